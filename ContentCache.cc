@@ -0,0 +1,326 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>        // for errno
+#include <fcntl.h>        // for O_CLOEXEC
+#include <poll.h>         // for poll()
+#include <sys/inotify.h>  // for inotify_init1(), inotify_add_watch()
+#include <sys/stat.h>     // for stat(), fstat()
+#include <unistd.h>       // for pipe2(), read(), close()
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./ContentCache.h"
+#include "./HttpUtils.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+// How many shards the cache is split into.
+static const size_t kNumShards = 16;
+
+// What happens to a file, or to a watched directory itself, that should
+// drop the files cached from it.
+static const uint32_t kWatchEvents =
+  IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+  IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+ContentCache::ContentCache(size_t max_bytes, size_t max_file_bytes,
+                           size_t max_fds)
+  : max_bytes_per_shard_(max_bytes / kNumShards),
+    max_file_bytes_(max_file_bytes),
+    max_fds_per_shard_((max_fds + kNumShards - 1) / kNumShards),
+    shards_(kNumShards),
+    inotify_fd_(-1) {
+  for (Shard& shard : shards_) {
+    Verify333(pthread_mutex_init(&shard.lock, nullptr) == 0);
+  }
+  Verify333(pthread_mutex_init(&watch_lock_, nullptr) == 0);
+
+  // Without inotify, or the pipe to stop its thread, every lookup checks
+  // its file instead.
+  inotify_fd_ = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd_ != -1 && pipe2(stop_fds_, O_CLOEXEC) != 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+  if (inotify_fd_ != -1) {
+    Verify333(pthread_create(&thread_, nullptr, &WatcherThreadFn,
+                             static_cast<void*>(this)) == 0);
+  }
+}
+
+ContentCache::~ContentCache() {
+  if (inotify_fd_ != -1) {
+    close(stop_fds_[1]);
+    Verify333(pthread_join(thread_, nullptr) == 0);
+    close(stop_fds_[0]);
+    close(inotify_fd_);
+  }
+  Verify333(pthread_mutex_destroy(&watch_lock_) == 0);
+  for (Shard& shard : shards_) {
+    Verify333(pthread_mutex_destroy(&shard.lock) == 0);
+  }
+}
+
+ContentCache::Shard* ContentCache::ShardFor(const string& key) {
+  return &shards_[std::hash<string>()(key) % kNumShards];
+}
+
+shared_ptr<const ContentCache::Entry> ContentCache::Lookup(
+    const string& key) {
+  Shard* shard = ShardFor(key);
+  Verify333(pthread_mutex_lock(&shard->lock) == 0);
+  auto it = shard->slots.find(key);
+  if (it == shard->slots.end()) {
+    shard->stats.misses++;
+    Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+    return nullptr;
+  }
+
+  // An unwatched file has to be checked every time; a watched one only
+  // if the watcher has seen something happen to it.  That may be an
+  // event from before the file was cached, which the kernel hadn't
+  // delivered yet, so it isn't reason enough to drop the entry.
+  shared_ptr<Item> item = it->second.item;
+  struct stat st;
+  if (!item->path.empty() &&
+      (!item->watched || item->suspect.exchange(false)) &&
+      (stat(item->path.c_str(), &st) != 0 ||
+       !SameFileVersion(st, item->st))) {
+    EraseLocked(shard, it);
+    shard->stats.invalidations++;
+    shard->stats.misses++;
+    Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+    return nullptr;
+  }
+
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru_pos);
+  shard->stats.hits++;
+  Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+  return item;
+}
+
+shared_ptr<const ContentCache::Entry> ContentCache::Insert(
+    const string& key, Entry entry) {
+  // Have the watcher track the item before reading the file, so that a
+  // change made after we read it can't be missed.  One made while we
+  // read it shows up in the file's metadata.
+  auto item = std::make_shared<Item>();
+  static_cast<Entry&>(*item) = std::move(entry);
+  string dir = item->path.substr(0, item->path.find_last_of('/'));
+  item->watched = !item->path.empty() && Watch(dir.empty() ? "/" : dir);
+  if (item->watched) {
+    Verify333(pthread_mutex_lock(&watch_lock_) == 0);
+    auto& items = items_by_path_[item->path];
+    size_t live = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (!items[i].expired()) {
+        items[live++] = items[i];
+      }
+    }
+    items.resize(live);
+    items.push_back(item);
+    Verify333(pthread_mutex_unlock(&watch_lock_) == 0);
+  }
+
+  size_t size = item->st.st_size;
+  if (item->mapping != nullptr) {
+    // Nothing to read: the contents are already in memory.
+  } else if (size <= max_file_bytes_) {
+    string contents(size, '\0');
+    struct stat after;
+    int fd = item->file->fd();
+    if (WrappedPread(fd, &contents[0], size, 0) !=
+        static_cast<ssize_t>(size) ||
+        fstat(fd, &after) != 0 || !SameFileVersion(item->st, after))
+      return item;
+    item->contents = std::make_shared<const string>(std::move(contents));
+    item->file.reset();
+  } else if (max_fds_per_shard_ == 0) {
+    return item;
+  }
+
+  size_t cost = Cost(*item);
+  if (cost > max_bytes_per_shard_)
+    return item;
+  size_t fds = (item->file != nullptr) ? 1 : 0;
+
+  Shard* shard = ShardFor(key);
+  Verify333(pthread_mutex_lock(&shard->lock) == 0);
+  auto it = shard->slots.find(key);
+  if (it != shard->slots.end()) {
+    EraseLocked(shard, it);
+  }
+  while ((shard->bytes + cost > max_bytes_per_shard_ ||
+          shard->fds + fds > max_fds_per_shard_) &&
+         !shard->lru.empty()) {
+    EraseLocked(shard, shard->slots.find(shard->lru.back()));
+    shard->stats.evictions++;
+  }
+  shard->lru.push_front(key);
+  shard->slots[key] = {item, shard->lru.begin()};
+  shard->bytes += cost;
+  shard->fds += fds;
+  Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+  return item;
+}
+
+ContentCache::Stats ContentCache::GetStats() {
+  Stats total;
+  for (Shard& shard : shards_) {
+    Verify333(pthread_mutex_lock(&shard.lock) == 0);
+    total.hits += shard.stats.hits;
+    total.misses += shard.stats.misses;
+    total.evictions += shard.stats.evictions;
+    total.invalidations += shard.stats.invalidations;
+    total.entries += shard.slots.size();
+    total.bytes += shard.bytes;
+    total.fds += shard.fds;
+    Verify333(pthread_mutex_unlock(&shard.lock) == 0);
+  }
+  return total;
+}
+
+void ContentCache::EraseLocked(
+    Shard* shard, std::unordered_map<string, Slot>::iterator it) {
+  const Item& item = *it->second.item;
+  shard->bytes -= Cost(item);
+  shard->fds -= (item.file != nullptr) ? 1 : 0;
+  shard->lru.erase(it->second.lru_pos);
+  shard->slots.erase(it);
+}
+
+size_t ContentCache::Cost(const Item& item) {
+  size_t cost = sizeof(Item) + item.path.size() + item.content_type.size();
+  if (item.contents != nullptr) {
+    cost += item.contents->size();
+  }
+  if (item.header_block != nullptr) {
+    cost += item.header_block->size();
+  }
+  for (const Entry::Encoded& encoded : item.encoded) {
+    cost += sizeof(encoded) + encoded.etag.size() +
+            encoded.header_block->size();
+  }
+  return cost;
+}
+
+bool ContentCache::Watch(const string& dir) {
+  if (inotify_fd_ == -1)
+    return false;
+
+  Verify333(pthread_mutex_lock(&watch_lock_) == 0);
+  bool ok = (dir_watches_.count(dir) > 0);
+  if (!ok) {
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(),
+                               kWatchEvents | IN_ONLYDIR);
+    if (wd != -1) {
+      watch_dirs_[wd] = dir;
+      dir_watches_[dir] = wd;
+      ok = true;
+    }
+  }
+  Verify333(pthread_mutex_unlock(&watch_lock_) == 0);
+  return ok;
+}
+
+void ContentCache::SuspectLocked(const string& path) {
+  if (path.empty()) {
+    for (auto& entry : items_by_path_) {
+      for (auto& weak : entry.second) {
+        shared_ptr<Item> item = weak.lock();
+        if (item) {
+          item->suspect = true;
+        }
+      }
+    }
+    return;
+  }
+
+  // Forget the items that are gone while we're at it.
+  auto it = items_by_path_.find(path);
+  if (it == items_by_path_.end())
+    return;
+  auto& items = it->second;
+  size_t live = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    shared_ptr<Item> item = items[i].lock();
+    if (item) {
+      item->suspect = true;
+      items[live++] = items[i];
+    }
+  }
+  items.resize(live);
+  if (items.empty()) {
+    items_by_path_.erase(it);
+  }
+}
+
+void* ContentCache::WatcherThreadFn(void* arg) {
+  ContentCache* cache = static_cast<ContentCache*>(arg);
+  alignas(struct inotify_event) char buf[16 * 1024];
+
+  while (1) {
+    struct pollfd fds[2];
+    fds[0].fd = cache->inotify_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = cache->stop_fds_[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents != 0)
+      break;  // the write end was closed: time to stop
+
+    ssize_t len = read(cache->inotify_fd_, buf, sizeof(buf));
+    if (len <= 0)
+      continue;
+
+    Verify333(pthread_mutex_lock(&cache->watch_lock_) == 0);
+    for (char* p = buf; p < buf + len; ) {
+      struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      auto dir = cache->watch_dirs_.find(event->wd);
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so anything may have changed.
+        cache->SuspectLocked("");
+      } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        // The directory itself went away, so nothing in it is watched
+        // any more; it has to be watched afresh for new items.
+        cache->SuspectLocked("");
+        if (dir != cache->watch_dirs_.end()) {
+          cache->dir_watches_.erase(dir->second);
+          cache->watch_dirs_.erase(dir);
+        }
+      } else if (event->len > 0 && dir != cache->watch_dirs_.end()) {
+        cache->SuspectLocked(dir->second + "/" + event->name);
+      }
+    }
+    Verify333(pthread_mutex_unlock(&cache->watch_lock_) == 0);
+  }
+  return nullptr;
+}
+
+}  // namespace hw4
@@ -0,0 +1,199 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_CONTENTCACHE_H_
+#define HW4_CONTENTCACHE_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <stddef.h>
+#include <stdint.h>     // for uint64_t, etc.
+#include <sys/stat.h>   // for struct stat
+#include <atomic>
+#include <list>         // for std::list
+#include <memory>
+#include <string>       // for std::string
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "./HttpCompression.h"
+#include "./HttpResponse.h"
+
+namespace hw4 {
+
+// A ContentCache keeps what it takes to serve frequently requested
+// static files: their metadata, the headers that describe them, and
+// either their contents, for small files, or an open descriptor, for
+// big ones.  Serving a small file again takes no file system calls at
+// all: no path checks, no open() and no read(); serving a big one takes
+// only the sendfile() that sends it.  The contents are immutable shared
+// buffers and the descriptors are shared OpenFiles, so a response can
+// send them without copying, and keep them even if the entry is
+// evicted.
+//
+// The cache is bounded by the memory its entries take and by the number
+// of descriptors it holds open, and evicts the least recently used
+// entries to stay under both.  It is split into shards, each with its
+// own lock and its own share of the bounds, so that worker threads
+// rarely wait on one another.
+//
+// Entries are keyed by the path a client asked for, and also remember
+// the resolved path of the file.  A background thread watches the
+// directories of cached files through inotify; once a file has been
+// written to, replaced, renamed or removed, the next lookup of it checks
+// the file's inode, size and modification time, and drops the entry if
+// they changed.  For a file whose directory can't be watched, every
+// lookup checks them.  A file with no path, e.g. one served from a
+// StaticBundle, never changes, and is never checked.
+class ContentCache {
+ public:
+  // A cached file.  Exactly one of "contents", "file" and "mapping" is
+  // set.
+  struct Entry {
+    std::shared_ptr<const std::string> contents;
+    std::shared_ptr<const OpenFile> file;
+
+    // Contents that live in memory the cache doesn't own, e.g. a mapped
+    // StaticBundle, and what keeps them there.
+    std::shared_ptr<const void> mapping;
+    std::string_view mapped;
+
+    struct stat st;            // as of when the file was opened
+    std::string path;          // the resolved path, or empty if immutable
+    std::string content_type;  // empty if unknown
+    std::string etag;
+
+    // The response headers that depend only on the file, e.g. its
+    // validators, rendered once (see HttpResponse::set_header_block()).
+    std::shared_ptr<const std::string> header_block;
+
+    // Compressed copies of the file, the best first, each with its own
+    // entity tag and headers (see PrecompressedStore.h).  The cache
+    // doesn't count their contents against its bound, since they belong
+    // to the store (or to the bundle).
+    struct Encoded {
+      ContentCoding coding;
+      std::shared_ptr<const void> owner;  // keeps "contents" alive
+      std::string_view contents;
+      std::string etag;
+      std::shared_ptr<const std::string> header_block;
+    };
+    std::vector<Encoded> encoded;
+  };
+
+  // Counters, for monitoring.
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;      // to make room for other files
+    uint64_t invalidations = 0;  // because a file changed
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t fds = 0;
+  };
+
+  // Construct a cache whose entries take at most "max_bytes" of memory,
+  // which holds the contents of files up to "max_file_bytes" long, and
+  // which keeps at most "max_fds" bigger files open.  Starts the watcher
+  // thread, if inotify is available.
+  ContentCache(size_t max_bytes, size_t max_file_bytes, size_t max_fds);
+
+  // Stops the watcher thread.
+  virtual ~ContentCache();
+
+  // Returns the entry for "key", or nullptr if there isn't one (or the
+  // file has changed since it was cached).
+  std::shared_ptr<const Entry> Lookup(const std::string& key);
+
+  // Cache "entry", whose "file" is set and whose "contents" isn't, under
+  // "key".  If the file is small enough, its contents are read in and
+  // the entry lets go of the file.  An immutable entry, whose "mapping"
+  // is set, is cached as it is.  Returns the entry as cached, or, if it
+  // can't be cached (e.g. the file changed while it was being read), as
+  // given.
+  std::shared_ptr<const Entry> Insert(const std::string& key, Entry entry);
+
+  // Returns the size of the biggest file whose contents the cache holds.
+  size_t max_file_bytes() const { return max_file_bytes_; }
+
+  // Returns true if files are watched through inotify.
+  bool watching() const { return inotify_fd_ != -1; }
+
+  Stats GetStats();
+
+ private:
+  // An entry, and whether the watcher has seen an event for its file
+  // since the file was last checked.
+  struct Item : public Entry {
+    std::atomic<bool> suspect{false};
+    bool watched = false;  // if not, lookups check the file every time
+  };
+
+  struct Slot {
+    std::shared_ptr<Item> item;
+    std::list<std::string>::iterator lru_pos;  // position in Shard::lru
+  };
+
+  struct Shard {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, Slot> slots;
+    std::list<std::string> lru;  // keys, most recently used first
+    size_t bytes = 0;
+    size_t fds = 0;
+    Stats stats;
+  };
+
+  // Returns roughly how much memory "item" takes.
+  static size_t Cost(const Item& item);
+
+  Shard* ShardFor(const std::string& key);
+
+  // Remove the slot "it" points to from "shard", which must be locked.
+  static void EraseLocked(
+      Shard* shard, std::unordered_map<std::string, Slot>::iterator it);
+
+  // Make sure the directory "dir" is watched.  Returns false if it
+  // can't be.
+  bool Watch(const std::string& dir);
+
+  // Mark the items cached from "path" as suspect, so that the next
+  // lookup checks the file; or, if "path" is empty, every watched item.
+  // watch_lock_ must be held.
+  void SuspectLocked(const std::string& path);
+
+  // The watcher thread's start routine; "arg" is the ContentCache.
+  static void* WatcherThreadFn(void* arg);
+
+  size_t max_bytes_per_shard_;
+  size_t max_file_bytes_;
+  size_t max_fds_per_shard_;
+  std::vector<Shard> shards_;
+
+  // The inotify instance and the pipe that tells the watcher thread to
+  // stop, or -1.
+  int inotify_fd_;
+  int stop_fds_[2];
+  pthread_t thread_;
+
+  // Guards everything below.
+  pthread_mutex_t watch_lock_;
+  std::unordered_map<int, std::string> watch_dirs_;  // by watch descriptor
+  std::unordered_map<std::string, int> dir_watches_;
+  std::unordered_map<std::string, std::vector<std::weak_ptr<Item>>>
+    items_by_path_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_CONTENTCACHE_H_
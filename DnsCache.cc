@@ -0,0 +1,168 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/types.h>   // for getaddrinfo(), etc.
+#include <sys/socket.h>  // for getaddrinfo(), etc.
+#include <netdb.h>       // for getaddrinfo(), getnameinfo()
+#include <string.h>      // for memset()
+#include <time.h>        // for time()
+#include <string>
+
+#include "./DnsCache.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::string;
+
+namespace hw4 {
+
+// The most addresses that can wait for the resolver thread at once.
+// Lookups that miss while the queue is full are simply not resolved.
+static const uint32_t kMaxQueued = 256;
+
+DnsCache::DnsCache(uint32_t max_entries, uint32_t ttl_secs)
+  : max_entries_(max_entries), ttl_secs_(ttl_secs),
+    queue_len_(0), terminate_(false) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+  Verify333(pthread_cond_init(&cond_, nullptr) == 0);
+  Verify333(pthread_create(&thread_, nullptr, &ResolverThreadFn,
+                           static_cast<void*>(this)) == 0);
+}
+
+DnsCache::~DnsCache() {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  terminate_ = true;
+  Verify333(pthread_cond_signal(&cond_) == 0);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  Verify333(pthread_join(thread_, nullptr) == 0);
+
+  Verify333(pthread_cond_destroy(&cond_) == 0);
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+string DnsCache::Lookup(const string& addr) {
+  time_t now = time(nullptr);
+  string name = addr;
+
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  auto it = entries_.find(addr);
+  if (it != entries_.end()) {
+    Entry& entry = it->second;
+    lru_.splice(lru_.begin(), lru_, entry.lru_pos);
+    if (!entry.name.empty()) {
+      name = entry.name;
+    }
+    if (entry.resolving || now < entry.expires) {
+      Verify333(pthread_mutex_unlock(&lock_) == 0);
+      return name;
+    }
+    // The entry has gone stale; keep serving it while we refresh it.
+  }
+
+  if (queue_len_ < kMaxQueued) {
+    if (it == entries_.end()) {
+      // Make room, skipping entries the resolver is still working on.
+      auto victim = lru_.end();
+      while (entries_.size() >= max_entries_ && victim != lru_.begin()) {
+        --victim;
+        auto vit = entries_.find(*victim);
+        if (!vit->second.resolving) {
+          entries_.erase(vit);
+          victim = lru_.erase(victim);
+        }
+      }
+      if (entries_.size() < max_entries_) {
+        lru_.push_front(addr);
+        Entry& entry = entries_[addr];
+        entry.expires = 0;
+        entry.lru_pos = lru_.begin();
+        it = entries_.find(addr);
+      }
+    }
+    if (it != entries_.end()) {
+      it->second.resolving = true;
+      queue_.push_back(addr);
+      queue_len_++;
+      Verify333(pthread_cond_signal(&cond_) == 0);
+    }
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return name;
+}
+
+uint32_t DnsCache::size() {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  uint32_t res = entries_.size();
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return res;
+}
+
+void* DnsCache::ResolverThreadFn(void* arg) {
+  DnsCache* cache = static_cast<DnsCache*>(arg);
+
+  Verify333(pthread_mutex_lock(&cache->lock_) == 0);
+  while (1) {
+    while (cache->queue_.empty() && !cache->terminate_) {
+      Verify333(pthread_cond_wait(&cache->cond_, &cache->lock_) == 0);
+    }
+    if (cache->terminate_)
+      break;
+
+    string addr = cache->queue_.front();
+    cache->queue_.pop_front();
+    cache->queue_len_--;
+
+    // Do the (possibly slow) lookup without holding the lock.  Failures
+    // are cached too, as the numeric address, so that an address with
+    // no DNS name isn't looked up again until its entry expires.
+    Verify333(pthread_mutex_unlock(&cache->lock_) == 0);
+    string name;
+    if (!Resolve(addr, &name)) {
+      name = addr;
+    }
+    time_t expires = time(nullptr) + cache->ttl_secs_;
+    Verify333(pthread_mutex_lock(&cache->lock_) == 0);
+
+    auto it = cache->entries_.find(addr);
+    if (it != cache->entries_.end()) {
+      it->second.name = name;
+      it->second.expires = expires;
+      it->second.resolving = false;
+    }
+  }
+  Verify333(pthread_mutex_unlock(&cache->lock_) == 0);
+  return nullptr;
+}
+
+bool DnsCache::Resolve(const string& addr, string* const name) {
+  // Turn the printable address back into a sockaddr, without touching DNS.
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_flags = AI_NUMERICHOST;
+  struct addrinfo* result;
+  if (getaddrinfo(addr.c_str(), nullptr, &hints, &result) != 0)
+    return false;
+
+  char host[NI_MAXHOST];
+  bool ok = (getnameinfo(result->ai_addr, result->ai_addrlen,
+                         host, sizeof(host), nullptr, 0,
+                         NI_NAMEREQD) == 0);
+  freeaddrinfo(result);
+  if (ok) {
+    *name = host;
+  }
+  return ok;
+}
+
+}  // namespace hw4
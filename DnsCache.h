@@ -0,0 +1,93 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_DNSCACHE_H_
+#define HW4_DNSCACHE_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <stdint.h>   // for uint32_t, etc.
+#include <time.h>     // for time_t
+#include <list>       // for std::list
+#include <string>     // for std::string
+#include <unordered_map>
+
+namespace hw4 {
+
+// A DnsCache maps numeric IP addresses (as printed by inet_ntop()) to
+// their reverse-DNS names, without ever making the caller wait for a
+// resolver.  A lookup that misses returns the numeric address right
+// away and queues the address for a background thread, which calls
+// getnameinfo() and caches the answer for later lookups.
+//
+// The cache holds at most a fixed number of entries, evicting the least
+// recently used one when full, and forgets answers (including failed
+// lookups) after a time-to-live so that DNS changes are picked up.
+class DnsCache {
+ public:
+  // Construct a cache holding at most "max_entries" names, each for at
+  // most "ttl_secs" seconds.  Starts the background resolver thread.
+  DnsCache(uint32_t max_entries, uint32_t ttl_secs);
+
+  // Stops the resolver thread, abandoning any queued lookups.
+  virtual ~DnsCache();
+
+  // Returns the DNS name of the numeric address "addr" if it is in the
+  // cache, and otherwise "addr" itself.  On a miss (or an expired entry)
+  // the address is queued for resolution in the background, unless the
+  // queue is already full.  Never blocks on the resolver.
+  std::string Lookup(const std::string& addr);
+
+  // Returns the number of addresses in the cache, including ones that
+  // are still waiting to be resolved.
+  uint32_t size();
+
+ private:
+  struct Entry {
+    std::string name;       // the DNS name; empty until resolved
+    time_t expires;         // when "name" goes stale
+    bool resolving;         // queued for (or in) the resolver thread
+    std::list<std::string>::iterator lru_pos;  // position in lru_
+  };
+
+  // The resolver thread's start routine; "arg" is the DnsCache.
+  static void* ResolverThreadFn(void* arg);
+
+  // Blocking reverse lookup of a numeric address.  Returns false if the
+  // address has no DNS name.
+  static bool Resolve(const std::string& addr, std::string* const name);
+
+  uint32_t max_entries_;
+  uint32_t ttl_secs_;
+
+  // Guards everything below.  cond_ wakes the resolver thread when an
+  // address is queued or the cache is being destroyed.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+
+  // The cached entries, and their addresses from most to least recently
+  // used.
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;
+
+  // Addresses waiting for the resolver thread.
+  std::list<std::string> queue_;
+  uint32_t queue_len_;
+
+  bool terminate_;
+  pthread_t thread_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_DNSCACHE_H_
@@ -12,7 +12,11 @@
  * author.
  */
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
 #include <cstdlib>
 #include <iostream>
@@ -66,4 +70,40 @@ bool FileReader::ReadFile(string* const contents) {
   return true;
 }
 
+bool FileReader::Stat(struct stat* const st) {
+  string full_file = basedir_ + "/" + fname_;
+  if (!IsPathSafe(basedir_, full_file)) {
+    return false;
+  }
+  return stat(full_file.c_str(), st) == 0 && S_ISREG(st->st_mode);
+}
+
+bool FileReader::Open(int* const fd, struct stat* const st,
+                      string* const resolved_path) {
+  string full_file = basedir_ + "/" + fname_;
+  if (!IsPathSafe(basedir_, full_file)) {
+    return false;
+  }
+
+  // Check the file we actually opened, not whatever is at the path now.
+  int file_fd = open(full_file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_fd == -1) {
+    return false;
+  }
+  if (fstat(file_fd, st) != 0 || !S_ISREG(st->st_mode)) {
+    close(file_fd);
+    return false;
+  }
+  if (resolved_path != nullptr) {
+    char path[PATH_MAX];
+    if (realpath(full_file.c_str(), path) == nullptr) {
+      close(file_fd);
+      return false;
+    }
+    *resolved_path = path;
+  }
+  *fd = file_fd;
+  return true;
+}
+
 }  // namespace hw4
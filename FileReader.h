@@ -12,6 +12,7 @@
 #ifndef HW4_FILEREADER_H_
 #define HW4_FILEREADER_H_
 
+#include <sys/stat.h>  // for struct stat
 #include <string>
 
 namespace hw4 {
@@ -42,6 +43,25 @@ class FileReader {
   // contents of the file.
   bool ReadFile(std::string* const contents);
 
+  // Look up the file specified by the constructor arguments without
+  // reading it, e.g. to see whether a client's copy is still current.
+  //
+  // Return false if the file isn't a regular file that can be found, or
+  // if it exists above the basedir (as for ReadFile()).  Otherwise,
+  // return true and use output parameter "st" to return its metadata.
+  bool Stat(struct stat* const st);
+
+  // Open the file specified by the constructor arguments for reading,
+  // without reading it in, e.g. to send it with sendfile().
+  //
+  // Return false under the same conditions as Stat().  Otherwise, return
+  // true, and use output parameters "fd" to return the open file, which
+  // the caller must close, and "st" to return its metadata.  If
+  // "resolved_path" isn't null, also return the file's absolute path,
+  // with no symbolic links, "." or ".." in it.
+  bool Open(int* const fd, struct stat* const st,
+            std::string* const resolved_path = nullptr);
+
  private:
   std::string basedir_;
   std::string fname_;
@@ -0,0 +1,58 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string>
+#include <string_view>
+
+#include "./HtmlTemplate.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::string;
+using std::string_view;
+
+namespace hw4 {
+
+HtmlTemplate::HtmlTemplate(string_view text) : constant_size_(0) {
+  while (true) {
+    size_t open = text.find('{');
+    if (open == string_view::npos)
+      break;
+    size_t close = text.find('}', open);
+    Verify333(close != string_view::npos);
+    pieces_.emplace_back(text.substr(0, open));
+    text.remove_prefix(close + 1);
+  }
+  pieces_.emplace_back(text);
+  for (const string& piece : pieces_) {
+    constant_size_ += piece.size();
+  }
+}
+
+void HtmlTemplate::Render(std::initializer_list<string_view> values,
+                          string* out) const {
+  Verify333(values.size() == num_slots());
+  size_t size = constant_size_;
+  for (string_view value : values) {
+    size += value.size();
+  }
+  out->reserve(out->size() + size);
+
+  auto piece = pieces_.begin();
+  out->append(*piece++);
+  for (string_view value : values) {
+    out->append(value).append(*piece++);
+  }
+}
+
+}  // namespace hw4
@@ -0,0 +1,58 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_HTMLTEMPLATE_H_
+#define HW4_HTMLTEMPLATE_H_
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hw4 {
+
+// A fragment of a page with slots for the parts that vary, e.g.:
+//
+//   <div>{count} results found for <b>{terms}</b></div>
+//
+// The text is split into its constant pieces once, when the template is
+// built, so filling it in is just a series of appends.  A slot is a
+// name in braces; the names only document what goes where, since
+// Render() fills the slots in the order they appear.  The template
+// text can't otherwise contain '{'.
+//
+// Render() doesn't escape anything: callers pass values that are
+// already safe to put in the page (see EscapeHtml() in HttpUtils.h).
+class HtmlTemplate {
+ public:
+  explicit HtmlTemplate(std::string_view text);
+  virtual ~HtmlTemplate() { }
+
+  // Returns the number of slots.
+  size_t num_slots() const { return pieces_.size() - 1; }
+
+  // Append the template to "out", with the i'th of "values" in the i'th
+  // slot.  There must be exactly one value per slot.
+  void Render(std::initializer_list<std::string_view> values,
+              std::string* out) const;
+
+ private:
+  // The constant text before, between and after the slots; there is
+  // always one more piece than there are slots.
+  std::vector<std::string> pieces_;
+
+  // The total size of the pieces.
+  size_t constant_size_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_HTMLTEMPLATE_H_
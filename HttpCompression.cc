@@ -0,0 +1,282 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <ctype.h>    // for tolower()
+#include <stdlib.h>   // for strtod()
+#include <zlib.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "./HttpCompression.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::shared_ptr;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace hw4 {
+
+// How many finished deflate contexts each thread keeps for reuse.
+static const size_t kMaxIdleStreams = 8;
+
+// The zlib window size, and what to add to it to get a gzip wrapper
+// instead of a zlib one (see deflateInit2() in zlib.h).
+static const int kWindowBits = 15;
+static const int kGzipWindowBits = 16;
+static const int kMemLevel = 8;
+
+struct Deflater::Stream {
+  z_stream z;
+  ContentCoding coding;
+  int level;
+};
+
+// A thread's idle deflate contexts, freed when the thread exits.
+class IdleStreams {
+ public:
+  IdleStreams() { }
+  IdleStreams(const IdleStreams&) = delete;
+  IdleStreams& operator=(const IdleStreams&) = delete;
+  ~IdleStreams() {
+    for (Deflater::Stream* stream : streams_) {
+      Free(stream);
+    }
+  }
+
+  // Returns an idle context for "coding" and "level", or nullptr if the
+  // thread has none.
+  Deflater::Stream* Take(ContentCoding coding, int level) {
+    for (size_t i = 0; i < streams_.size(); i++) {
+      Deflater::Stream* stream = streams_[i];
+      if (stream->coding == coding && stream->level == level) {
+        streams_[i] = streams_.back();
+        streams_.pop_back();
+        return stream;
+      }
+    }
+    return nullptr;
+  }
+
+  // Reset "stream" and keep it, or free it if the thread has enough.
+  void Give(Deflater::Stream* stream) {
+    if (streams_.size() < kMaxIdleStreams && deflateReset(&stream->z) == Z_OK) {
+      streams_.push_back(stream);
+    } else {
+      Free(stream);
+    }
+  }
+
+ private:
+  static void Free(Deflater::Stream* stream) {
+    deflateEnd(&stream->z);
+    delete stream;
+  }
+
+  vector<Deflater::Stream*> streams_;
+};
+
+static thread_local IdleStreams idle_streams;
+
+// Returns the q-value in the parameters "params" of an Accept-Encoding
+// entry, e.g. "; q=0.5", or 1 if there isn't one.
+static double QValue(string_view params) {
+  size_t q = params.find("q=");
+  if (q == string_view::npos)
+    return 1.0;
+  string value(params.substr(q + 2));
+  return strtod(value.c_str(), nullptr);
+}
+
+// Returns "s" without leading and trailing whitespace.
+static string_view Trim(string_view s) {
+  size_t first = s.find_first_not_of(" \t");
+  if (first == string_view::npos)
+    return string_view();
+  return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+}
+
+// Returns true if "a" and "b" are the same, ignoring case.
+static bool SameToken(string_view a, string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (tolower(static_cast<unsigned char>(a[i])) !=
+        tolower(static_cast<unsigned char>(b[i])))
+      return false;
+  }
+  return true;
+}
+
+ContentCoding NegotiateCoding(string_view accept_encoding) {
+  // The q-values of gzip, deflate and "*"; -1 where not listed.
+  double gzip = -1, deflate = -1, any = -1;
+  while (!accept_encoding.empty()) {
+    size_t comma = accept_encoding.find(',');
+    string_view entry = accept_encoding.substr(0, comma);
+    accept_encoding = (comma == string_view::npos) ?
+                      string_view() : accept_encoding.substr(comma + 1);
+
+    size_t semi = entry.find(';');
+    string_view name = Trim(entry.substr(0, semi));
+    double q = (semi == string_view::npos) ? 1.0 : QValue(entry.substr(semi));
+    if (SameToken(name, "gzip") || SameToken(name, "x-gzip")) {
+      gzip = q;
+    } else if (SameToken(name, "deflate")) {
+      deflate = q;
+    } else if (name == "*") {
+      any = q;
+    }
+  }
+
+  // "*" covers whichever of the two wasn't listed by name.
+  if (gzip < 0)
+    gzip = any;
+  if (deflate < 0)
+    deflate = any;
+  if (gzip > 0 && gzip >= deflate)
+    return ContentCoding::kGzip;
+  if (deflate > 0)
+    return ContentCoding::kDeflate;
+  return ContentCoding::kIdentity;
+}
+
+double AcceptedQValue(string_view accept_encoding, ContentCoding coding) {
+  string_view coding_name = CodingName(coding);
+  double q = -1, any = -1;
+  while (!accept_encoding.empty()) {
+    size_t comma = accept_encoding.find(',');
+    string_view entry = accept_encoding.substr(0, comma);
+    accept_encoding = (comma == string_view::npos) ?
+                      string_view() : accept_encoding.substr(comma + 1);
+
+    size_t semi = entry.find(';');
+    string_view name = Trim(entry.substr(0, semi));
+    double entry_q =
+      (semi == string_view::npos) ? 1.0 : QValue(entry.substr(semi));
+    if (SameToken(name, coding_name) ||
+        (coding == ContentCoding::kGzip && SameToken(name, "x-gzip"))) {
+      q = entry_q;
+    } else if (name == "*") {
+      any = entry_q;
+    }
+  }
+  if (q < 0)
+    q = any;
+  return (q > 0) ? q : 0;
+}
+
+const char* CodingName(ContentCoding coding) {
+  switch (coding) {
+    case ContentCoding::kGzip:    return "gzip";
+    case ContentCoding::kDeflate: return "deflate";
+    case ContentCoding::kBrotli:  return "br";
+    default:                      return "identity";
+  }
+}
+
+Deflater::Deflater(ContentCoding coding, int level)
+  : stream_(idle_streams.Take(coding, level)) {
+  Verify333(coding == ContentCoding::kGzip ||
+            coding == ContentCoding::kDeflate);
+  if (stream_ != nullptr)
+    return;
+
+  stream_ = new Stream();
+  stream_->coding = coding;
+  stream_->level = level;
+  int window_bits = kWindowBits;
+  if (coding == ContentCoding::kGzip) {
+    window_bits += kGzipWindowBits;
+  }
+  Verify333(deflateInit2(&stream_->z, level, Z_DEFLATED, window_bits,
+                         kMemLevel, Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+Deflater::~Deflater() {
+  if (stream_ != nullptr) {
+    idle_streams.Give(stream_);
+  }
+}
+
+void Deflater::Compress(string_view in, bool finish, string* out) {
+  z_stream* z = &stream_->z;
+  z->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  z->avail_in = in.size();
+
+  // Make room for as much as zlib says the input could need, plus the
+  // flush marker, and go around again if that wasn't enough.
+  int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+  do {
+    size_t old_size = out->size();
+    size_t room = deflateBound(z, z->avail_in) + 16;
+    out->resize(old_size + room);
+    z->next_out = reinterpret_cast<Bytef*>(&(*out)[old_size]);
+    z->avail_out = room;
+    int res = deflate(z, flush);
+    Verify333(res != Z_STREAM_ERROR);
+    out->resize(old_size + room - z->avail_out);
+  } while (z->avail_out == 0);
+}
+
+// Compresses what another body source produces.
+class CompressingSource : public HttpResponse::BodySource {
+ public:
+  CompressingSource(shared_ptr<HttpResponse::BodySource> source,
+                    Deflater&& deflater)
+    : source_(std::move(source)), deflater_(std::move(deflater)) { }
+
+  bool Next(string* chunk) override {
+    plain_.clear();
+    bool more = source_->Next(&plain_);
+    deflater_.Compress(plain_, !more, chunk);
+    return more;
+  }
+
+ private:
+  shared_ptr<HttpResponse::BodySource> source_;
+  Deflater deflater_;
+
+  // What the source produced, before compression.
+  string plain_;
+};
+
+void CompressResponse(ContentCoding coding, int level,
+                      HttpResponse* response) {
+  string plain;
+  plain.reserve(response->body_size());
+  for (const HttpResponse::Segment& seg : response->ReleaseBody()) {
+    Verify333(!seg.is_file());
+    plain.append(seg.bytes());
+  }
+
+  Deflater deflater(coding, level);
+  string compressed;
+  shared_ptr<HttpResponse::BodySource> source = response->ReleaseBodySource();
+  deflater.Compress(plain, source == nullptr, &compressed);
+  response->AppendToBody(std::move(compressed));
+  if (source != nullptr) {
+    response->set_body_source(std::make_shared<CompressingSource>(
+        std::move(source), std::move(deflater)));
+  }
+
+  response->set_header("Content-Encoding", CodingName(coding));
+  response->set_header("Vary", "Accept-Encoding");
+}
+
+}  // namespace hw4
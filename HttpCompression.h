@@ -0,0 +1,85 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_HTTPCOMPRESSION_H_
+#define HW4_HTTPCOMPRESSION_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "./HttpResponse.h"
+
+namespace hw4 {
+
+// The content-codings (RFC 7231:3.1.2.1) the server can compress
+// responses with.
+enum class ContentCoding {
+  kIdentity,  // not compressed
+  kGzip,      // the gzip format (RFC 1952)
+  kDeflate,   // the zlib format (RFC 1950)
+  kBrotli,    // brotli (RFC 7932); only for precompressed files
+};
+
+// Returns the coding to compress a response with, given the value of
+// the request's Accept-Encoding header: the one the client prefers
+// (by q-value), gzip if it likes both equally, and kIdentity if it
+// accepts neither or sent no header.
+ContentCoding NegotiateCoding(std::string_view accept_encoding);
+
+// Returns the q-value the client gives "coding" in its Accept-Encoding
+// header "accept_encoding", counting "*", or 0 if it doesn't accept it.
+double AcceptedQValue(std::string_view accept_encoding, ContentCoding coding);
+
+// Returns the name of "coding" as it goes in a Content-Encoding header.
+const char* CodingName(ContentCoding coding);
+
+// Compresses one stream of data, a piece at a time.  Deflate contexts
+// are costly to set up, so each thread keeps a few finished ones to
+// reuse: a Deflater takes one from the thread that constructs it, and
+// gives it back to the thread that destroys it.
+class Deflater {
+ public:
+  // Start a stream in "coding" (kGzip or kDeflate) at zlib compression
+  // level "level" (1-9).
+  Deflater(ContentCoding coding, int level);
+  Deflater(Deflater&& other) : stream_(other.stream_) {
+    other.stream_ = nullptr;
+  }
+  Deflater(const Deflater&) = delete;
+  Deflater& operator=(const Deflater&) = delete;
+  virtual ~Deflater();
+
+  // Compress "in", appending the output to "out".  With "finish", end
+  // the stream; otherwise flush it, so that the client can decompress
+  // everything given so far without waiting for more.
+  void Compress(std::string_view in, bool finish, std::string* out);
+
+  // A deflate context (see HttpCompression.cc).
+  struct Stream;
+
+ private:
+  Stream* stream_;
+};
+
+// Compress the body of "response" in "coding" (kGzip or kDeflate) at zlib
+// compression level "level", and mark it with the Content-Encoding and
+// Vary headers to say so.  A streamed response stays streamed: what the
+// body holds now is compressed (and flushed) right away, and the rest
+// as the body source produces it.  The body can't contain files.
+void CompressResponse(ContentCoding coding, int level,
+                      HttpResponse* response);
+
+}  // namespace hw4
+
+#endif  // HW4_HTTPCOMPRESSION_H_
@@ -12,25 +12,44 @@
  * author.
  */
 
+#include <errno.h>
 #include <stdint.h>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
-#include <map>
+#include <stdio.h>    // for snprintf()
+#include <string.h>   // for memset()
+#include <sys/sendfile.h>
+#include <sys/socket.h>  // for sendmsg()
+#include <sys/uio.h>  // for writev()
+#include <algorithm>  // for std::min()
 #include <string>
-#include <vector>
+#include <string_view>
+#include <utility>    // for std::move
 
 #include "./HttpRequest.h"
 #include "./HttpUtils.h"
 #include "./HttpConnection.h"
 
-using std::map;
 using std::string;
-using std::vector;
 
 namespace hw4 {
 
 static const char* kHeaderEnd = "\r\n\r\n";
-static const int kHeaderEndLen = 4;
+
+// The least free space we read into with each read().
+static const int kReadChunkSize = 8192;
+
+// The most queued pieces FlushQueuedOutput() hands to one writev().
+static const int kMaxIovecs = 64;
+
+// How much of a file in a response body is read in at a time.
+static const size_t kFileChunkSize = 64 * 1024;
+
+// Returns the line that starts a chunk of "size" bytes in chunked
+// transfer-encoding: the size in hex, then CRLF.
+static string ChunkHeader(size_t size) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%zx\r\n", size);
+  return buf;
+}
 
 bool HttpConnection::GetNextRequest(HttpRequest* const request) {
   // Use WrappedRead from HttpUtils.cc to read bytes from the files into
@@ -41,8 +60,8 @@ bool HttpConnection::GetNextRequest(HttpRequest* const request) {
   // Hint: Try and read in a large amount of bytes each time you call
   // WrappedRead.
   //
-  // After reading complete request header, use ParseRequest() to parse into
-  // an HttpRequest and save to the output parameter request.
+  // After reading complete request header, use ParseBufferedRequest() to
+  // parse into an HttpRequest and save to the output parameter request.
   //
   // Important note: Clients may send back-to-back requests on the same socket.
   // This means WrappedRead may also end up reading more than one request.
@@ -50,94 +69,196 @@ bool HttpConnection::GetNextRequest(HttpRequest* const request) {
   // next time the caller invokes GetNextRequest()!
 
   // STEP 1:
-  unsigned char buf[1024];
-  size_t header_end;
-
-  while ((header_end = buffer_.find(kHeaderEnd)) == string::npos) {
-    int bytes_read = WrappedRead(fd_, buf, sizeof(buf));
+  while (!ParseBufferedRequest(request)) {
+    size_t space;
+    char* buf = buffer_.PrepareWrite(kReadChunkSize, &space);
+    int bytes_read = WrappedRead(fd_, reinterpret_cast<unsigned char*>(buf),
+                                 static_cast<int>(space));
     if (bytes_read <= 0) {  // connection closed or error occurred
       return false;
     }
-    buffer_.append(reinterpret_cast<char*>(buf), bytes_read);
+    buffer_.CommitWrite(bytes_read);
   }
-  string request_str = buffer_.substr(0, header_end + kHeaderEndLen);
-  buffer_ = buffer_.substr(header_end + kHeaderEndLen);
 
-  *request = HttpConnection::ParseRequest(request_str);
+  // The caller keeps the request after we read the next one.
+  request->TakeOwnership();
+  ReleaseRequests();
+  return true;
+}
+
+bool HttpConnection::WriteResponse(const HttpResponse& response) {
+  // fd_ blocks here, so flushing only stops once everything has been
+  // written or the connection fails.
+  QueueResponse(response);
+  return FlushQueuedOutput() && !has_queued_output();
+}
+
+bool HttpConnection::ReadAvailable(size_t max_buffered, bool* const eof) {
+  *eof = false;
+  while (buffered_bytes() < max_buffered) {
+    size_t space;
+    char* buf = buffer_.PrepareWrite(kReadChunkSize, &space);
+    space = std::min(space, max_buffered - buffered_bytes());
+    ssize_t res = read(fd_, buf, space);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    if (res == 0) {
+      *eof = true;
+      return true;
+    }
+    buffer_.CommitWrite(res);
+  }
   return true;
 }
 
-bool HttpConnection::WriteResponse(const HttpResponse& response) const {
-  string str = response.GenerateResponseString();
-  int res = WrappedWrite(fd_,
-                         reinterpret_cast<const unsigned char*>(str.c_str()),
-                         str.length());
-  if (res != static_cast<int>(str.length()))
+bool HttpConnection::ParseBufferedRequest(HttpRequest* const request) {
+  size_t len = buffer_.Scan(kHeaderEnd);
+  if (len == 0)
     return false;
+
+  request->Parse(buffer_.Take(len));
   return true;
 }
 
-HttpRequest HttpConnection::ParseRequest(const string& request) const {
-  HttpRequest req("/");  // by default, get "/".
+void HttpConnection::ReleaseRequests() {
+  buffer_.Release();
+}
 
-  // Plan for STEP 2:
-  // 1. Split the request into different lines (split on "\r\n").
-  // 2. Extract the URI from the first line and store it in req.URI.
-  // 3. For the rest of the lines in the request, track the header name and
-  //    value and store them in req.headers_ (e.g. HttpRequest::AddHeader).
-  //
-  // Hint: Take a look at HttpRequest.h for details about the HTTP header
-  // format that you need to parse.
-  //
-  // You'll probably want to look up boost functions for:
-  // - Splitting a string into lines on a "\r\n" delimiter
-  // - Trimming whitespace from the end of a string
-  // - Converting a string to lowercase.
-  //
-  // Note: If a header is malformed, skip that line.
+void HttpConnection::QueueResponse(const HttpResponse& response) {
+  QueueResponse(HttpResponse(response));
+}
+
+void HttpConnection::QueueResponse(HttpResponse&& response) {
+  if (response.serialized()) {
+    QueuePiece(HttpResponse::Segment(response.serialized()));
+    return;
+  }
 
-  // STEP 2:
+  QueuePiece(HttpResponse::Segment(response.GenerateHeaders()));
 
-  // split requests into different lines
-  vector<string> lines;
-  boost::algorithm::split(lines, request, boost::is_any_of("\r\n"),
-                          boost::token_compress_on);
-  if (lines.empty()) {
-    return req;
+  // A streamed response's body so far goes out as its first chunk.
+  bool chunked = response.is_streamed() && response.body_size() > 0;
+  if (chunked) {
+    QueuePiece(HttpResponse::Segment(ChunkHeader(response.body_size())));
   }
-  string request_line = lines[0];
+  for (HttpResponse::Segment& seg : response.ReleaseBody()) {
+    QueuePiece(std::move(seg));
+  }
+  if (chunked) {
+    QueuePiece(HttpResponse::Segment(string("\r\n")));
+  }
+}
 
-  // split request into its components
-  vector<string> request_elements;
-  boost::algorithm::split(request_elements, request_line,
-                          boost::is_space(), boost::token_compress_on);
+void HttpConnection::QueueChunk(string&& data) {
+  if (data.empty())
+    return;
+  QueuePiece(HttpResponse::Segment(ChunkHeader(data.size())));
+  QueuePiece(HttpResponse::Segment(std::move(data)));
+  QueuePiece(HttpResponse::Segment(string("\r\n")));
+}
 
-  // Extract the URI from the first line and store it in req.URI
-  req.set_uri(request_elements[1]);
+void HttpConnection::QueueLastChunk() {
+  QueuePiece(HttpResponse::Segment(string("0\r\n\r\n")));
+}
 
-  // Rest of the lines
-  for (size_t i = 1; i < lines.size(); i++) {
-    string line = lines[i];
-    if (line.empty()) {
-      continue;
-    }
+void HttpConnection::QueuePiece(HttpResponse::Segment&& piece) {
+  if (piece.size() == 0)
+    return;
+  queued_bytes_ += piece.size();
+  out_queue_.push_back(std::move(piece));
+}
+
+bool HttpConnection::FlushQueuedOutput() {
+  struct iovec iov[kMaxIovecs];
 
-    std::size_t colon = line.find(':');
-    if (colon == string::npos) {
-      continue;
+  while (!out_queue_.empty()) {
+    ssize_t res;
+    if (out_queue_.front().is_file()) {
+      // File segments go straight from the page cache to the socket.
+      const HttpResponse::Segment& seg = out_queue_.front();
+      off_t offset = seg.offset() + out_pos_;
+      res = sendfile(fd_, seg.file()->fd(), &offset, seg.size() - out_pos_);
+      if (res == 0)
+        return false;  // the file is shorter than the response said
+    } else {
+      int num_iov = GatherQueuedOutput(iov, kMaxIovecs);
+      size_t next = num_iov;
+      if (next < out_queue_.size() && out_queue_[next].is_file()) {
+        // Tell the kernel a file follows, so that a header block and
+        // the start of the file can share packets.
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num_iov;
+        res = sendmsg(fd_, &msg, MSG_MORE);
+      } else {
+        res = writev(fd_, iov, num_iov);
+      }
+    }
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
     }
+    ConsumeQueuedOutput(res);
+  }
+  return true;
+}
 
-    string name = line.substr(0, colon);
-    string value = line.substr(colon + 1);
+int HttpConnection::GatherQueuedOutput(struct iovec* iov, int max_iov) {
+  if (!out_queue_.empty() && out_queue_.front().is_file()) {
+    // File segments go out one chunk at a time, on their own.
+    if (!LoadFileChunk())
+      return -1;
+    size_t skip = out_pos_ - file_chunk_pos_;
+    iov[0].iov_base = &file_chunk_[skip];
+    iov[0].iov_len = file_chunk_.size() - skip;
+    return 1;
+  }
 
-    boost::algorithm::trim(name);
-    boost::algorithm::trim(value);
-    boost::algorithm::to_lower(name);
-    boost::algorithm::to_lower(value);
+  int num_iov = 0;
+  for (auto it = out_queue_.begin();
+       it != out_queue_.end() && !it->is_file() && num_iov < max_iov;
+       ++it, ++num_iov) {
+    std::string_view bytes = it->bytes();
+    size_t skip = (num_iov == 0) ? out_pos_ : 0;
+    iov[num_iov].iov_base = const_cast<char*>(bytes.data()) + skip;
+    iov[num_iov].iov_len = bytes.size() - skip;
+  }
+  return num_iov;
+}
 
-    req.AddHeader(name, value);
+void HttpConnection::ConsumeQueuedOutput(size_t len) {
+  // Drop the pieces that went out completely, and remember how far we
+  // got into the next one.
+  queued_bytes_ -= len;
+  while (!out_queue_.empty() && len >= out_queue_.front().size() - out_pos_) {
+    len -= out_queue_.front().size() - out_pos_;
+    if (out_queue_.front().is_file()) {
+      string().swap(file_chunk_);
+    }
+    out_queue_.pop_front();
+    out_pos_ = 0;
   }
-  return req;
+  out_pos_ += len;
+}
+
+bool HttpConnection::LoadFileChunk() {
+  if (!file_chunk_.empty() && out_pos_ < file_chunk_pos_ + file_chunk_.size())
+    return true;
+
+  const HttpResponse::Segment& seg = out_queue_.front();
+  size_t len = std::min(seg.size() - out_pos_, kFileChunkSize);
+  file_chunk_.resize(len);
+  ssize_t res = WrappedPread(seg.file()->fd(), &file_chunk_[0], len,
+                             seg.offset() + out_pos_);
+  if (res != static_cast<ssize_t>(len))
+    return false;
+  file_chunk_pos_ = out_pos_;
+  return true;
 }
 
 }  // namespace hw4
@@ -13,12 +13,15 @@
 #define HW4_HTTPCONNECTION_H_
 
 #include <stdint.h>
+#include <sys/uio.h>  // for struct iovec
 #include <unistd.h>
+#include <deque>
 #include <map>
 #include <string>
 
 #include "./HttpRequest.h"
 #include "./HttpResponse.h"
+#include "./ReceiveBuffer.h"
 
 namespace hw4 {
 
@@ -40,25 +43,124 @@ class HttpConnection {
   // returns false
   bool GetNextRequest(HttpRequest* const request);
 
-  // Write the response to the file descriptor fd_.
+  // Write the response to the file descriptor fd_, the header block and
+  // body segments together through writev(), and any files in the body
+  // with sendfile().
   //
   // Returns true if the response was successfully written, false if the
   // connection experiences an error and should be closed.
   //
   // The caller is responsible to close the connection if the function
   // returns false
-  bool WriteResponse(const HttpResponse& response) const;
+  bool WriteResponse(const HttpResponse& response);
 
- private:
-  // A helper function to parse the contents of data read from
-  // the HTTP connection.
-  HttpRequest ParseRequest(const std::string& request) const;
+  // The functions below make up the non-blocking interface used by the
+  // HttpServer's event loop.  They assume fd_ has been put in
+  // non-blocking mode, and none of them ever waits on the socket.
+
+  // Read what the client has sent so far into buffer_, stopping when the
+  // read would block, or once buffered_bytes() reaches "max_buffered";
+  // in that case, the rest stays in the socket for the next call.
+  //
+  // Returns false if the connection experienced an error.  Sets the
+  // output parameter "eof" to true if the client has closed its side of
+  // the connection.
+  bool ReadAvailable(size_t max_buffered, bool* const eof);
+
+  // Parse the next request out of the bytes already in buffer_, without
+  // touching fd_.  The request isn't copied out of buffer_: it refers
+  // into it until ReleaseRequests() is called, so several requests can
+  // be parsed and handled at once.
+  //
+  // Returns true and fills in the output parameter "request" if buffer_
+  // held a complete request header, and false otherwise.
+  bool ParseBufferedRequest(HttpRequest* const request);
+
+  // Tell the connection that the requests ParseBufferedRequest() has
+  // returned so far are no longer in use, so that their bytes can go.
+  void ReleaseRequests();
+
+  // Append the response to the queue of output waiting to be written
+  // to the client.  Use FlushQueuedOutput() to actually write it.  The
+  // body segments are queued as they are, not joined; the second version
+  // moves them out of "response" rather than copying them.
+  //
+  // A streamed response (see HttpResponse::set_body_source()) only has
+  // its headers and the body it has so far queued.  The caller runs the
+  // body source, feeding what it produces to QueueChunk(), and calls
+  // QueueLastChunk() once it is done.
+  void QueueResponse(const HttpResponse& response);
+  void QueueResponse(HttpResponse&& response);
+  void QueueChunk(std::string&& data);
+  void QueueLastChunk();
+
+  // Write as much of the queued output as the socket accepts without
+  // blocking.  Queued responses are gathered into as few writev() calls
+  // as possible, rather than written one at a time.  File ranges in
+  // their bodies are sent with sendfile(), without being read into
+  // memory.
+  //
+  // Returns false if the connection experiences an error and should be
+  // closed.  Use has_queued_output() to check whether everything was
+  // written.
+  bool FlushQueuedOutput();
+
+  // For callers that do their own I/O on fd_ (e.g., through io_uring)
+  // rather than use ReadAvailable() and FlushQueuedOutput():
+  //
+  // AppendReceived() adds "len" bytes the client sent to the buffer that
+  // ParseBufferedRequest() parses.  GatherQueuedOutput() describes up to
+  // "max_iov" pieces of the queued output in "iov", returning how many
+  // it filled in (or -1 if a file in a body couldn't be read); the
+  // pieces stay valid until ConsumeQueuedOutput() is told that "len"
+  // bytes of them were written.  A file segment is read into memory
+  // first, a chunk at a time, with a blocking pread().
+  void AppendReceived(const char* data, size_t len) {
+    buffer_.Append(data, len);
+  }
+  int GatherQueuedOutput(struct iovec* iov, int max_iov);
+  void ConsumeQueuedOutput(size_t len);
+
+  // Returns true if queued output has not been written to fd_ yet.
+  bool has_queued_output() const { return !out_queue_.empty(); }
+
+  // Returns the number of queued bytes not written to fd_ yet.
+  size_t queued_bytes() const { return queued_bytes_; }
+
+  // Returns the file descriptor associated with the client.
+  int fd() const { return fd_; }
+
+  // Returns the number of bytes read from the client that have not yet
+  // been parsed into a request.
+  size_t buffered_bytes() const { return buffer_.size(); }
 
+ private:
   // The file descriptor associated with the client.
   int fd_;
 
-  // A buffer storing data read from the client.
-  std::string buffer_;
+  // A buffer storing data read from the client.  Requests are taken
+  // out of it in place, and stay there until ReleaseRequests().
+  ReceiveBuffer buffer_;
+
+  // Append a piece of output to out_queue_, unless it is empty.
+  void QueuePiece(HttpResponse::Segment&& piece);
+
+  // Make file_chunk_ hold the bytes of the file segment at the front of
+  // out_queue_ that are to be written next.  Returns false if the file
+  // can't be read.
+  bool LoadFileChunk();
+
+  // The pieces of the responses queued by QueueResponse() (each one's
+  // header block, then its body segments), oldest first, and how much
+  // of the oldest piece has already been written to the client.
+  std::deque<HttpResponse::Segment> out_queue_;
+  size_t out_pos_ = 0;
+  size_t queued_bytes_ = 0;
+
+  // When the oldest piece is a file segment, its bytes from
+  // file_chunk_pos_ on, as far as they have been read in.
+  std::string file_chunk_;
+  size_t file_chunk_pos_ = 0;
 };
 
 }  // namespace hw4
@@ -0,0 +1,965 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>        // for errno
+#include <string.h>       // for strerror()
+#include <sys/epoll.h>    // for epoll_create1(), epoll_wait(), etc.
+#include <sys/eventfd.h>  // for eventfd()
+#include <sys/socket.h>   // for shutdown()
+#include <sys/uio.h>      // for struct iovec
+#include <poll.h>         // for POLLIN
+#include <time.h>         // for clock_gettime()
+#include <unistd.h>       // for read(), write(), close()
+#include <boost/algorithm/string.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./HttpConnection.h"
+#include "./HttpReactor.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::list;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace hw4 {
+
+// The epoll "data" values of the two non-connection file descriptors.
+// Connection ids start after them.
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeupId = 1;
+static const uint64_t kFirstConnId = 2;
+
+// The most events we pull out of epoll_wait() at once.
+static const int kMaxEvents = 256;
+
+// The resolution and size of the connection timer wheel: 100ms ticks,
+// and a little under a minute per turn.
+static const uint32_t kTimerTickMs = 100;
+static const uint32_t kTimerSlots = 512;
+
+// How long a client that we turned away because of overload is told to
+// wait before trying again.
+static const char* kRetryAfterSecs = "1";
+
+// The most pipelined requests from one connection that we process at
+// once.
+static const uint32_t kMaxPipelineBatch = 32;
+
+// A streamed response's next chunk is produced once less than this much
+// of its output is waiting to be written.
+static const size_t kStreamLowWaterBytes = 64 * 1024;
+
+// The io_uring setup: how many submissions fit in the ring, the size and
+// number of provided receive buffers, and the most iovecs in one write.
+static const uint32_t kRingEntries = 1024;
+static const uint16_t kRecvBufGroup = 0;
+static const uint32_t kNumRecvBufs = 512;
+static const uint32_t kRecvBufSize = 4096;
+static const int kMaxWriteIovecs = 64;
+
+// The io_uring user_data of a request is its connection id (or one of
+// the ids above) shifted left, with the kind of request in the low bits.
+static const int kOpBits = 3;
+static const uint64_t kOpAccept = 0;
+static const uint64_t kOpWakeup = 1;
+static const uint64_t kOpRecv = 2;
+static const uint64_t kOpWrite = 3;
+static const uint64_t kOpCancelRecv = 4;
+
+// The most a connection buffers of what its client sent.  Reads stop
+// there (under io_uring, the connection's receive is cancelled) until the
+// buffered requests are dealt with.  A client that sends more than this
+// without finishing a request gets disconnected.
+static const size_t kMaxBufferedBytes = 1024 * 1024;
+
+// A client that sends more than this many bytes without finishing a
+// request header gets disconnected rather than buffered forever.
+static const size_t kMaxRequestHeaderBytes = 64 * 1024;
+
+// How long to stop accepting for when accept() fails for want of
+// descriptors or memory, which other connections have to free first.
+static const uint32_t kAcceptBackoffMs = 200;
+
+// Returns true if accept() failing with "error" (see ServerSocket::Accept())
+// only concerns the one connection, so the next may well succeed.  These
+// are the errors accept(2) says to treat like EAGAIN, plus 0.
+static bool IsConnectionError(int error) {
+  switch (error) {
+    case 0:
+    case ECONNABORTED:
+    case EPROTO:
+    case EPERM:
+    case ENETDOWN:
+    case ENOPROTOOPT:
+    case EHOSTDOWN:
+    case ENONET:
+    case EHOSTUNREACH:
+    case EOPNOTSUPP:
+    case ENETUNREACH:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the current CLOCK_MONOTONIC time in milliseconds.
+static uint64_t NowMs() {
+  struct timespec ts;
+  Verify333(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct HttpReactor::Connection {
+  Connection(uint64_t conn_id, int fd) : id(conn_id), hc(fd) { }
+
+  uint64_t id;
+  HttpConnection hc;
+
+  // How many of this connection's requests the workers are processing.
+  uint32_t in_flight = 0;
+
+  // The responses to the batch of requests in flight, in request order,
+  // filled in as the workers finish them.
+  vector<HttpResponse> batch;
+
+  // Close the connection once the batch's responses are written.
+  bool batch_closes = false;
+
+  // The body source of the streamed response being sent, if any, and
+  // whether a worker is producing its next chunk.  The batch's later
+  // responses wait in "batch", from batch_pos on, until it is done.
+  shared_ptr<HttpResponse::BodySource> stream;
+  bool chunk_in_flight = false;
+  size_t batch_pos = 0;
+
+  // The socket signaled that it is readable, but we haven't read it yet.
+  // Under io_uring: the buffer filled up, so the receive was cancelled,
+  // and it is re-armed once the buffer has room.
+  bool read_pending = false;
+
+  // The client has closed its side of the connection.
+  bool eof = false;
+
+  // Close the connection as soon as the queued output is written.
+  bool close_when_flushed = false;
+
+  // CloseConnection() was called while requests were in flight; drop
+  // the connection as soon as their tasks come back.
+  bool closing = false;
+
+  // How many requests the connection has made.
+  uint32_t num_requests = 0;
+
+  // When the first bytes of the request we're waiting for arrived, or 0
+  // if none have.
+  uint64_t header_start_ms = 0;
+
+  // Under io_uring, whether the connection's multishot receive is armed,
+  // and whether a write is in flight (and the iovecs it writes from).
+  bool recv_armed = false;
+  bool write_in_flight = false;
+  vector<struct iovec> iov;
+
+  // How many of the connection's io_uring requests are in deferred_.
+  uint32_t num_deferred = 0;
+
+  // Whether anything (a worker, the kernel, or deferred_) still refers to
+  // the connection, so that it can't be freed yet.
+  bool has_pending_work() const {
+    return in_flight > 0 || chunk_in_flight || recv_armed ||
+           write_in_flight || num_deferred > 0;
+  }
+};
+
+HttpReactor::HttpReactor(ServerSocket* socket, int listen_fd,
+                         uint32_t min_threads, uint32_t max_threads,
+                         request_handler_fn handler, void* handler_arg)
+  : socket_(socket), listen_fd_(listen_fd), stopping_(false),
+    handler_(handler), handler_arg_(handler_arg), dns_cache_(nullptr),
+    idle_timeout_ms_(0), header_timeout_ms_(0), max_requests_(0),
+    timers_(kTimerSlots, kTimerTickMs, NowMs()),
+    next_conn_id_(kFirstConnId), tasks_done_(0), queue_wait_ns_(0),
+    max_queue_wait_ns_(0) {
+  Verify333(pthread_mutex_init(&done_lock_, nullptr) == 0);
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  Verify333(epoll_fd_ != -1);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  Verify333(wakeup_fd_ != -1);
+
+  // Watch the listening socket for new connections, and the eventfd for
+  // completed tasks.
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = kListenId;
+  Verify333(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == 0);
+  ev.events = EPOLLIN;
+  ev.data.u64 = kWakeupId;
+  Verify333(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) == 0);
+
+  pool_.reset(new ThreadPool(min_threads, max_threads));
+}
+
+HttpReactor::~HttpReactor() {
+  // Shut the workers down first; any tasks still queued are run now and
+  // post their completions to done_, which we then throw away.
+  pool_.reset();
+  for (RequestTask* task : done_) {
+    delete task;
+  }
+  done_.clear();
+
+  // Tearing down the ring cancels whatever the kernel still had queued.
+  ring_.reset();
+
+  // Destroying the connections closes their sockets.
+  conns_.clear();
+  close(wakeup_fd_);
+  close(epoll_fd_);
+  Verify333(pthread_mutex_destroy(&done_lock_) == 0);
+}
+
+HttpReactor::Stats HttpReactor::GetStats() const {
+  Stats stats;
+  stats.tasks = tasks_done_.load(std::memory_order_relaxed);
+  stats.queue_wait_ns = queue_wait_ns_.load(std::memory_order_relaxed);
+  stats.max_queue_wait_ns =
+    max_queue_wait_ns_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void HttpReactor::Stop() {
+  stopping_.store(true);
+  uint64_t one = 1;
+  while (write(wakeup_fd_, &one, sizeof(one)) == -1 && errno == EINTR) { }
+}
+
+bool HttpReactor::UseIoUring() {
+  unique_ptr<IoUring> ring(new IoUring());
+  if (!ring->Init(kRingEntries) ||
+      !ring->SetupBufferRing(kRecvBufGroup, kNumRecvBufs, kRecvBufSize)) {
+    return false;
+  }
+  ring_ = std::move(ring);
+  return true;
+}
+
+bool HttpReactor::Run() {
+  if (ring_ != nullptr)
+    return RunIoUring();
+
+  struct epoll_event events[kMaxEvents];
+
+  while (!stopping_.load()) {
+    int num_events = epoll_wait(epoll_fd_, events, kMaxEvents,
+                                timers_.timeout_ms());
+    if (num_events == -1) {
+      if (errno == EINTR)
+        continue;
+      cerr << "epoll_wait() failed: " << strerror(errno) << endl;
+      return false;
+    }
+
+    for (int i = 0; i < num_events; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kListenId) {
+        HandleAccept();
+      } else if (id == kWakeupId) {
+        HandleCompletions();
+      } else {
+        HandleConnectionEvent(id, events[i].events);
+      }
+    }
+    HandleTimers();
+  }
+  return true;
+}
+
+bool HttpReactor::RunIoUring() {
+  ArmAccept();
+  ArmWakeup();
+
+  while (!stopping_.load()) {
+    // Submit everything the last round queued (new receives, writes, and
+    // re-armed requests) and wait for completions, all in one call.
+    if (!ring_->SubmitAndWait(timers_.timeout_ms())) {
+      cerr << "io_uring_enter() failed: " << strerror(errno) << endl;
+      return false;
+    }
+
+    struct io_uring_cqe* cqe;
+    while ((cqe = ring_->PeekCqe()) != nullptr) {
+      uint64_t user_data = cqe->user_data;
+      int32_t res = cqe->res;
+      uint32_t flags = cqe->flags;
+      ring_->SeenCqe();
+      HandleUringCompletion(user_data, res, flags);
+    }
+    HandleTimers();
+    ArmDeferred();
+  }
+  return true;
+}
+
+void HttpReactor::RequestTaskFn(ThreadPool::Task* t) {
+  // The task belongs to us while we run, and goes back to the reactor
+  // once the response is ready.
+  RequestTask* task = static_cast<RequestTask*>(t);
+  HttpReactor* reactor = task->reactor_;
+  if (task->stream_) {
+    task->more_ = task->stream_->Next(&task->chunk_);
+  } else {
+    task->response_ = reactor->handler_(task->request_,
+                                        reactor->handler_arg_);
+    // Only HTTP/1.1 clients understand chunked transfer-encoding.
+    if (task->response_.is_streamed() &&
+        task->request_.version() != "HTTP/1.1") {
+      task->response_.DrainBodySource();
+    }
+  }
+  reactor->PostCompletion(task);
+}
+
+void HttpReactor::PostCompletion(RequestTask* task) {
+  Verify333(pthread_mutex_lock(&done_lock_) == 0);
+  bool was_empty = done_.empty();
+  done_.push_back(task);
+  Verify333(pthread_mutex_unlock(&done_lock_) == 0);
+
+  // The reactor drains the whole list each time it wakes up, so only the
+  // task that makes the list non-empty needs to wake it.
+  if (was_empty) {
+    uint64_t one = 1;
+    while (write(wakeup_fd_, &one, sizeof(one)) == -1 && errno == EINTR) { }
+  }
+}
+
+void HttpReactor::HandleAccept() {
+  // The listening socket is edge-triggered, so keep accepting until the
+  // backlog is empty; no new event comes for connections left in it.
+  while (1) {
+    int client_fd;
+    uint16_t c_port;
+    string c_addr, c_dns, s_addr, s_dns;
+    int error;
+    if (!socket_->Accept(&client_fd, &c_addr, &c_port, &c_dns,
+                         &s_addr, &s_dns, &error)) {
+      if (error == EAGAIN)
+        return;
+      if (IsConnectionError(error))
+        continue;
+
+      // Out of descriptors (or worse): the backlog can't drain until
+      // some are freed, so try again in a little while.
+      timers_.Schedule(kListenId, NowMs() + kAcceptBackoffMs);
+      return;
+    }
+    Connection* conn = AddConnection(client_fd, c_addr, c_port, c_dns);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = conn->id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+      cerr << "epoll_ctl() failed: " << strerror(errno) << endl;
+      conns_.erase(conn->id);  // closes the socket
+    }
+  }
+}
+
+HttpReactor::Connection* HttpReactor::AddConnection(int client_fd,
+                                                    const string& c_addr,
+                                                    uint16_t c_port,
+                                                    string c_dns) {
+  if (dns_cache_ != nullptr) {
+    c_dns = dns_cache_->Lookup(c_addr);
+  }
+  cout << "  client " << c_dns << ":" << c_port << " "
+       << "(IP address " << c_addr << ")" << " connected." << endl;
+
+  uint64_t id = next_conn_id_++;
+  Connection* conn = new Connection(id, client_fd);
+  conns_[id] = unique_ptr<Connection>(conn);
+  ScheduleTimeout(conn, NowMs());
+  return conn;
+}
+
+void HttpReactor::HandleCompletions() {
+  // Reset the eventfd *before* taking the list, so that a task posted
+  // after we take it is guaranteed to wake us up again.
+  uint64_t count;
+  while (read(wakeup_fd_, &count, sizeof(count)) == -1 && errno == EINTR) { }
+
+  list<RequestTask*> done;
+  Verify333(pthread_mutex_lock(&done_lock_) == 0);
+  done.swap(done_);
+  Verify333(pthread_mutex_unlock(&done_lock_) == 0);
+
+  for (RequestTask* t : done) {
+    unique_ptr<RequestTask> task(t);
+    uint64_t wait_ns = task->queue_wait_ns();
+    tasks_done_.store(tasks_done_.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    queue_wait_ns_.store(
+        queue_wait_ns_.load(std::memory_order_relaxed) + wait_ns,
+        std::memory_order_relaxed);
+    if (wait_ns > max_queue_wait_ns_.load(std::memory_order_relaxed)) {
+      max_queue_wait_ns_.store(wait_ns, std::memory_order_relaxed);
+    }
+
+    auto it = conns_.find(task->conn_id_);
+    if (it == conns_.end())
+      continue;
+    Connection* conn = it->second.get();
+    if (task->stream_) {
+      FinishChunk(conn, task.get());
+      continue;
+    }
+    conn->in_flight--;
+    if (conn->closing) {
+      if (!conn->has_pending_work()) {
+        conns_.erase(it);
+      }
+      continue;
+    }
+
+    conn->batch[task->index_] = std::move(task->response_);
+    if (conn->in_flight == 0) {
+      FinishBatch(conn);
+      Advance(conn);
+    }
+  }
+}
+
+void HttpReactor::HandleConnectionEvent(uint64_t conn_id, uint32_t events) {
+  auto it = conns_.find(conn_id);
+  if (it == conns_.end())
+    return;
+  Connection* conn = it->second.get();
+  if (conn->closing)
+    return;
+
+  if (events & EPOLLERR) {
+    CloseConnection(conn);
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+    conn->read_pending = true;
+  }
+  Advance(conn);
+}
+
+void HttpReactor::HandleTimers() {
+  vector<uint64_t> expired;
+  timers_.Expire(NowMs(), &expired);
+  for (uint64_t id : expired) {
+    if (id == kListenId) {
+      // Accepting backed off; start again.
+      if (ring_ != nullptr) {
+        ArmAccept();
+      } else {
+        HandleAccept();
+      }
+      continue;
+    }
+    auto it = conns_.find(id);
+    if (it == conns_.end())
+      continue;
+    Connection* conn = it->second.get();
+    if (conn->in_flight > 0)
+      continue;
+
+    if (conn->hc.buffered_bytes() == 0 || conn->hc.has_queued_output() ||
+        conn->close_when_flushed) {
+      // Idle between requests, or not reading what we send.
+      CloseConnection(conn);
+      continue;
+    }
+
+    // Partway through a request header, and too slow with the rest.
+    HttpResponse resp;
+    resp.set_protocol("HTTP/1.1");
+    resp.set_response_code(408);
+    resp.set_message("Request Timeout");
+    resp.set_header("Connection", "close");
+    conn->hc.QueueResponse(resp);
+    conn->close_when_flushed = true;
+    Advance(conn);
+  }
+}
+
+void HttpReactor::Advance(Connection* conn) {
+  // Write out whatever is queued; if the socket fills up, we'll get an
+  // EPOLLOUT event once it drains.  Under io_uring, the write completes
+  // in the background instead.
+  bool ok = (ring_ != nullptr) ? StartWrite(conn)
+                                : conn->hc.FlushQueuedOutput();
+  if (!ok) {
+    CloseConnection(conn);
+    return;
+  }
+
+  // Handle one batch of requests at a time per connection, and don't
+  // start on the next one until the previous responses are fully
+  // written.  That stops a client that never reads from making us
+  // buffer unbounded output.
+  if (conn->in_flight > 0) {
+    timers_.Cancel(conn->id);
+    return;
+  }
+  if (conn->stream) {
+    // Have the next chunk of a streamed response produced once most of
+    // the last one is written, so that a slow client holds at most a
+    // chunk or two in memory.
+    if (!conn->chunk_in_flight &&
+        conn->hc.queued_bytes() < kStreamLowWaterBytes) {
+      conn->chunk_in_flight = true;
+      pool_->Dispatch(new RequestTask(this, conn->id, conn->stream));
+    }
+    if (conn->hc.has_queued_output()) {
+      ScheduleTimeout(conn, NowMs());
+    } else {
+      timers_.Cancel(conn->id);
+    }
+    return;
+  }
+  if (conn->hc.has_queued_output()) {
+    ScheduleTimeout(conn, NowMs());
+    return;
+  }
+  if (conn->close_when_flushed) {
+    CloseConnection(conn);
+    return;
+  }
+
+  if (conn->read_pending && ring_ != nullptr) {
+    if (conn->hc.buffered_bytes() < kMaxBufferedBytes) {
+      conn->read_pending = false;
+      if (!conn->recv_armed && !conn->eof) {
+        ArmRecv(conn);
+      }
+    }
+  } else if (conn->read_pending) {
+    bool eof;
+    if (!conn->hc.ReadAvailable(kMaxBufferedBytes, &eof)) {
+      CloseConnection(conn);
+      return;
+    }
+    conn->eof = conn->eof || eof;
+
+    // If the buffer filled up, the rest is read once these requests are
+    // done; no new event will come for it.
+    conn->read_pending =
+      !conn->eof && conn->hc.buffered_bytes() >= kMaxBufferedBytes;
+  }
+
+  // Parse every complete request that is already buffered, so that a
+  // client that pipelines gets them processed together.  The batch ends
+  // early at a request that closes the connection, or at the
+  // connection's last allowed request.
+  vector<ThreadPool::Task*> tasks;
+  bool closes = false;
+  while (!closes && tasks.size() < kMaxPipelineBatch &&
+         conn->hc.buffered_bytes() > 0) {
+    unique_ptr<RequestTask> task(new RequestTask(this, conn->id,
+                                                 tasks.size()));
+    if (!conn->hc.ParseBufferedRequest(&task->request_))
+      break;
+    closes = boost::algorithm::iequals(
+        task->request_.GetHeaderValue("connection"), "close");
+    tasks.push_back(task.release());
+    if (max_requests_ != 0 &&
+        conn->num_requests + tasks.size() >= max_requests_) {
+      closes = true;
+    }
+  }
+  if (!tasks.empty()) {
+    DispatchBatch(conn, tasks, closes);
+    return;
+  }
+
+  if (conn->eof) {
+    CloseConnection(conn);
+  } else if (conn->read_pending) {
+    // The buffer is full, and there's no request in it to make room.
+    cerr << "Client sent too much without reading; closing connection."
+         << endl;
+    CloseConnection(conn);
+  } else if (conn->hc.buffered_bytes() > kMaxRequestHeaderBytes) {
+    cerr << "Request header too large; closing connection." << endl;
+    CloseConnection(conn);
+  } else {
+    // Wait for (the rest of) the next request.
+    ScheduleTimeout(conn, NowMs());
+  }
+}
+
+void HttpReactor::DispatchBatch(Connection* conn,
+                                const vector<ThreadPool::Task*>& tasks,
+                                bool closes) {
+  uint32_t num_tasks = tasks.size();
+  uint32_t accepted = pool_->TryDispatch(tasks.data(), num_tasks);
+
+  // The workers can't hand anything back before we return to the event
+  // loop, so it's safe to set up the batch after dispatching it.
+  conn->batch.clear();
+  conn->batch.resize(accepted);
+  conn->in_flight = accepted;
+  conn->num_requests += accepted;
+  conn->batch_closes = closes;
+  conn->header_start_ms = 0;
+  timers_.Cancel(conn->id);
+
+  if (accepted < num_tasks) {
+    // Too much work is queued already.  Turn the client away now rather
+    // than let the rest of its requests wait behind everybody else's.
+    HttpResponse resp;
+    resp.set_protocol("HTTP/1.1");
+    resp.set_response_code(503);
+    resp.set_message("Service Unavailable");
+    resp.set_header("Retry-After", kRetryAfterSecs);
+    resp.set_header("Connection", "close");
+    conn->batch.push_back(resp);
+    conn->batch_closes = true;
+    for (uint32_t i = accepted; i < num_tasks; i++) {
+      delete static_cast<RequestTask*>(tasks[i]);
+    }
+  }
+
+  if (conn->in_flight == 0) {
+    FinishBatch(conn);
+    Advance(conn);
+  }
+}
+
+void HttpReactor::FinishBatch(Connection* conn) {
+  // The requests point into the connection's buffer until we let go.
+  conn->hc.ReleaseRequests();
+  if (max_requests_ != 0 && conn->num_requests >= max_requests_) {
+    conn->batch.back().set_header("Connection", "close");
+  }
+
+  conn->batch_pos = 0;
+  QueueBatch(conn);
+}
+
+void HttpReactor::QueueBatch(Connection* conn) {
+  // The responses all go out together, in as few writes as possible,
+  // except that the ones after a streamed response wait for its body.
+  while (conn->batch_pos < conn->batch.size()) {
+    HttpResponse& resp = conn->batch[conn->batch_pos++];
+    conn->stream = resp.body_source();
+    conn->hc.QueueResponse(std::move(resp));
+    if (conn->stream)
+      return;
+  }
+  conn->batch.clear();
+  conn->batch_pos = 0;
+  if (conn->batch_closes) {
+    conn->close_when_flushed = true;
+  }
+}
+
+void HttpReactor::FinishChunk(Connection* conn, RequestTask* task) {
+  conn->chunk_in_flight = false;
+  if (conn->closing) {
+    if (!conn->has_pending_work()) {
+      conns_.erase(conn->id);
+    }
+    return;
+  }
+
+  conn->hc.QueueChunk(std::move(task->chunk_));
+  if (!task->more_) {
+    conn->hc.QueueLastChunk();
+    conn->stream.reset();
+    QueueBatch(conn);
+  }
+  Advance(conn);
+}
+
+void HttpReactor::ScheduleTimeout(Connection* conn, uint64_t now_ms) {
+  uint32_t timeout_ms = idle_timeout_ms_;
+  uint64_t start_ms = now_ms;
+  if (!conn->hc.has_queued_output()) {
+    if (conn->hc.buffered_bytes() == 0) {
+      conn->header_start_ms = 0;
+    } else {
+      // The header deadline runs from the request's first bytes, however
+      // slowly the rest trickle in.
+      if (conn->header_start_ms == 0) {
+        conn->header_start_ms = now_ms;
+      }
+      timeout_ms = header_timeout_ms_;
+      start_ms = conn->header_start_ms;
+    }
+  }
+
+  if (timeout_ms == 0) {
+    timers_.Cancel(conn->id);
+  } else {
+    timers_.Schedule(conn->id, start_ms + timeout_ms);
+  }
+}
+
+void HttpReactor::CloseConnection(Connection* conn) {
+  timers_.Cancel(conn->id);
+  if (conn->has_pending_work()) {
+    // Workers or the kernel still reference this connection; wait for
+    // them.  Shutting the socket down makes the kernel finish up soon.
+    if (!conn->closing && (conn->recv_armed || conn->write_in_flight)) {
+      shutdown(conn->hc.fd(), SHUT_RDWR);
+    }
+    conn->closing = true;
+    return;
+  }
+  conns_.erase(conn->id);
+}
+
+void HttpReactor::ArmAccept() {
+  struct io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe == nullptr) {
+    deferred_.push_back((kListenId << kOpBits) | kOpAccept);
+    return;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = (kListenId << kOpBits) | kOpAccept;
+}
+
+void HttpReactor::ArmWakeup() {
+  // A multishot poll fires every time a worker writes the eventfd;
+  // HandleCompletions() then reads it, just as under epoll.
+  struct io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe == nullptr) {
+    deferred_.push_back((kWakeupId << kOpBits) | kOpWakeup);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = wakeup_fd_;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = (kWakeupId << kOpBits) | kOpWakeup;
+}
+
+void HttpReactor::ArmRecv(Connection* conn) {
+  struct io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe == nullptr) {
+    conn->num_deferred++;
+    deferred_.push_back((conn->id << kOpBits) | kOpRecv);
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->hc.fd();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kRecvBufGroup;
+  sqe->user_data = (conn->id << kOpBits) | kOpRecv;
+  conn->recv_armed = true;
+}
+
+void HttpReactor::CancelRecv(Connection* conn) {
+  struct io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe == nullptr) {
+    conn->num_deferred++;
+    deferred_.push_back((conn->id << kOpBits) | kOpCancelRecv);
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = (conn->id << kOpBits) | kOpRecv;
+  sqe->user_data = (conn->id << kOpBits) | kOpCancelRecv;
+}
+
+bool HttpReactor::StartWrite(Connection* conn) {
+  if (conn->write_in_flight || !conn->hc.has_queued_output())
+    return true;
+
+  conn->iov.resize(kMaxWriteIovecs);
+  int num_iov = conn->hc.GatherQueuedOutput(conn->iov.data(),
+                                            kMaxWriteIovecs);
+  if (num_iov == -1)
+    return false;
+  struct io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe == nullptr) {
+    conn->num_deferred++;
+    deferred_.push_back((conn->id << kOpBits) | kOpWrite);
+    return true;
+  }
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = conn->hc.fd();
+  sqe->addr = reinterpret_cast<uint64_t>(conn->iov.data());
+  sqe->len = num_iov;
+  sqe->user_data = (conn->id << kOpBits) | kOpWrite;
+  conn->write_in_flight = true;
+  return true;
+}
+
+void HttpReactor::ArmDeferred() {
+  vector<uint64_t> deferred;
+  deferred.swap(deferred_);
+  for (uint64_t user_data : deferred) {
+    uint64_t op = user_data & ((1 << kOpBits) - 1);
+    if (op == kOpAccept) {
+      ArmAccept();
+      continue;
+    }
+    if (op == kOpWakeup) {
+      ArmWakeup();
+      continue;
+    }
+
+    auto it = conns_.find(user_data >> kOpBits);
+    Verify333(it != conns_.end());
+    Connection* conn = it->second.get();
+    conn->num_deferred--;
+    if (conn->closing) {
+      if (!conn->has_pending_work()) {
+        conns_.erase(conn->id);
+      }
+    } else if (op == kOpRecv) {
+      if (!conn->recv_armed && !conn->eof && !conn->read_pending) {
+        ArmRecv(conn);
+      }
+    } else if (op == kOpCancelRecv) {
+      if (conn->recv_armed && conn->read_pending) {
+        CancelRecv(conn);
+      }
+    } else {
+      Advance(conn);
+    }
+  }
+}
+
+void HttpReactor::HandleUringCompletion(uint64_t user_data, int32_t res,
+                                        uint32_t flags) {
+  uint64_t op = user_data & ((1 << kOpBits) - 1);
+  if (op == kOpAccept) {
+    HandleUringAccept(res);
+    if (!(flags & IORING_CQE_F_MORE)) {
+      if (res < 0 && !IsConnectionError(-res)) {
+        // As in HandleAccept(), back off rather than fail right away.
+        timers_.Schedule(kListenId, NowMs() + kAcceptBackoffMs);
+      } else {
+        ArmAccept();
+      }
+    }
+    return;
+  }
+  if (op == kOpWakeup) {
+    HandleCompletions();
+    if (!(flags & IORING_CQE_F_MORE)) {
+      ArmWakeup();
+    }
+    return;
+  }
+  if (op == kOpCancelRecv) {
+    // The receive's own completion says when it has stopped; this one
+    // may even come after the connection is gone.
+    return;
+  }
+
+  auto it = conns_.find(user_data >> kOpBits);
+  Verify333(it != conns_.end());
+  if (op == kOpRecv) {
+    HandleUringRecv(it->second.get(), res, flags);
+  } else {
+    HandleUringWrite(it->second.get(), res);
+  }
+}
+
+void HttpReactor::HandleUringAccept(int32_t res) {
+  if (res < 0) {
+    cerr << "accept failed: " << strerror(-res) << endl;
+    return;
+  }
+
+  int client_fd = res;
+  uint16_t c_port;
+  string c_addr, c_dns, s_addr, s_dns;
+  if (!socket_->DescribeAccepted(client_fd, &c_addr, &c_port, &c_dns,
+                                 &s_addr, &s_dns)) {
+    close(client_fd);
+    return;
+  }
+  ArmRecv(AddConnection(client_fd, c_addr, c_port, c_dns));
+}
+
+void HttpReactor::HandleUringRecv(Connection* conn, int32_t res,
+                                  uint32_t flags) {
+  if (!(flags & IORING_CQE_F_MORE)) {
+    conn->recv_armed = false;
+  }
+  if (flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0 && !conn->closing) {
+      conn->hc.AppendReceived(ring_->buffer(bid), res);
+    }
+    ring_->RecycleBuffer(bid);
+  }
+
+  if (conn->closing) {
+    if (!conn->has_pending_work()) {
+      conns_.erase(conn->id);
+    }
+    return;
+  }
+  if (res == 0) {
+    conn->eof = true;
+  } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+    // ENOBUFS just means we ran out of provided buffers for a moment,
+    // and ECANCELED that CancelRecv() stopped the receive.
+    CloseConnection(conn);
+    return;
+  }
+
+  // Stop receiving once the buffer is full; Advance() starts again once
+  // the buffered requests have been dealt with.
+  if (!conn->eof && conn->hc.buffered_bytes() >= kMaxBufferedBytes &&
+      !conn->read_pending) {
+    conn->read_pending = true;
+    if (conn->recv_armed) {
+      CancelRecv(conn);
+    }
+  }
+  if (!conn->recv_armed && !conn->eof && !conn->read_pending) {
+    ArmRecv(conn);
+  }
+  Advance(conn);
+}
+
+void HttpReactor::HandleUringWrite(Connection* conn, int32_t res) {
+  conn->write_in_flight = false;
+  if (conn->closing) {
+    if (!conn->has_pending_work()) {
+      conns_.erase(conn->id);
+    }
+    return;
+  }
+  if (res < 0) {
+    CloseConnection(conn);
+    return;
+  }
+  conn->hc.ConsumeQueuedOutput(res);
+  Advance(conn);
+}
+
+}  // namespace hw4
@@ -0,0 +1,286 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_HTTPREACTOR_H_
+#define HW4_HTTPREACTOR_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./DnsCache.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
+#include "./IoUring.h"
+#include "./ServerSocket.h"
+#include "./ThreadPool.h"
+#include "./TimerWheel.h"
+
+namespace hw4 {
+
+// An HttpReactor is the event loop at the heart of the web server.  A
+// single thread runs the reactor, which uses edge-triggered epoll to
+// watch the (non-blocking) listening socket and every client
+// connection.  The reactor thread does all of the socket I/O itself:
+// it accepts connections, reads and parses requests, and writes
+// responses.  Only the work of turning a request into a response is
+// handed to the worker threads of a ThreadPool.
+//
+// Because no thread ever blocks on a client, an idle keep-alive
+// connection costs a file descriptor and a little memory rather than a
+// worker thread, and one reactor can hold many thousands of them.
+class HttpReactor {
+ public:
+  // The function the worker threads invoke to produce the response
+  // to a request.  "arg" is the handler_arg given to the constructor.
+  typedef HttpResponse (*request_handler_fn)(const HttpRequest& request,
+                                             void* arg);
+
+  // Construct a reactor that accepts connections on "socket", which
+  // must already be listening on "listen_fd" in non-blocking mode (see
+  // ServerSocket::SetNonBlocking()), and processes requests by calling
+  // "handler" from a pool of between "min_threads" and "max_threads"
+  // worker threads (see ThreadPool.h).  The reactor does not take
+  // ownership of "socket".
+  HttpReactor(ServerSocket* socket, int listen_fd,
+              uint32_t min_threads, uint32_t max_threads,
+              request_handler_fn handler, void* handler_arg);
+
+  // Closes every open client connection and shuts down the workers.
+  virtual ~HttpReactor();
+
+  // Run the event loop.  Returns false if the loop hits a fatal error,
+  // or true once Stop() is called.
+  bool Run();
+
+  // Have Run() return soon.  Safe to call from any thread.  Connections
+  // stay open until the reactor is destroyed.
+  void Stop();
+
+  // Do the socket I/O through io_uring instead of epoll and non-blocking
+  // system calls: a multishot accept and a multishot receive per
+  // connection stay queued in the kernel, received data lands in a ring
+  // of provided buffers, and each turn of the event loop submits all of
+  // its writes in one system call.  Static files are still read into
+  // memory synchronously, with pread() on the reactor thread, a chunk at
+  // a time before each write (see HttpConnection::GatherQueuedOutput()),
+  // so a file that isn't in the page cache holds up every connection on
+  // the reactor meanwhile.  Must be called before Run().
+  // Returns false, leaving the reactor on epoll, if the kernel doesn't
+  // support what we need.
+  bool UseIoUring();
+
+  // Use "cache" to look up client names for the connection log instead
+  // of the names ServerSocket::Accept() returns.  Pair this with
+  // ServerSocket::set_resolve_names(false) to keep DNS lookups off the
+  // accept path.  The reactor does not take ownership of "cache".
+  void set_dns_cache(DnsCache* cache) { dns_cache_ = cache; }
+
+  // Set the most requests that may wait for a worker at once; 0 means no
+  // limit.  Past that, the reactor sheds load: it answers new requests
+  // with "503 Service Unavailable" itself, without queueing them, and
+  // closes their connections.
+  void set_max_queued(uint32_t num_requests) {
+    pool_->set_high_water_mark(num_requests);
+  }
+
+  // Set how long a connection may wait between requests ("idle_ms"), and
+  // how long a client may take to send a request header once it has
+  // started ("header_ms").  A connection that stays idle too long is
+  // closed; one that is too slow with its header is answered with "408
+  // Request Timeout" and closed.  The idle timeout also applies to a
+  // client that stops reading its responses.  0 disables a timeout.
+  void set_timeouts(uint32_t idle_ms, uint32_t header_ms) {
+    idle_timeout_ms_ = idle_ms;
+    header_timeout_ms_ = header_ms;
+  }
+
+  // Set the most requests one connection may make; the response to the
+  // last one carries "Connection: close".  0 means no limit.
+  void set_max_requests(uint32_t num_requests) {
+    max_requests_ = num_requests;
+  }
+
+  // Counters, for monitoring: how many tasks (requests, and chunks of
+  // streamed responses) the workers have finished, and how long they
+  // waited for a worker, in total and at worst.
+  struct Stats {
+    uint64_t tasks = 0;
+    uint64_t queue_wait_ns = 0;
+    uint64_t max_queue_wait_ns = 0;
+  };
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
+ private:
+  // Per-connection state; only ever touched by the reactor thread.
+  struct Connection;
+
+  // The unit of work handed to a worker thread: one request from one
+  // connection, and (once the worker is done) its response.  Or, if
+  // stream_ is set, the next chunk of a streamed response's body.
+  class RequestTask : public ThreadPool::Task {
+   public:
+    RequestTask(HttpReactor* reactor, uint64_t conn_id, uint32_t index)
+      : ThreadPool::Task(&HttpReactor::RequestTaskFn),
+        reactor_(reactor), conn_id_(conn_id), index_(index) { }
+    RequestTask(HttpReactor* reactor, uint64_t conn_id,
+                std::shared_ptr<HttpResponse::BodySource> stream)
+      : ThreadPool::Task(&HttpReactor::RequestTaskFn),
+        reactor_(reactor), conn_id_(conn_id), index_(0),
+        stream_(std::move(stream)) { }
+
+    HttpReactor* reactor_;
+    uint64_t conn_id_;
+    uint32_t index_;  // the request's position in its pipelined batch
+    HttpRequest request_;
+    HttpResponse response_;
+
+    // The body source, the chunk it produced, and whether there's more.
+    std::shared_ptr<HttpResponse::BodySource> stream_;
+    std::string chunk_;
+    bool more_ = false;
+  };
+
+  // The thread_task_fn the workers run: calls the handler, then hands
+  // the task back to the reactor with PostCompletion().
+  static void RequestTaskFn(ThreadPool::Task* t);
+
+  // Called by the worker threads to return a finished task to the
+  // reactor thread, waking the reactor up if necessary.
+  void PostCompletion(RequestTask* task);
+
+  // The io_uring version of Run().
+  bool RunIoUring();
+
+  // Log and start tracking a newly accepted client connection; shared by
+  // both event loops.
+  Connection* AddConnection(int client_fd, const std::string& c_addr,
+                            uint16_t c_port, std::string c_dns);
+
+  // Handlers for the different kinds of epoll events.
+  void HandleAccept();
+  void HandleCompletions();
+  void HandleConnectionEvent(uint64_t conn_id, uint32_t events);
+  void HandleTimers();
+
+  // Queue the io_uring requests that stay armed in the kernel (see
+  // UseIoUring()), and start writing a connection's queued output.
+  // StartWrite() returns false if the output couldn't be gathered.  If
+  // the submission ring is full, the request goes on deferred_, and
+  // ArmDeferred() retries it once the next completions are handled.
+  void ArmAccept();
+  void ArmWakeup();
+  void ArmRecv(Connection* conn);
+  bool StartWrite(Connection* conn);
+
+  // Stop a connection's multishot receive, whose last completion then
+  // comes back with -ECANCELED.
+  void CancelRecv(Connection* conn);
+  void ArmDeferred();
+
+  // Handlers for the different kinds of io_uring completions.
+  void HandleUringCompletion(uint64_t user_data, int32_t res, uint32_t flags);
+  void HandleUringAccept(int32_t res);
+  void HandleUringRecv(Connection* conn, int32_t res, uint32_t flags);
+  void HandleUringWrite(Connection* conn, int32_t res);
+
+  // Move a connection's state machine forward as far as it can go
+  // without blocking: write queued output, read newly arrived bytes,
+  // and dispatch the next batch of complete requests to the workers.
+  // May close the connection, so callers must not use "conn" afterwards.
+  void Advance(Connection* conn);
+
+  // Hand a connection's batch of pipelined requests to the workers,
+  // turning away whatever doesn't fit in the queue.  "closes" says that
+  // the connection ends after the batch.
+  void DispatchBatch(Connection* conn,
+                     const std::vector<ThreadPool::Task*>& tasks,
+                     bool closes);
+
+  // Queue the responses to a connection's finished batch, in order.
+  void FinishBatch(Connection* conn);
+
+  // Queue the batch's responses from where QueueBatch() last stopped,
+  // up to and including the next streamed response, if any.
+  void QueueBatch(Connection* conn);
+
+  // Queue the chunk of a streamed response that "task" produced, and
+  // carry on with the batch if that was the last one.
+  void FinishChunk(Connection* conn, RequestTask* task);
+
+  // Set the connection's timer according to what it is waiting for.
+  void ScheduleTimeout(Connection* conn, uint64_t now_ms);
+
+  // Close a connection and forget about it.  If a worker is still
+  // processing one of its requests, the connection lingers until the
+  // worker's task comes back.
+  void CloseConnection(Connection* conn);
+
+  ServerSocket* socket_;
+  int listen_fd_;
+  int epoll_fd_;
+  int wakeup_fd_;  // an eventfd that workers use to wake up the reactor
+  std::atomic<bool> stopping_;  // set by Stop()
+
+  request_handler_fn handler_;
+  void* handler_arg_;
+  DnsCache* dns_cache_;
+
+  // Per-connection limits; see set_timeouts() and set_max_requests().
+  uint32_t idle_timeout_ms_;
+  uint32_t header_timeout_ms_;
+  uint32_t max_requests_;
+
+  // The deadline of each connection that is waiting on its client,
+  // keyed by connection id.
+  TimerWheel timers_;
+
+  // The open connections, keyed by the connection id that is also
+  // stored in their epoll events.
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> conns_;
+  uint64_t next_conn_id_;
+
+  // Under io_uring, the requests that are waiting for room in the
+  // submission ring, tagged like their SQEs' user_data.
+  std::vector<uint64_t> deferred_;
+
+  // See GetStats().  Only the reactor thread updates them.
+  std::atomic<uint64_t> tasks_done_;
+  std::atomic<uint64_t> queue_wait_ns_;
+  std::atomic<uint64_t> max_queue_wait_ns_;
+
+  // Tasks the workers have finished, waiting for the reactor thread to
+  // write their responses.  Guarded by done_lock_.
+  pthread_mutex_t done_lock_;
+  std::list<RequestTask*> done_;
+
+  // The worker threads.  The destructor shuts the pool down first, since
+  // tasks still queued in it post their completions back to us.
+  std::unique_ptr<ThreadPool> pool_;
+
+  // The io_uring instance, if UseIoUring() succeeded; nullptr on epoll.
+  std::unique_ptr<IoUring> ring_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_HTTPREACTOR_H_
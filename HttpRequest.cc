@@ -0,0 +1,184 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string>
+#include <string_view>
+
+#include "./HttpRequest.h"
+
+using std::string;
+using std::string_view;
+
+namespace hw4 {
+
+// Strips spaces and tabs from both ends of "s".
+static string_view Trim(string_view s);
+
+// Compares two strings, ignoring the case of ASCII letters.
+static bool EqualsIgnoreCase(string_view a, string_view b);
+
+// Removes the next line (without its "\n" or "\r\n") from the front of
+// "text" and returns it.
+static string_view NextLine(string_view* text);
+
+// Removes the next space-separated word from the front of "line" and
+// returns it, or an empty view if there are no words left.
+static string_view NextWord(string_view* line);
+
+// Returns "view", moved from "from" to "to" if it pointed into "from".
+static string_view Rebase(string_view view, const string& from,
+                          const string& to);
+
+bool HttpRequest::Parse(string_view text) {
+  method_ = uri_ = version_ = string_view();
+  num_headers_ = 0;
+
+  string_view line = NextLine(&text);
+  method_ = NextWord(&line);
+  uri_ = NextWord(&line);
+  version_ = NextWord(&line);
+  bool ok = !uri_.empty();
+  if (!ok) {
+    uri_ = "/";  // by default, get "/".
+  }
+
+  // The header lines run up to the first blank line.
+  while (!text.empty()) {
+    line = NextLine(&text);
+    if (line.empty())
+      break;
+    size_t colon = line.find(':');
+    if (colon == string_view::npos)
+      continue;
+    string_view name = Trim(line.substr(0, colon));
+    string_view value = Trim(line.substr(colon + 1));
+    if (name.empty())
+      continue;
+
+    int i = 0;
+    while (i < num_headers_ && !EqualsIgnoreCase(headers_[i].name, name)) {
+      i++;
+    }
+    if (i < num_headers_) {
+      headers_[i].value = value;
+    } else if (num_headers_ < kMaxHeaders) {
+      headers_[num_headers_++] = {name, value};
+    }
+  }
+  return ok;
+}
+
+void HttpRequest::TakeOwnership() {
+  size_t len = method_.size() + uri_.size() + version_.size();
+  for (int i = 0; i < num_headers_; i++) {
+    len += headers_[i].name.size() + headers_[i].value.size();
+  }
+
+  string text;
+  text.reserve(len);
+  text.append(method_).append(uri_).append(version_);
+  for (int i = 0; i < num_headers_; i++) {
+    text.append(headers_[i].name).append(headers_[i].value);
+  }
+  storage_.swap(text);
+
+  // Point the views at the copy, in the order they were copied.
+  size_t pos = 0;
+  auto point_at_copy = [this, &pos](string_view* view) {
+    *view = string_view(storage_.data() + pos, view->size());
+    pos += view->size();
+  };
+  point_at_copy(&method_);
+  point_at_copy(&uri_);
+  point_at_copy(&version_);
+  for (int i = 0; i < num_headers_; i++) {
+    point_at_copy(&headers_[i].name);
+    point_at_copy(&headers_[i].value);
+  }
+}
+
+string_view HttpRequest::GetHeaderValue(string_view name) const {
+  for (int i = 0; i < num_headers_; i++) {
+    if (EqualsIgnoreCase(headers_[i].name, name))
+      return headers_[i].value;
+  }
+  return string_view();
+}
+
+void HttpRequest::CopyFrom(const HttpRequest& other) {
+  storage_ = other.storage_;
+  method_ = Rebase(other.method_, other.storage_, storage_);
+  uri_ = Rebase(other.uri_, other.storage_, storage_);
+  version_ = Rebase(other.version_, other.storage_, storage_);
+  num_headers_ = other.num_headers_;
+  for (int i = 0; i < num_headers_; i++) {
+    headers_[i].name = Rebase(other.headers_[i].name, other.storage_,
+                              storage_);
+    headers_[i].value = Rebase(other.headers_[i].value, other.storage_,
+                               storage_);
+  }
+}
+
+static string_view Trim(string_view s) {
+  size_t start = s.find_first_not_of(" \t");
+  if (start == string_view::npos)
+    return string_view();
+  size_t end = s.find_last_not_of(" \t");
+  return s.substr(start, end - start + 1);
+}
+
+static bool EqualsIgnoreCase(string_view a, string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    char ca = a[i], cb = b[i];
+    if (ca >= 'A' && ca <= 'Z')
+      ca += 'a' - 'A';
+    if (cb >= 'A' && cb <= 'Z')
+      cb += 'a' - 'A';
+    if (ca != cb)
+      return false;
+  }
+  return true;
+}
+
+static string_view NextLine(string_view* text) {
+  size_t eol = text->find('\n');
+  string_view line = text->substr(0, eol);
+  text->remove_prefix(eol == string_view::npos ? text->size() : eol + 1);
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
+static string_view NextWord(string_view* line) {
+  size_t start = line->find_first_not_of(' ');
+  if (start == string_view::npos) {
+    *line = string_view();
+    return string_view();
+  }
+  line->remove_prefix(start);
+  size_t end = line->find(' ');
+  string_view word = line->substr(0, end);
+  line->remove_prefix(word.size());
+  return word;
+}
+
+static string_view Rebase(string_view view, const string& from,
+                          const string& to) {
+  const char* begin = from.data();
+  if (view.data() < begin || view.data() > begin + from.size())
+    return view;
+  return string_view(to.data() + (view.data() - begin), view.size());
+}
+
+}  // namespace hw4
@@ -14,8 +14,8 @@
 
 #include <stdint.h>
 
-#include <map>
 #include <string>
+#include <string_view>
 
 namespace hw4 {
 
@@ -35,49 +35,72 @@ namespace hw4 {
 // GET /foo/bar?baz=bam HTTP/1.1\r\n
 // Host: www.news.com\r\n
 //
+// Parse() doesn't copy the request: the URI and the header names and
+// values are string_views into the parsed text, and the headers live in
+// a small fixed-size array.  Use TakeOwnership() to give a request its
+// own copy of the text when it has to outlive it.
 class HttpRequest {
  public:
-  HttpRequest() { }
-  explicit HttpRequest(const std::string& uri) : uri_(uri) { }
-  virtual ~HttpRequest() { }
+  // The most headers a request keeps; Parse() ignores any beyond these.
+  static const int kMaxHeaders = 32;
 
-  const std::string& uri() const { return uri_; }
-  void set_uri(const std::string& uri) { uri_ = uri; }
-
-  // Returns the value associated with the passed-in header name, or empty
-  // string if it does not exist in the header map.  The passed-in name must
-  // be entirely lowercase to comply with our implementation of RFC 2616:4.2.
-  std::string GetHeaderValue(const std::string& name) const {
-    std::map<std::string, std::string>::const_iterator it = headers_.find(name);
-    if (it == headers_.end()) {
-      return "";
-    } else {
-      return it->second;
+  HttpRequest() : uri_("/"), num_headers_(0) { }
+  explicit HttpRequest(const std::string& uri)
+    : storage_(uri), uri_(storage_), num_headers_(0) { }
+  HttpRequest(const HttpRequest& other) { CopyFrom(other); }
+  HttpRequest& operator=(const HttpRequest& other) {
+    if (this != &other) {
+      CopyFrom(other);
     }
+    return *this;
   }
+  virtual ~HttpRequest() { }
 
-  // Adds a name -> value mapping to the header map, over-writing any existing
-  // previous mapping for name.
-  void AddHeader(const std::string& name, const std::string& value) {
-    headers_[name] = value;
-  }
+  // Parse the request header "text" (the request line, then header
+  // lines, up to and including the blank line) into this request,
+  // replacing whatever it held before.  Header lines without a colon
+  // are skipped.  The request refers into "text", which must outlive it
+  // (or until TakeOwnership() is called).  Never allocates.
+  //
+  // Returns false if the request line doesn't have a method and a URI.
+  bool Parse(std::string_view text);
+
+  // Copy the text this request refers to into the request itself.
+  void TakeOwnership();
+
+  std::string_view method() const { return method_; }
+  std::string_view uri() const { return uri_; }
+  std::string_view version() const { return version_; }
+
+  // Returns the value associated with the passed-in header name, or an
+  // empty string if the request has no such header.  Header names are
+  // case-insensitive (RFC 2616:4.2); values are returned as sent.
+  std::string_view GetHeaderValue(std::string_view name) const;
 
   // Returns the number of headers this HttpRequest contains
-  int GetHeaderCount() {
-    return headers_.size();
-  }
+  int GetHeaderCount() const { return num_headers_; }
 
  private:
-  // Which URI did the client request?
-  std::string uri_;
+  struct Header {
+    std::string_view name;
+    std::string_view value;
+  };
 
-  // A map from mapping a header name to a header value, which represents the
-  // headers a client would supply to us. Due to RFC 2616:4.2 stating that
-  // header names are case-insensitive, convert all header names to be
-  // lowercase.
-  //
-  // But note that the header values can remain the same.
-  std::map<std::string, std::string> headers_;
+  // Copy "other", pointing the copies of any views into other.storage_
+  // at our own storage_ instead.
+  void CopyFrom(const HttpRequest& other);
+
+  // Only used once the request owns its text (see TakeOwnership()).
+  std::string storage_;
+
+  std::string_view method_;
+  std::string_view uri_;
+  std::string_view version_;
+
+  // The headers, in the order they first appeared.  A repeated header
+  // keeps its first position but takes the last value sent.
+  Header headers_[kMaxHeaders];
+  int num_headers_;
 };
 
 }  // namespace hw4
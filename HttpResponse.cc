@@ -0,0 +1,172 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <memory>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "./HttpResponse.h"
+#include "./HttpUtils.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+void HttpResponse::AppendToBody(const string& body_fragment) {
+  if (body_.empty() || body_.back().shared_ || body_.back().is_file()) {
+    body_.emplace_back(string());
+  }
+  body_.back().data_ += body_fragment;
+  body_size_ += body_fragment.size();
+  serialized_.reset();
+}
+
+void HttpResponse::AppendToBody(string&& body_fragment) {
+  if (body_.empty() || body_.back().shared_ || body_.back().is_file()) {
+    body_size_ += body_fragment.size();
+    body_.emplace_back(std::move(body_fragment));
+    serialized_.reset();
+  } else {
+    AppendToBody(static_cast<const string&>(body_fragment));
+  }
+}
+
+void HttpResponse::AppendToBody(shared_ptr<const string> buffer) {
+  body_size_ += buffer->size();
+  body_.emplace_back(std::move(buffer));
+  serialized_.reset();
+}
+
+void HttpResponse::AppendToBody(shared_ptr<const string> buffer,
+                                size_t offset, size_t length) {
+  Verify333(offset <= buffer->size() && length <= buffer->size() - offset);
+  std::string_view bytes = std::string_view(*buffer).substr(offset, length);
+  AppendToBody(shared_ptr<const void>(std::move(buffer)), bytes);
+}
+
+void HttpResponse::AppendToBody(shared_ptr<const void> owner,
+                                std::string_view bytes) {
+  body_size_ += bytes.size();
+  body_.emplace_back(std::move(owner), bytes);
+  serialized_.reset();
+}
+
+void HttpResponse::AppendFileToBody(shared_ptr<const OpenFile> file,
+                                    off_t offset, size_t length) {
+  body_size_ += length;
+  body_.emplace_back(std::move(file), offset, length);
+  serialized_.reset();
+}
+
+void HttpResponse::DrainBodySource() {
+  if (!body_source_)
+    return;
+  string chunk;
+  bool more;
+  do {
+    more = body_source_->Next(&chunk);
+    AppendToBody(chunk);
+    chunk.clear();
+  } while (more);
+  body_source_.reset();
+}
+
+vector<HttpResponse::Segment> HttpResponse::ReleaseBody() {
+  vector<Segment> body;
+  body.swap(body_);
+  body_size_ = 0;
+  serialized_.reset();
+  return body;
+}
+
+string HttpResponse::GenerateHeaders() const {
+  string length = std::to_string(body_size_);
+  size_t size = protocol_.size() + message_.size() + length.size() + 40;
+  if (!content_type_.empty()) {
+    size += content_type_.size() + 16;
+  }
+  for (const auto& header : headers_) {
+    size += header.first.size() + header.second.size() + 4;
+  }
+  if (header_block_) {
+    size += header_block_->size();
+  }
+
+  string resp;
+  resp.reserve(size);
+  resp.append(protocol_).append(" ").append(std::to_string(response_code_))
+      .append(" ").append(message_).append("\r\n");
+  if (!content_type_.empty()) {
+    resp.append("Content-type: ").append(content_type_).append("\r\n");
+  }
+  for (const auto& header : headers_) {
+    resp.append(header.first).append(": ").append(header.second)
+        .append("\r\n");
+  }
+  if (header_block_) {
+    resp.append(*header_block_);
+  }
+  if (body_source_) {
+    resp.append("Transfer-encoding: chunked\r\n");
+  } else if (response_code_ != 304) {
+    resp.append("Content-length: ").append(length).append("\r\n");
+  }
+  resp.append("\r\n");
+  return resp;
+}
+
+string HttpResponse::GenerateResponseString() const {
+  if (serialized_)
+    return *serialized_;
+
+  string resp = GenerateHeaders();
+  size_t head_size = resp.size();
+  resp.resize(head_size + body_size_);
+
+  char* dst = &resp[head_size];
+  for (const Segment& seg : body_) {
+    if (seg.is_file()) {
+      ssize_t res = WrappedPread(seg.file()->fd(), dst, seg.size(),
+                                 seg.offset());
+      if (res != static_cast<ssize_t>(seg.size()))
+        return string();
+    } else {
+      seg.bytes().copy(dst, seg.size());
+    }
+    dst += seg.size();
+  }
+  return resp;
+}
+
+void HttpResponse::Preserialize() {
+  Verify333(!body_source_);
+  serialized_.reset();
+  string body;
+  body.reserve(body_size_);
+  for (const Segment& seg : body_) {
+    Verify333(!seg.is_file());
+    body.append(seg.bytes());
+  }
+  body_.clear();
+  if (!body.empty()) {
+    body_.emplace_back(std::make_shared<const string>(std::move(body)));
+  }
+  serialized_ = std::make_shared<const string>(GenerateResponseString());
+}
+
+}  // namespace hw4
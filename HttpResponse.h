@@ -13,13 +13,32 @@
 #define HW4_HTTPRESPONSE_H_
 
 #include <stdint.h>
+#include <sys/types.h>  // for off_t
+#include <unistd.h>     // for close()
 
 #include <map>
+#include <memory>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <vector>
 
 namespace hw4 {
 
+// An open file that response bodies can send ranges of.  The file is
+// closed when the last response referring to it goes away.
+class OpenFile {
+ public:
+  explicit OpenFile(int fd) : fd_(fd) { }
+  OpenFile(const OpenFile&) = delete;
+  OpenFile& operator=(const OpenFile&) = delete;
+  virtual ~OpenFile() { close(fd_); }
+
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
 // This class represents an HTTP Response, including the headers and body.
 // Clients (like in HttpServer.cc) will create instances of this class to
 // prepare HTTP Responses, and GenerateResponseString() will generate a
@@ -40,38 +59,187 @@ namespace hw4 {
 // Content-length: 10\r\n
 // \r\n
 // Hi there!!
-
+//
+// The body is kept as a list of segments rather than one string, so
+// that HttpConnection can hand the header block and the segments to a
+// single writev() without joining them first.
 class HttpResponse {
  public:
+  // One piece of a response body: bytes the response owns, immutable
+  // bytes it shares with other responses (e.g. part of a buffer, or of a
+  // mapped file), or a range of an open file.
+  class Segment {
+   public:
+    explicit Segment(std::string data) : data_(std::move(data)) { }
+    explicit Segment(std::shared_ptr<const std::string> data)
+      : shared_bytes_(*data), shared_(std::move(data)) { }
+    Segment(std::shared_ptr<const void> owner, std::string_view bytes)
+      : shared_bytes_(bytes), shared_(std::move(owner)) { }
+    Segment(std::shared_ptr<const OpenFile> file, off_t offset,
+            size_t length)
+      : file_(std::move(file)), offset_(offset), length_(length) { }
+
+    bool is_file() const { return file_ != nullptr; }
+
+    // The bytes of an owned or shared segment.
+    std::string_view bytes() const {
+      return shared_ ? shared_bytes_ : std::string_view(data_);
+    }
+
+    // The file and range of a file segment.
+    const OpenFile* file() const { return file_.get(); }
+    off_t offset() const { return offset_; }
+
+    size_t size() const { return is_file() ? length_ : bytes().size(); }
+
+   private:
+    friend class HttpResponse;
+
+    std::string data_;
+
+    // Shared bytes, and whatever keeps them alive.
+    std::string_view shared_bytes_;
+    std::shared_ptr<const void> shared_;
+
+    std::shared_ptr<const OpenFile> file_;
+    off_t offset_ = 0;
+    size_t length_ = 0;
+  };
+
+  // Produces a body a piece at a time, for responses that are too big
+  // or too slow to build up front.  See set_body_source().
+  class BodySource {
+   public:
+    virtual ~BodySource() { }
+
+    // Append the next piece of the body to "chunk".  Returns false once
+    // the body is complete (possibly after appending a last piece).
+    virtual bool Next(std::string* chunk) = 0;
+  };
+
   HttpResponse() { }
   virtual ~HttpResponse() { }
 
-  void set_protocol(const std::string& protocol) { protocol_ = protocol; }
-  void set_response_code(uint16_t code) { response_code_ = code; }
-  void set_message(const std::string& msg) { message_ = msg; }
-  void set_content_type(const std::string& type) { content_type_ = type; }
+  void set_protocol(const std::string& protocol) {
+    protocol_ = protocol;
+    serialized_.reset();
+  }
+  void set_response_code(uint16_t code) {
+    response_code_ = code;
+    serialized_.reset();
+  }
+  void set_message(const std::string& msg) {
+    message_ = msg;
+    serialized_.reset();
+  }
+  void set_content_type(const std::string& type) {
+    content_type_ = type;
+    serialized_.reset();
+  }
 
-  void AppendToBody(const std::string& body_fragment) {
-    body_ += body_fragment;
+  // Add (or replace) a header.  Headers are sent after "Content-type:" and
+  // before "Content-length:".
+  void set_header(const std::string& name, const std::string& value) {
+    headers_[name] = value;
+    serialized_.reset();
   }
 
-  // A method to generate a std::string of the HTTP response, suitable for
-  // writing back to the client.
+  // Send "block", one or more complete "name: value\r\n" lines, after
+  // the headers set with set_header().  For headers that are rendered
+  // once and shared by many responses.
+  void set_header_block(std::shared_ptr<const std::string> block) {
+    header_block_ = std::move(block);
+    serialized_.reset();
+  }
+
+  // Append bytes to the body.  Consecutive owned bytes share a segment.
+  void AppendToBody(const std::string& body_fragment);
+  void AppendToBody(std::string&& body_fragment);
+
+  // Append an immutable buffer, or "length" bytes of it starting at
+  // "offset", to the body without copying them.
+  void AppendToBody(std::shared_ptr<const std::string> buffer);
+  void AppendToBody(std::shared_ptr<const std::string> buffer, size_t offset,
+                    size_t length);
+
+  // Append immutable "bytes" that "owner" keeps alive, e.g. part of a
+  // mapped file, to the body without copying them.
+  void AppendToBody(std::shared_ptr<const void> owner,
+                    std::string_view bytes);
+
+  // Append "length" bytes of "file", starting at "offset", to the body.
+  // They are only read when the response is written.
+  void AppendFileToBody(std::shared_ptr<const OpenFile> file, off_t offset,
+                        size_t length);
+
+  // Have the rest of the body, after whatever has been appended so far,
+  // come from "source".  Such a response is sent with chunked
+  // transfer-encoding instead of a "Content-length:" header, as the
+  // source produces it.  Copies of the response share the source, so
+  // only one of them may be sent.
+  void set_body_source(std::shared_ptr<BodySource> source) {
+    body_source_ = std::move(source);
+    serialized_.reset();
+  }
+
+  // Returns true if the response has a body source.
+  bool is_streamed() const { return body_source_ != nullptr; }
+
+  // Returns the body source, or nullptr if the response has none.
+  const std::shared_ptr<BodySource>& body_source() const {
+    return body_source_;
+  }
+
+  // Returns the body source, leaving the response without one.
+  std::shared_ptr<BodySource> ReleaseBodySource() {
+    serialized_.reset();
+    return std::move(body_source_);
+  }
+
+  // Run the body source to completion, appending everything it produces
+  // to the body, so that the response is no longer streamed.
+  void DrainBodySource();
+
+  // Returns the size of the body, in bytes (not counting what a body
+  // source has yet to produce).
+  size_t body_size() const { return body_size_; }
+
+  // Returns the body segments, in order.
+  const std::vector<Segment>& body() const { return body_; }
+
+  // Moves the body segments out of the response, leaving it without a
+  // body.
+  std::vector<Segment> ReleaseBody();
+
+  // Generate the status line and headers, through the blank line that
+  // ends them.
   //
   // The "Content-length:" header is automatically generated, which will be the
   // last header in the block. The value of that Content-length header is the
-  // size of the response body (in bytes).
-  std::string GenerateResponseString() const {
-    std::stringstream resp;
+  // size of the response body (in bytes).  A streamed response gets a
+  // "Transfer-encoding: chunked" header there instead, and a 304 (Not
+  // Modified) response, which never has a body, gets neither.
+  std::string GenerateHeaders() const;
 
-    resp << protocol_ << " " << response_code_ << " " << message_ << "\r\n";
-    if (!content_type_.empty()) {
-      resp << "Content-type: " << content_type_ << "\r\n";
-    }
-    resp << "Content-length: " << body_.size() << "\r\n";
-    resp << "\r\n";
-    resp << body_;
-    return resp.str();
+  // A method to generate a std::string of the HTTP response, suitable for
+  // writing back to the client: the headers, followed by the whole body.
+  // Returns an empty string if part of a file in the body can't be read.
+  // Not for streamed responses.
+  std::string GenerateResponseString() const;
+
+  // Serialize the whole response, headers and body, into one immutable
+  // buffer, and move the body into a buffer of its own, so that copies
+  // of the response share both instead of copying them.  A copy is then
+  // sent by queuing the one buffer.  Changing a response afterwards
+  // drops its serialized form, but not the shared body.  For responses
+  // that are sent over and over unchanged; not for streamed responses
+  // or those with files in the body.
+  void Preserialize();
+
+  // Returns the buffer Preserialize() produced, or null if the response
+  // hasn't been serialized since it last changed.
+  const std::shared_ptr<const std::string>& serialized() const {
+    return serialized_;
   }
 
  private:
@@ -87,8 +255,19 @@ class HttpResponse {
   // The HTTP content type string to pass back in the header.  Optional.
   std::string content_type_;
 
-  // The body of the response.
-  std::string body_;
+  // Any other headers, by name, and any pre-rendered ones.
+  std::map<std::string, std::string> headers_;
+  std::shared_ptr<const std::string> header_block_;
+
+  // The body of the response, and its total size.
+  std::vector<Segment> body_;
+  size_t body_size_ = 0;
+
+  // Where the rest of a streamed body comes from.
+  std::shared_ptr<BodySource> body_source_;
+
+  // The whole response, if it has been serialized (see Preserialize()).
+  std::shared_ptr<const std::string> serialized_;
 };
 
 }  // namespace hw4
@@ -11,29 +11,48 @@
  * author.
  */
 
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <random>
 #include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <utility>
 
 #include "./FileReader.h"
-#include "./HttpConnection.h"
+#include "./HtmlTemplate.h"
+#include "./HttpCompression.h"
+#include "./HttpReactor.h"
 #include "./HttpRequest.h"
 #include "./HttpUtils.h"
 #include "./HttpServer.h"
 #include "./libhw3/QueryProcessor.h"
 
+extern "C"
+{
+#include "libhw1/CSE333.h"
+}
+
 using std::cerr;
 using std::cout;
 using std::endl;
 using std::list;
 using std::map;
+using std::pair;
+using std::shared_ptr;
 using std::string;
-using std::stringstream;
 using std::unique_ptr;
+using std::vector;
 
 namespace hw4
 {
@@ -60,132 +79,397 @@ namespace hw4
       "</form>\n"
       "</center><p>\n";
 
-  // static
-  const int HttpServer::kNumThreads = 100;
+  // How many results each chunk of a streamed result page lists.
+  static const size_t kResultsPerChunk = 256;
+
+  // The constant parts of the search page, built once.
+  struct SearchPage
+  {
+    SearchPage();
+
+    // The whole response for the page without a query, serialized.
+    HttpResponse landing;
+
+    // The logo and search box, which start every page.
+    shared_ptr<const string> header;
+
+    // The line above the results, and the results themselves.
+    HtmlTemplate found;
+    HtmlTemplate not_found;
+    HtmlTemplate local_result;
+    HtmlTemplate remote_result;
+  };
+
+  SearchPage::SearchPage()
+      : header(std::make_shared<const string>(kThreegleStr)),
+        found("<div>{count} results found for <b>{terms}</b></div><br>"),
+        not_found("<div>No results found for <b>{terms}</b></div><br>"),
+        local_result("<div><li><a href=\"/static/{name}\">{name}</a>"
+                     " [{rank}]</li></div>"),
+        remote_result("<div><li><a href=\"{url}\" target=\"_blank\">"
+                      "{url}</a> [{rank}]</li></div>")
+  {
+    landing.set_protocol("HTTP/1.1");
+    landing.set_response_code(200);
+    landing.set_message("OK");
+    landing.set_content_type("text/html");
+    landing.AppendToBody(header);
+    landing.Preserialize();
+  }
+
+  // Returns the search page, building it on the first call.
+  static const SearchPage &GetSearchPage()
+  {
+    static const SearchPage page;
+    return page;
+  }
 
-  // This is the function that threads are dispatched into
-  // in order to process new client connections.
-  static void HttpServer_ThrFn(ThreadPool::Task *t);
+  // The body of a result page, after the logo and search box.  The first
+  // chunk runs the query and says how many results it found; the rest
+  // list the results, kResultsPerChunk at a time.  Runs on the worker
+  // threads, one chunk at a time.
+  class QueryResultsSource : public HttpResponse::BodySource
+  {
+  public:
+    QueryResultsSource(const string &search_terms,
+                       const vector<string> &terms,
+                       const list<string> *indices)
+        : search_terms_(EscapeHtml(search_terms)), terms_(terms),
+          indices_(indices), queried_(false), next_(0) {}
+
+    bool Next(string *chunk) override;
+
+  private:
+    // The terms as typed, and ready to put in the page.
+    string search_terms_;
+    vector<string> terms_;
+    const list<string> *indices_;
+
+    // Whether the query has run, its results, and the first result that
+    // hasn't been listed yet.
+    bool queried_;
+    vector<hw3::QueryProcessor::QueryResult> results_;
+    size_t next_;
+  };
 
   // Given a request, produce a response.
   static HttpResponse ProcessRequest(const HttpRequest &req,
                                      const string &base_dir,
-                                     const list<string> &indices);
+                                     const HttpServerOptions &options,
+                                     ContentCache *content_cache,
+                                     PrecompressedStore *precompressed,
+                                     const StaticBundle *bundle,
+                                     const list<string> &indices,
+                                     const vector<unique_ptr<HttpReactor>>
+                                         &reactors);
+
+  // Process a file request, from "bundle" if it isn't nullptr, or else
+  // from "base_dir".  "content_cache" and "precompressed" may be nullptr.
+  static HttpResponse ProcessFileRequest(
+      const HttpRequest &req, const string &uri, const string &base_dir,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache, PrecompressedStore *precompressed,
+      const StaticBundle *bundle);
 
-  // Process a file request.
-  static HttpResponse ProcessFileRequest(const string &uri,
-                                         const string &base_dir);
+  // Returns the server's counters as a plain-text page, one "name value"
+  // pair per line.
+  static HttpResponse ProcessStatsRequest(ContentCache *content_cache,
+                                          PrecompressedStore *precompressed,
+                                          const StaticBundle *bundle,
+                                          const vector<unique_ptr<HttpReactor>>
+                                              &reactors);
 
-  // Process a query request.
+  // Open the static file "file_name" under "base_dir", whose URI is
+  // "uri", and describe it for serving, with whatever compressed copies
+  // of it "precompressed" has; through "content_cache", if it isn't
+  // nullptr.  Returns nullptr if there is no such file.
+  static shared_ptr<const ContentCache::Entry> LoadFile(
+      const string &base_dir, const string &file_name, const string &uri,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache, PrecompressedStore *precompressed);
+
+  // Find the static file "file_name", whose URI is "uri", in "bundle",
+  // and describe it for serving; through "content_cache", if it isn't
+  // nullptr.  Returns nullptr if the bundle has no such file.
+  static shared_ptr<const ContentCache::Entry> LoadBundledFile(
+      const StaticBundle &bundle, const string &file_name, const string &uri,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache);
+
+  // Add "contents", the file "entry" describes compressed with "coding",
+  // which "owner" keeps in memory, to the entry's compressed copies.
+  // "cache" is the file's Cache-Control value, or nullptr.
+  static void AddEncoded(ContentCache::Entry *entry, ContentCoding coding,
+                         shared_ptr<const void> owner,
+                         std::string_view contents, const string *cache);
+
+  // Returns the header block for a static file with entity tag "etag",
+  // last modified at "mtime", compressed with "coding".  "cache" is the
+  // file's Cache-Control value, or nullptr, and "vary" says whether the
+  // file also comes in other codings.
+  static shared_ptr<const string> RenderFileHeaders(const string &etag,
+                                                    time_t mtime,
+                                                    const string *cache,
+                                                    ContentCoding coding,
+                                                    bool vary);
+
+  // Returns the compressed copy of the file "entry" describes to send in
+  // answer to "req", or nullptr to send the file as it is.
+  static const ContentCache::Entry::Encoded *ChooseEncoded(
+      const HttpRequest &req, const ContentCache::Entry &entry);
+
+  // Returns true if a Range header in "req" applies to the version of a
+  // file with entity tag "etag", last modified at "mtime": if there is
+  // no If-Range header, or it names that version.
+  static bool IsRangeCurrent(const HttpRequest &req, const string &etag,
+                             time_t mtime);
+
+  // Make "ret" a "206 Partial Content" response carrying "ranges" of the
+  // file "entry" describes, or, if there are none, a "416 Range Not
+  // Satisfiable" one.
+  static void SetRangeResponse(const ContentCache::Entry &entry,
+                               const vector<ByteRange> &ranges,
+                               HttpResponse *ret);
+
+  // Append "length" bytes of the file "entry" describes, starting at
+  // "offset", to the body of "ret".
+  static void AppendFileRange(const ContentCache::Entry &entry,
+                              uint64_t offset, size_t length,
+                              HttpResponse *ret);
+
+  // Returns the boundary that separates the parts of a multi-range
+  // response, chosen once per process.
+  static const string &GetByteRangesBoundary();
+
+  // Returns the strong entity tag for the file "st" describes.  It
+  // changes whenever the file is replaced, resized or written to.
+  static string MakeETag(const struct stat &st);
+
+  // Returns true if the conditional headers in "req" say the client's
+  // copy of a file with entity tag "etag", last modified at "mtime", is
+  // still current.
+  static bool IsNotModified(const HttpRequest &req, const string &etag,
+                            time_t mtime);
+
+  // Compress "response", a dynamic page, if the client accepts it
+  // compressed and it is worth compressing.
+  static void MaybeCompress(const HttpRequest &req,
+                            const HttpServerOptions &options,
+                            HttpResponse *response);
+
+  // Returns the Cache-Control value for the file at "path", or nullptr if
+  // it shouldn't have one.
+  static const string *FindCacheControl(
+      const string &path, const vector<pair<string, string>> &cache_control);
+
+  // Process a query request against "indices".
   static HttpResponse ProcessQueryRequest(const string &uri,
                                           const list<string> &indices);
 
+  // Returns the calling thread's own QueryProcessor for "indices",
+  // opening it the first time.  Each one reads the indices through its
+  // own (FILE*)s, so the workers can all query at once.  It doesn't
+  // validate the indices again: HttpServer::Run() already has.
+  static hw3::QueryProcessor *GetQueryProcessor(const list<string> &indices);
+
   ///////////////////////////////////////////////////////////////////////////////
   // HttpServer
   ///////////////////////////////////////////////////////////////////////////////
+  HttpServer::HttpServer(uint16_t port,
+                         const string &static_file_dir_path,
+                         const list<string> &indices,
+                         const HttpServerOptions &options)
+      : port_(port), options_(options),
+        static_file_dir_path_(static_file_dir_path), indices_(indices) {}
+
   bool HttpServer::Run(void)
   {
-    // Create the server listening socket.
-    int listen_fd;
-    cout << "  creating and binding the listening socket..." << endl;
-    if (!socket_.BindAndListen(AF_INET6, &listen_fd))
-    {
-      cerr << endl
-           << "Couldn't bind to the listening socket." << endl;
-      return false;
-    }
+    // Validate the indices' checksums once, up front, rather than on
+    // every query.  The QueryProcessor aborts the process if an index is
+    // missing or corrupt, so this also catches bad indices before we
+    // start accepting connections.
+    cout << "  opening and validating the indices..." << endl;
+    hw3::QueryProcessor(indices_, true);
+    GetSearchPage();
 
-    // Spin, accepting connections and dispatching them.  Use a
-    // threadpool to dispatch connections into their own thread.
-    cout << "  accepting connections..." << endl
-         << endl;
-    ThreadPool tp(kNumThreads);
-    while (1)
-    {
-      HttpServerTask *hst = new HttpServerTask(HttpServer_ThrFn);
-      hst->base_dir = static_file_dir_path_;
-      hst->indices = &indices_;
-      if (!socket_.Accept(&hst->client_fd,
-                          &hst->c_addr,
-                          &hst->c_port,
-                          &hst->c_dns,
-                          &hst->s_addr,
-                          &hst->s_dns))
+    // Mapping the bundle takes the same time however big it is; its
+    // files are only read as they are served.
+    if (!options_.bundle_path.empty())
+    {
+      cout << "  mapping the static file bundle..." << endl;
+      bundle_.reset(new StaticBundle());
+      if (!bundle_->Open(options_.bundle_path))
       {
-        // The accept failed for some reason, so quit out of the server.
-        // (Will happen when kill command is used to shut down the server.)
-        break;
+        cerr << endl
+             << "Couldn't open the static file bundle." << endl;
+        return false;
       }
-      // The accept succeeded; dispatch it.
-      tp.Dispatch(hst);
+      cout << "    " << bundle_->num_files() << " file(s)" << endl;
     }
-    return true;
-  }
 
-  static void HttpServer_ThrFn(ThreadPool::Task *t)
-  {
-    // Cast back our HttpServerTask structure with all of our new
-    // client's information in it.
-    unique_ptr<HttpServerTask> hst(static_cast<HttpServerTask *>(t));
-    cout << "  client " << hst->c_dns << ":" << hst->c_port << " "
-         << "(IP address " << hst->c_addr << ")" << " connected." << endl;
-
-    // Read in the next request, process it, and write the response.
-
-    // Use the HttpConnection class to read and process the next
-    // request from our current client, then write out our response.  If
-    // the client sends a "Connection: close\r\n" header, then shut down
-    // the connection -- we're done.
-    //
-    // Hint: the client can make multiple requests on our single connection,
-    // so we should keep the connection open between requests rather than
-    // creating/destroying the same connection repeatedly.
-
-    // STEP 1:
-    HttpConnection connection = HttpConnection(hst->client_fd);
-    HttpRequest request;
-    bool done = false;
-    while (!done)
+    // Create the server's listening sockets.  With several listeners,
+    // they all share the port through SO_REUSEPORT.  The event loops
+    // need them to be non-blocking.
+    uint32_t num_listeners = options_.num_listeners;
+    if (num_listeners == 0)
+    {
+      long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      num_listeners = (num_cpus > 0) ? static_cast<uint32_t>(num_cpus) : 1;
+    }
+    vector<int> listen_fds;
+    cout << "  creating and binding " << num_listeners
+         << " listening socket(s)..." << endl;
+    for (uint32_t i = 0; i < num_listeners; i++)
     {
-      if (!connection.GetNextRequest(&request))
+      int listen_fd;
+      ServerSocket *ss = new ServerSocket(port_);
+      sockets_.push_back(unique_ptr<ServerSocket>(ss));
+      ss->set_reuse_port(num_listeners > 1);
+      ss->set_resolve_names(!options_.lazy_dns);
+      if (!ss->BindAndListen(AF_INET6, &listen_fd) || !ss->SetNonBlocking())
       {
-        cerr << "Failed to get next request or";
-        cerr << "connection closed by the client." << endl;
-        break;
+        cerr << endl
+             << "Couldn't bind to the listening socket." << endl;
+        return false;
       }
-      HttpResponse response = ProcessRequest(request,
-                                             hst->base_dir, *(hst->indices));
+      listen_fds.push_back(listen_fd);
+    }
 
-      if (!connection.WriteResponse(response))
+    // Give each listener its own event loop and its own share of the
+    // worker threads.  Each event loop accepts connections and reads
+    // their requests, and hands complete requests to its worker group,
+    // which calls back into HandleRequest().
+    uint32_t min_per_listener = options_.min_threads / num_listeners;
+    uint32_t max_per_listener = options_.max_threads / num_listeners;
+    if (min_per_listener == 0)
+    {
+      min_per_listener = 1;
+    }
+    if (max_per_listener < min_per_listener)
+    {
+      max_per_listener = min_per_listener;
+    }
+    uint32_t queued_per_listener = options_.max_queued / num_listeners;
+    if (options_.max_queued != 0 && queued_per_listener == 0)
+    {
+      queued_per_listener = 1;
+    }
+    if (options_.precompress_bytes > 0 && bundle_ == nullptr)
+    {
+      cout << "  precompressing static files in the background..." << endl;
+      precompressed_.reset(new PrecompressedStore(
+          static_file_dir_path_, options_.precompress_bytes,
+          options_.compression_min_bytes));
+    }
+    if (options_.content_cache_bytes > 0)
+    {
+      content_cache_.reset(new ContentCache(
+          options_.content_cache_bytes, options_.content_cache_max_file_bytes,
+          options_.content_cache_max_fds));
+    }
+    if (options_.lazy_dns)
+    {
+      dns_cache_.reset(new DnsCache(options_.dns_cache_entries,
+                                    options_.dns_cache_ttl_secs));
+    }
+    for (uint32_t i = 0; i < num_listeners; i++)
+    {
+      reactors_.push_back(unique_ptr<HttpReactor>(
+          new HttpReactor(sockets_[i].get(), listen_fds[i],
+                          min_per_listener, max_per_listener,
+                          &HttpServer::HandleRequest, this)));
+      reactors_[i]->set_dns_cache(dns_cache_.get());
+      reactors_[i]->set_max_queued(queued_per_listener);
+      reactors_[i]->set_timeouts(options_.idle_timeout_secs * 1000,
+                                 options_.header_timeout_secs * 1000);
+      reactors_[i]->set_max_requests(options_.max_requests_per_connection);
+      if (options_.io_uring && !reactors_[i]->UseIoUring())
       {
-        cerr << "Failed to send response." << endl;
-        break;
+        cout << "  io_uring is not available; using epoll instead." << endl;
       }
+    }
 
-      if (request.GetHeaderValue("connection") == "close")
-      {
-        cerr << "Client requested to close connection." << endl;
-        done = true;
-      }
+    // The first event loop runs on this thread, the rest on their own.
+    cout << "  accepting connections..." << endl
+         << endl;
+    vector<pthread_t> threads(num_listeners);
+    for (uint32_t i = 1; i < num_listeners; i++)
+    {
+      Verify333(pthread_create(&threads[i], nullptr,
+                               &HttpServer::ReactorThreadFn,
+                               reactors_[i].get()) == 0);
+    }
+    bool ok = reactors_[0]->Run();
+    for (uint32_t i = 1; i < num_listeners; i++)
+    {
+      void *thread_ok;
+      Verify333(pthread_join(threads[i], &thread_ok) == 0);
+      ok = ok && (thread_ok != nullptr);
     }
+    return ok;
+  }
+
+  void HttpServer::Stop()
+  {
+    for (const unique_ptr<HttpReactor> &reactor : reactors_)
+    {
+      reactor->Stop();
+    }
+  }
+
+  void *HttpServer::ReactorThreadFn(void *arg)
+  {
+    HttpReactor *reactor = static_cast<HttpReactor *>(arg);
+    return reactor->Run() ? arg : nullptr;
+  }
+
+  HttpResponse HttpServer::HandleRequest(const HttpRequest &request,
+                                         void *arg)
+  {
+    HttpServer *server = static_cast<HttpServer *>(arg);
+    return ProcessRequest(request, server->static_file_dir_path_,
+                          server->options_, server->content_cache_.get(),
+                          server->precompressed_.get(), server->bundle_.get(),
+                          server->indices_, server->reactors_);
   }
 
   static HttpResponse ProcessRequest(const HttpRequest &req,
                                      const string &base_dir,
-                                     const list<string> &indices)
+                                     const HttpServerOptions &options,
+                                     ContentCache *content_cache,
+                                     PrecompressedStore *precompressed,
+                                     const StaticBundle *bundle,
+                                     const list<string> &indices,
+                                     const vector<unique_ptr<HttpReactor>>
+                                         &reactors)
   {
+    const string uri(req.uri());
+
     // Is the user asking for a static file?
-    if (req.uri().substr(0, 8) == "/static/")
+    if (uri.substr(0, 8) == "/static/")
     {
-      return ProcessFileRequest(req.uri(), base_dir);
+      return ProcessFileRequest(req, uri, base_dir, options.cache_control,
+                                content_cache, precompressed, bundle);
+    }
+
+    // Or for the server's counters?
+    if (!options.stats_path.empty() && uri == options.stats_path)
+    {
+      return ProcessStatsRequest(content_cache, precompressed, bundle,
+                                 reactors);
     }
 
     // The user must be asking for a query.
-    return ProcessQueryRequest(req.uri(), indices);
+    HttpResponse resp = ProcessQueryRequest(uri, indices);
+    MaybeCompress(req, options, &resp);
+    return resp;
   }
 
-  static HttpResponse ProcessFileRequest(const string &uri,
-                                         const string &base_dir)
+  static HttpResponse ProcessFileRequest(
+      const HttpRequest &req, const string &uri, const string &base_dir,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache, PrecompressedStore *precompressed,
+      const StaticBundle *bundle)
   {
     // The response we'll build up.
     HttpResponse ret;
@@ -220,61 +504,456 @@ namespace hw4
 
     ret.set_protocol("HTTP/1.1");
 
-    FileReader reader(base_dir, file_name);
+    // Everything about a file that doesn't depend on the request is
+    // worked out once, when it is first served, and cached with it.
+    shared_ptr<const ContentCache::Entry> entry;
+    if (content_cache != nullptr)
+    {
+      entry = content_cache->Lookup(file_name);
+    }
+    if (entry == nullptr && bundle != nullptr)
+    {
+      entry = LoadBundledFile(*bundle, file_name, new_uri, cache_control,
+                              content_cache);
+    }
+    else if (entry == nullptr)
+    {
+      entry = LoadFile(base_dir, file_name, new_uri, cache_control,
+                       content_cache, precompressed);
+    }
 
-    std::string contents;
-    if (reader.ReadFile(&contents))
+    if (entry == nullptr)
     {
-      ret.set_response_code(200);
-      ret.set_message("OK");
-      ret.AppendToBody(contents);
+      // If you couldn't find the file, return an HTTP 404 error.
+      ret.set_response_code(404);
+      ret.set_message("Not Found");
+      ret.AppendToBody("<html><body>Couldn't find file \"" + EscapeHtml(file_name) + "\"</body></html>\n");
+      return ret;
+    }
 
-      std::string extension = file_name.substr(file_name.find_last_of(".") + 1);
-      if (extension == "html" || extension == "htm")
-      {
-        ret.set_content_type("text/html");
-      }
-      else if (extension == "jpeg" || extension == "jpg")
-      {
-        ret.set_content_type("image/jpeg");
-      }
-      else if (extension == "png")
-      {
-        ret.set_content_type("image/png");
-      }
-      else if (extension == "gif")
-      {
-        ret.set_content_type("image/gif");
-      }
-      else if (extension == "css")
+    // A client that takes a compressed copy of the file gets the one it
+    // likes best.  Each copy has its own validators, which go out with
+    // the full response and with "304 Not Modified" alike, so that a
+    // client can keep asking conditionally.  A 304 never touches the
+    // file's contents.
+    const ContentCache::Entry::Encoded *encoded = ChooseEncoded(req, *entry);
+    ret.set_header_block(encoded ? encoded->header_block
+                                 : entry->header_block);
+    if (IsNotModified(req, encoded ? encoded->etag : entry->etag,
+                      entry->st.st_mtime))
+    {
+      ret.set_response_code(304);
+      ret.set_message("Not Modified");
+      return ret;
+    }
+
+    // A client resuming a download asks for just the bytes it is
+    // missing, provided its copy is still current; a bad Range header
+    // is ignored.
+    std::string_view range = req.GetHeaderValue("Range");
+    vector<ByteRange> ranges;
+    if (!range.empty() &&
+        IsRangeCurrent(req, entry->etag, entry->st.st_mtime) &&
+        ParseByteRanges(range, entry->st.st_size, &ranges))
+    {
+      SetRangeResponse(*entry, ranges, &ret);
+      return ret;
+    }
+
+    // A big file is sent straight from the file when the response is
+    // written, so it is never read into memory here.
+    ret.set_response_code(200);
+    ret.set_message("OK");
+    if (!entry->content_type.empty())
+    {
+      ret.set_content_type(entry->content_type);
+    }
+    if (encoded != nullptr)
+    {
+      ret.AppendToBody(encoded->owner, encoded->contents);
+    }
+    else
+    {
+      AppendFileRange(*entry, 0, entry->st.st_size, &ret);
+    }
+    return ret;
+  }
+
+  static const ContentCache::Entry::Encoded *ChooseEncoded(
+      const HttpRequest &req, const ContentCache::Entry &entry)
+  {
+    // A range is always of the file as it is.
+    if (entry.encoded.empty() || !req.GetHeaderValue("Range").empty())
+    {
+      return nullptr;
+    }
+    std::string_view accept = req.GetHeaderValue("Accept-Encoding");
+    const ContentCache::Entry::Encoded *best = nullptr;
+    double best_q = 0;
+    for (const auto &encoded : entry.encoded)
+    {
+      double q = AcceptedQValue(accept, encoded.coding);
+      if (q > best_q)
       {
-        ret.set_content_type("text/css");
+        best = &encoded;
+        best_q = q;
       }
-      else if (extension == "js")
+    }
+    return best;
+  }
+
+  static bool IsRangeCurrent(const HttpRequest &req, const string &etag,
+                             time_t mtime)
+  {
+    // The validator must be a strong one (RFC 7233:3.2): a tag that
+    // matches exactly, or the exact modification time.
+    std::string_view if_range = req.GetHeaderValue("If-Range");
+    if (if_range.empty())
+    {
+      return true;
+    }
+    if (if_range[0] == '"' || if_range.substr(0, 2) == "W/")
+    {
+      return if_range == etag;
+    }
+    time_t date;
+    return ParseHttpDate(if_range, &date) && date == mtime;
+  }
+
+  static void SetRangeResponse(const ContentCache::Entry &entry,
+                               const vector<ByteRange> &ranges,
+                               HttpResponse *ret)
+  {
+    string size = std::to_string(entry.st.st_size);
+    if (ranges.empty())
+    {
+      ret->set_response_code(416);
+      ret->set_message("Range Not Satisfiable");
+      ret->set_header("Content-Range", "bytes */" + size);
+      return;
+    }
+
+    ret->set_response_code(206);
+    ret->set_message("Partial Content");
+    if (ranges.size() == 1)
+    {
+      const ByteRange &range = ranges[0];
+      if (!entry.content_type.empty())
       {
-        ret.set_content_type("application/javascript");
+        ret->set_content_type(entry.content_type);
       }
-      else if (extension == "xml")
+      ret->set_header("Content-Range",
+                      "bytes " + std::to_string(range.first) + "-" +
+                          std::to_string(range.last) + "/" + size);
+      AppendFileRange(entry, range.first, range.last - range.first + 1, ret);
+      return;
+    }
+
+    // Several ranges go out as the parts of a multipart/byteranges body
+    // (RFC 7233:4.1), each with its own headers.
+    const string &boundary = GetByteRangesBoundary();
+    ret->set_content_type("multipart/byteranges; boundary=" + boundary);
+    for (const ByteRange &range : ranges)
+    {
+      string part_header = "\r\n--" + boundary + "\r\n";
+      if (!entry.content_type.empty())
       {
-        ret.set_content_type("application/xml");
+        part_header += "Content-type: " + entry.content_type + "\r\n";
       }
-      else if (extension == "txt")
+      part_header += "Content-Range: bytes " + std::to_string(range.first) +
+                     "-" + std::to_string(range.last) + "/" + size +
+                     "\r\n\r\n";
+      ret->AppendToBody(std::move(part_header));
+      AppendFileRange(entry, range.first, range.last - range.first + 1, ret);
+    }
+    ret->AppendToBody("\r\n--" + boundary + "--\r\n");
+  }
+
+  static void AppendFileRange(const ContentCache::Entry &entry,
+                              uint64_t offset, size_t length,
+                              HttpResponse *ret)
+  {
+    if (entry.contents != nullptr)
+    {
+      ret->AppendToBody(entry.contents, offset, length);
+    }
+    else if (entry.mapping != nullptr)
+    {
+      ret->AppendToBody(entry.mapping, entry.mapped.substr(offset, length));
+    }
+    else
+    {
+      ret->AppendFileToBody(entry.file, offset, length);
+    }
+  }
+
+  static const string &GetByteRangesBoundary()
+  {
+    // Random, so that no file we serve can contain it by design.
+    static const string boundary = []
+    {
+      std::random_device random;
+      char buf[40];
+      snprintf(buf, sizeof(buf), "333gle-%08x%08x", random(), random());
+      return string(buf);
+    }();
+    return boundary;
+  }
+
+  static shared_ptr<const ContentCache::Entry> LoadFile(
+      const string &base_dir, const string &file_name, const string &uri,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache, PrecompressedStore *precompressed)
+  {
+    FileReader reader(base_dir, file_name);
+    ContentCache::Entry entry;
+    int fd;
+    if (!reader.Open(&fd, &entry.st,
+                     (content_cache != nullptr) ? &entry.path : nullptr))
+    {
+      return nullptr;
+    }
+    entry.file = std::make_shared<const OpenFile>(fd);
+    entry.content_type = ContentTypeFor(file_name);
+    entry.etag = MakeETag(entry.st);
+
+    // A file whose compressed copies aren't ready yet isn't cached, so
+    // that it picks them up once they are.
+    bool pending = false;
+    shared_ptr<const PrecompressedStore::Variants> variants;
+    bool vary = (precompressed != nullptr &&
+                 PrecompressedStore::IsCompressible(file_name));
+    if (vary)
+    {
+      variants = precompressed->Find(file_name, entry.st, &pending);
+    }
+
+    const string *cache = FindCacheControl(uri, cache_control);
+    entry.header_block = RenderFileHeaders(
+        entry.etag, entry.st.st_mtime, cache, ContentCoding::kIdentity, vary);
+    if (variants != nullptr)
+    {
+      // The brotli copy is the smaller, so it goes first.
+      for (const auto &copy : {std::make_pair(ContentCoding::kBrotli,
+                                              variants->brotli),
+                               std::make_pair(ContentCoding::kGzip,
+                                              variants->gzip)})
       {
-        ret.set_content_type("text/plain");
+        if (copy.second != nullptr)
+        {
+          AddEncoded(&entry, copy.first, copy.second, *copy.second, cache);
+        }
       }
     }
-    else
+
+    if (content_cache != nullptr && !pending)
     {
-      // If you couldn't find the file, return an HTTP 404 error.
-      // ret.set_protocol("HTTP/1.1");
-      ret.set_response_code(404);
-      ret.set_message("Not Found");
-      ret.AppendToBody("<html><body>Couldn't find file \"" + EscapeHtml(file_name) + "\"</body></html>\n");
+      return content_cache->Insert(file_name, std::move(entry));
+    }
+    return std::make_shared<const ContentCache::Entry>(std::move(entry));
+  }
+
+  static shared_ptr<const ContentCache::Entry> LoadBundledFile(
+      const StaticBundle &bundle, const string &file_name, const string &uri,
+      const vector<pair<string, string>> &cache_control,
+      ContentCache *content_cache)
+  {
+    StaticBundle::File file;
+    if (!bundle.Lookup(file_name, &file))
+    {
+      return nullptr;
+    }
+
+    // The file is served straight out of the mapping, and never changes,
+    // so its entity tag comes from its contents rather than its inode.
+    ContentCache::Entry entry;
+    entry.mapping = bundle.mapping();
+    entry.mapped = file.contents;
+    memset(&entry.st, 0, sizeof(entry.st));
+    entry.st.st_size = file.contents.size();
+    entry.st.st_mtim = file.mtime;
+    entry.content_type = string(file.content_type);
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"b%" PRIx64 "-%zx\"", file.hash,
+             file.contents.size());
+    entry.etag = etag;
+
+    const string *cache = FindCacheControl(uri, cache_control);
+    bool vary = !file.gzip.empty() || !file.brotli.empty();
+    entry.header_block = RenderFileHeaders(
+        entry.etag, entry.st.st_mtime, cache, ContentCoding::kIdentity, vary);
+    if (!file.brotli.empty())
+    {
+      AddEncoded(&entry, ContentCoding::kBrotli, entry.mapping, file.brotli,
+                 cache);
+    }
+    if (!file.gzip.empty())
+    {
+      AddEncoded(&entry, ContentCoding::kGzip, entry.mapping, file.gzip,
+                 cache);
+    }
+
+    if (content_cache != nullptr)
+    {
+      return content_cache->Insert(file_name, std::move(entry));
     }
+    return std::make_shared<const ContentCache::Entry>(std::move(entry));
+  }
 
+  static void AddEncoded(ContentCache::Entry *entry, ContentCoding coding,
+                         shared_ptr<const void> owner,
+                         std::string_view contents, const string *cache)
+  {
+    ContentCache::Entry::Encoded encoded;
+    encoded.coding = coding;
+    encoded.owner = std::move(owner);
+    encoded.contents = contents;
+    encoded.etag = entry->etag.substr(0, entry->etag.size() - 1) + "-" +
+                   CodingName(coding) + "\"";
+    encoded.header_block = RenderFileHeaders(
+        encoded.etag, entry->st.st_mtime, cache, coding, true);
+    entry->encoded.push_back(std::move(encoded));
+  }
+
+  static shared_ptr<const string> RenderFileHeaders(const string &etag,
+                                                    time_t mtime,
+                                                    const string *cache,
+                                                    ContentCoding coding,
+                                                    bool vary)
+  {
+    string block = "Accept-Ranges: bytes\r\n"
+                   "ETag: " + etag + "\r\n" +
+                   "Last-Modified: " + FormatHttpDate(mtime) + "\r\n";
+    if (cache != nullptr)
+    {
+      block += "Cache-Control: " + *cache + "\r\n";
+    }
+    if (coding != ContentCoding::kIdentity)
+    {
+      block += string("Content-Encoding: ") + CodingName(coding) + "\r\n";
+    }
+    if (vary)
+    {
+      block += "Vary: Accept-Encoding\r\n";
+    }
+    return std::make_shared<const string>(std::move(block));
+  }
+
+  static HttpResponse ProcessStatsRequest(ContentCache *content_cache,
+                                          PrecompressedStore *precompressed,
+                                          const StaticBundle *bundle,
+                                          const vector<unique_ptr<HttpReactor>>
+                                              &reactors)
+  {
+    HttpResponse ret;
+    ret.set_protocol("HTTP/1.1");
+    ret.set_response_code(200);
+    ret.set_message("OK");
+    ret.set_content_type("text/plain");
+    ret.set_header("Cache-Control", "no-store");
+
+    std::ostringstream out;
+    HttpReactor::Stats workers;
+    for (const unique_ptr<HttpReactor> &reactor : reactors)
+    {
+      HttpReactor::Stats stats = reactor->GetStats();
+      workers.tasks += stats.tasks;
+      workers.queue_wait_ns += stats.queue_wait_ns;
+      workers.max_queue_wait_ns = std::max(workers.max_queue_wait_ns,
+                                           stats.max_queue_wait_ns);
+    }
+    out << "worker_tasks " << workers.tasks << "\n"
+        << "worker_queue_wait_ns_total " << workers.queue_wait_ns << "\n"
+        << "worker_queue_wait_ns_max " << workers.max_queue_wait_ns << "\n";
+    if (content_cache != nullptr)
+    {
+      ContentCache::Stats stats = content_cache->GetStats();
+      out << "content_cache_entries " << stats.entries << "\n"
+          << "content_cache_bytes " << stats.bytes << "\n"
+          << "content_cache_hits " << stats.hits << "\n"
+          << "content_cache_misses " << stats.misses << "\n"
+          << "content_cache_evictions " << stats.evictions << "\n"
+          << "content_cache_invalidations " << stats.invalidations << "\n"
+          << "content_cache_fds " << stats.fds << "\n";
+    }
+    if (precompressed != nullptr)
+    {
+      PrecompressedStore::Stats stats = precompressed->GetStats();
+      out << "precompressed_files " << stats.files << "\n"
+          << "precompressed_bytes " << stats.bytes << "\n"
+          << "precompressed_builds " << stats.builds << "\n";
+    }
+    if (bundle != nullptr)
+    {
+      out << "bundle_files " << bundle->num_files() << "\n";
+    }
+    ret.AppendToBody(out.str());
     return ret;
   }
 
+  static string MakeETag(const struct stat &st)
+  {
+    uint64_t mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%" PRIx64 "-%" PRIx64 "-%" PRIx64 "\"",
+             static_cast<uint64_t>(st.st_ino),
+             static_cast<uint64_t>(st.st_size), mtime_ns);
+    return buf;
+  }
+
+  static bool IsNotModified(const HttpRequest &req, const string &etag,
+                            time_t mtime)
+  {
+    // If-None-Match takes precedence over If-Modified-Since (RFC
+    // 7232:6), since an entity tag is more precise than a date.
+    std::string_view if_none_match = req.GetHeaderValue("If-None-Match");
+    if (!if_none_match.empty())
+    {
+      return ETagListMatches(if_none_match, etag);
+    }
+    std::string_view if_modified_since =
+        req.GetHeaderValue("If-Modified-Since");
+    time_t since;
+    return !if_modified_since.empty() &&
+           ParseHttpDate(if_modified_since, &since) && mtime <= since;
+  }
+
+  static void MaybeCompress(const HttpRequest &req,
+                            const HttpServerOptions &options,
+                            HttpResponse *response)
+  {
+    if (options.compression_level == 0 ||
+        (!response->is_streamed() &&
+         response->body_size() < options.compression_min_bytes))
+    {
+      return;
+    }
+    ContentCoding coding =
+        NegotiateCoding(req.GetHeaderValue("Accept-Encoding"));
+    if (coding == ContentCoding::kIdentity)
+    {
+      // Caches still need to know the page depends on the header.
+      response->set_header("Vary", "Accept-Encoding");
+      return;
+    }
+    CompressResponse(coding, options.compression_level, response);
+  }
+
+  static const string *FindCacheControl(
+      const string &path, const vector<pair<string, string>> &cache_control)
+  {
+    const pair<string, string> *best = nullptr;
+    for (const auto &entry : cache_control)
+    {
+      if (path.compare(0, entry.first.size(), entry.first) == 0 &&
+          (best == nullptr || entry.first.size() > best->first.size()))
+      {
+        best = &entry;
+      }
+    }
+    return (best != nullptr) ? &best->second : nullptr;
+  }
+
   static HttpResponse ProcessQueryRequest(const string &uri,
                                           const list<string> &indices)
   {
@@ -294,8 +973,8 @@ namespace hw4
     //    search terms from a typed-in search query.  convert them
     //    to lower case.
     //
-    // 4. Initialize and use hw3::QueryProcessor to process queries with the
-    //    search indices.
+    // 4. Use the worker's own hw3::QueryProcessor to process queries
+    //    against the search indices.
     //
     // 5. With your results, try figuring out how to hyperlink results to file
     //    contents, like in solution_binaries/http333d. (Hint: Look into HTML
@@ -306,62 +985,90 @@ namespace hw4
 
     URLParser parser;
     parser.Parse(uri);
-    auto args = parser.args();
+    std::string_view terms_arg = parser.args()["terms"];
+
+    // Without a query, the page is always the same.
+    const SearchPage &page = GetSearchPage();
+    if (terms_arg.empty())
+    {
+      return page.landing;
+    }
+
+    ret.AppendToBody(page.header);
 
-    stringstream ss;
-    ss << kThreegleStr;
+    string search_terms(terms_arg);
+    boost::algorithm::to_lower(search_terms);
 
-    if (!args["terms"].empty())
+    vector<string> terms;
+    std::istringstream iss(search_terms);
+    string term;
+    while (iss >> term)
     {
-      string search_terms = args["terms"];
-      boost::algorithm::to_lower(search_terms);
+      terms.push_back(term);
+    }
 
-      vector<string> terms;
-      std::istringstream iss(search_terms);
-      string term;
-      while (iss >> term)
-      {
-        terms.push_back(term);
-      }
+    // The logo and search box go out right away; the results follow,
+    // in chunks, as they are rendered.
+    ret.set_body_source(std::make_shared<QueryResultsSource>(
+        search_terms, terms, &indices));
+
+    ret.set_response_code(200);
+    ret.set_message("OK");
+    ret.set_content_type("text/html");
+
+    return ret;
+  }
+
+  static hw3::QueryProcessor *GetQueryProcessor(const list<string> &indices)
+  {
+    // Keyed by the indices, in case the thread serves another server.
+    thread_local const list<string> *opened = nullptr;
+    thread_local unique_ptr<hw3::QueryProcessor> qp;
+    if (qp == nullptr || opened != &indices)
+    {
+      qp.reset(new hw3::QueryProcessor(indices, false));
+      opened = &indices;
+    }
+    return qp.get();
+  }
 
-      hw3::QueryProcessor qp(indices, true);
-      auto results = qp.ProcessQuery(terms);
+  bool QueryResultsSource::Next(string *chunk)
+  {
+    const SearchPage &page = GetSearchPage();
+    if (!queried_)
+    {
+      // The worker's QueryProcessor stays open from one query to the
+      // next, so a query only costs the lookups.
+      results_ = GetQueryProcessor(*indices_)->ProcessQuery(terms_);
+      queried_ = true;
 
-      if (results.empty())
+      if (results_.empty())
       {
-        ss << "<div>" << "No results found for <b>"
-           << EscapeHtml(search_terms) << "</b></div><br>";
+        page.not_found.Render({search_terms_}, chunk);
       }
       else
       {
-        ss << "<div>" << results.size() << " results found for <b>"
-           << EscapeHtml(search_terms) << "</b></div><br>";
+        page.found.Render({std::to_string(results_.size()), search_terms_},
+                          chunk);
       }
+    }
 
-      for (const auto &result : results)
+    size_t end = std::min(next_ + kResultsPerChunk, results_.size());
+    for (; next_ < end; next_++)
+    {
+      const auto &result = results_[next_];
+      const string &name = result.document_name;
+      string rank = std::to_string(result.rank);
+      if (name.find("http://") == 0 || name.find("https://") == 0)
       {
-        if (result.document_name.find("http://") == 0 ||
-            result.document_name.find("https://") == 0)
-        {
-          ss << "<div><li><a href=\"" << result.document_name
-             << "\" target=\"_blank\">" << result.document_name
-             << "</a> [" << result.rank << "]</li></div>";
-        }
-        else
-        {
-          ss << "<div><li><a href=\"/static/" << result.document_name
-             << "\">" << result.document_name << "</a> [" << result.rank
-             << "]</li></div>";
-        }
+        page.remote_result.Render({name, name, rank}, chunk);
+      }
+      else
+      {
+        page.local_result.Render({name, name, rank}, chunk);
       }
     }
-
-    ret.AppendToBody(ss.str());
-    ret.set_response_code(200);
-    ret.set_message("OK");
-    ret.set_content_type("text/html");
-
-    return ret;
+    return next_ < results_.size();
   }
 
 } // namespace hw4
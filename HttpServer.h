@@ -15,12 +15,107 @@
 #include <stdint.h>
 #include <string>
 #include <list>
+#include <memory>
+#include <utility>
+#include <vector>
 
-#include "./ThreadPool.h"
+#include "./ContentCache.h"
+#include "./DnsCache.h"
+#include "./PrecompressedStore.h"
+#include "./HttpReactor.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
 #include "./ServerSocket.h"
+#include "./StaticBundle.h"
 
 namespace hw4 {
 
+// Optional settings for an HttpServer.  The defaults give a single
+// listening socket and event loop.
+struct HttpServerOptions {
+  // How many listening sockets to open.  With more than one, each is
+  // bound with SO_REUSEPORT and gets its own event loop thread and its
+  // own share of the worker threads, and the kernel spreads incoming
+  // connections across them.  0 means one per online CPU.
+  uint32_t num_listeners = 1;
+
+  // Whether to keep reverse-DNS lookups off the accept path.  If true,
+  // connections are accepted with numeric addresses only, and the names
+  // in the connection log come from a DnsCache that resolves them in the
+  // background.  If false, ServerSocket::Accept() resolves both names
+  // before returning each connection.
+  bool lazy_dns = true;
+
+  // The size and time-to-live of that DnsCache.
+  uint32_t dns_cache_entries = 4096;
+  uint32_t dns_cache_ttl_secs = 300;
+
+  // The bounds on the number of worker threads, across all listeners.
+  // The pool starts at min_threads and grows toward max_threads while
+  // requests are waiting and every worker is busy, then shrinks back as
+  // workers sit idle.
+  uint32_t min_threads = 4;
+  uint32_t max_threads = 100;
+
+  // The most requests that may wait for a worker thread at once, across
+  // all listeners.  Past that, new requests are answered with "503
+  // Service Unavailable" instead of being queued.  0 means no limit.
+  uint32_t max_queued = 1024;
+
+  // How long a keep-alive connection may sit idle between requests, and
+  // how long a client may take to send a request header once it has
+  // started.  0 disables a timeout.
+  uint32_t idle_timeout_secs = 60;
+  uint32_t header_timeout_secs = 10;
+
+  // The most requests a client may make on one connection.  0 means no
+  // limit.
+  uint32_t max_requests_per_connection = 1000;
+
+  // Whether to do socket I/O through io_uring (see
+  // HttpReactor::UseIoUring()).  If the kernel can't, the server says so
+  // and falls back to epoll.
+  bool io_uring = false;
+
+  // The Cache-Control header to send with static files, by URI prefix,
+  // e.g. {"/static/images/", "max-age=86400"}.  The longest prefix that
+  // matches a file's URI wins; a file that matches none gets no header.
+  std::vector<std::pair<std::string, std::string>> cache_control;
+
+  // The zlib level (1-9) to compress dynamic pages at, for clients that
+  // accept gzip or deflate; 0 turns compression off.  A page whose size
+  // is known up front is only compressed if it is at least
+  // compression_min_bytes long.  Streamed result pages, whose size isn't
+  // known when their headers go out, always are.
+  uint32_t compression_level = 6;
+  uint32_t compression_min_bytes = 1024;
+
+  // The most memory to cache static files in, the biggest file to keep
+  // the contents of there, and the most bigger files to keep open (see
+  // ContentCache.h).  Bigger files are sent straight from disk, open or
+  // not.  A content_cache_bytes of 0 turns the cache off.
+  size_t content_cache_bytes = 64 << 20;
+  size_t content_cache_max_file_bytes = 1 << 20;
+  size_t content_cache_max_fds = 256;
+
+  // The most bytes of compressed copies of static files to keep (see
+  // PrecompressedStore.h), which clients that accept them get instead
+  // of the files.  Only files at least compression_min_bytes long are
+  // compressed.  0 turns precompression off.
+  size_t precompress_bytes = 64 << 20;
+
+  // The URI of a plain-text page of the server's counters, e.g.
+  // "/stats"; empty means there is no such page.
+  std::string stats_path;
+
+  // A StaticBundle of the static files to serve instead of the files
+  // themselves (see StaticBundle.h), which are then never looked at; its
+  // files already have their compressed copies, so precompress_bytes
+  // doesn't apply.  Empty means static files are served from the
+  // directory.
+  std::string bundle_path;
+};
+
 // The HttpServer class contains the main logic for the web server.
 class HttpServer {
  public:
@@ -30,40 +125,50 @@ class HttpServer {
   // does not do anything except memorize these variables.
   explicit HttpServer(uint16_t port,
                       const std::string& static_file_dir_path,
-                      const std::list<std::string>& indices)
-    : socket_(port), static_file_dir_path_(static_file_dir_path),
-      indices_(indices) { }
+                      const std::list<std::string>& indices,
+                      const HttpServerOptions& options = HttpServerOptions());
 
-  // The destructor closes the listening socket if it is open and
-  // also terminates any threads in the threadpool.
+  // The destructor closes the listening sockets if they are open.
   virtual ~HttpServer() { }
 
-  // Creates a listening socket for the server and launches it, accepting
-  // connections and dispatching them to worker threads.
+  // Opens and validates the search indices, creates a listening socket
+  // for the server and launches it.  An event loop (see HttpReactor.h)
+  // accepts connections and reads their requests, and a pool of worker
+  // threads turns the requests into responses.
   //
   // Returns: true if the server was able to start and run and false otherwise.
   //
   // The server continues to run until a kill command is used to send
-  // a SIGTERM signal to the server process (i.e., kill pid, ctrl+C).
+  // a SIGTERM signal to the server process (i.e., kill pid, ctrl+C), or
+  // until Stop() is called.
   bool Run();
 
+  // Have Run() return soon.  Call it from another thread, and only once
+  // the server has answered a request, so that its event loops are all
+  // set up.
+  void Stop();
+
  private:
-  ServerSocket socket_;
+  // The HttpReactor's request handler; "arg" is the HttpServer.  Runs on
+  // the worker threads.
+  static HttpResponse HandleRequest(const HttpRequest& request, void* arg);
+
+  // The start routine of the extra event loop threads that Run() creates
+  // when there is more than one listener; "arg" is an HttpReactor.
+  static void* ReactorThreadFn(void* arg);
+
+  uint16_t port_;
+  HttpServerOptions options_;
+  std::vector<std::unique_ptr<ServerSocket>> sockets_;
+  std::unique_ptr<DnsCache> dns_cache_;  // only used if options_.lazy_dns
+  std::unique_ptr<ContentCache> content_cache_;  // null if turned off
+  std::unique_ptr<PrecompressedStore> precompressed_;  // likewise
+  std::unique_ptr<StaticBundle> bundle_;  // null if serving the directory
   std::string static_file_dir_path_;
   std::list<std::string> indices_;
-  static const int kNumThreads;
-};
 
-class HttpServerTask : public ThreadPool::Task {
- public:
-  explicit HttpServerTask(ThreadPool::thread_task_fn f)
-    : ThreadPool::Task(f) { }
-
-  int client_fd;
-  uint16_t c_port;
-  std::string c_addr, c_dns, s_addr, s_dns;
-  std::string base_dir;
-  std::list<std::string>* indices;
+  // One event loop per listener, parallel to sockets_; set up by Run().
+  std::vector<std::unique_ptr<HttpReactor>> reactors_;
 };
 
 }  // namespace hw4
@@ -19,27 +19,25 @@
 #include <errno.h>
 #include <limits.h>
 #include <netdb.h>
-#include <boost/algorithm/string/replace.hpp>
-#include <boost/algorithm/string.hpp>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
+#include <algorithm>
 #include <iostream>
-#include <vector>
 #include "./HttpUtils.h"
 
-using boost::algorithm::replace_all;
 using std::cerr;
 using std::endl;
-using std::map;
-using std::pair;
 using std::string;
-using std::vector;
 
 namespace hw4 {
 
@@ -78,120 +76,441 @@ bool IsPathSafe(const string& root_dir, const string& test_file) {
   }
 }
 
+// Bytes that EscapeHtml() replaces, and that URIDecode() acts on.
+static const char kHtmlSpecials[] = "&\"\'<>";
+static const char kUriSpecials[] = "%+";
+
+// The most ranges a Range header may ask for.  Past that, it is cheaper
+// to send the whole file than to pick through the pieces.
+static const size_t kMaxByteRanges = 16;
+
+// The value of each hex digit, or -1 for bytes that aren't one.
+static const int8_t kHexValues[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// Returns the offset of the first byte in [p, p + len) that is one of
+// the first N bytes of "set", or len if there isn't one.  FindFirstOf()
+// below uses the widest version the CPU supports, which skips clean
+// runs 16 or 32 bytes at a time.
+template <int N>
+static size_t ScalarFindFirstOf(const char* p, size_t len, const char* set) {
+  for (size_t i = 0; i < len; i++) {
+    for (int j = 0; j < N; j++) {
+      if (p[i] == set[j])
+        return i;
+    }
+  }
+  return len;
+}
+
+#if defined(__SSE2__)
+
+template <int N>
+static size_t Sse2FindFirstOf(const char* p, size_t len, const char* set) {
+  __m128i needles[N];
+  for (int j = 0; j < N; j++) {
+    needles[j] = _mm_set1_epi8(set[j]);
+  }
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+    for (int j = 1; j < N; j++) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[j]));
+    }
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + ScalarFindFirstOf<N>(p + i, len - i, set);
+}
+
+template <int N>
+__attribute__((target("avx2")))
+static size_t Avx2FindFirstOf(const char* p, size_t len, const char* set) {
+  __m256i needles[N];
+  for (int j = 0; j < N; j++) {
+    needles[j] = _mm256_set1_epi8(set[j]);
+  }
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    __m256i hits = _mm256_cmpeq_epi8(chunk, needles[0]);
+    for (int j = 1; j < N; j++) {
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[j]));
+    }
+    uint32_t mask = _mm256_movemask_epi8(hits);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + Sse2FindFirstOf<N>(p + i, len - i, set);
+}
+
+static bool HaveAvx2() {
+  static const bool have_avx2 =
+    (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+  return have_avx2;
+}
+
+#endif  // defined(__SSE2__)
+
+template <int N>
+static size_t FindFirstOf(const char* p, size_t len, const char* set) {
+#if defined(__SSE2__)
+  if (len >= 32 && HaveAvx2())
+    return Avx2FindFirstOf<N>(p, len, set);
+  return Sse2FindFirstOf<N>(p, len, set);
+#else
+  return ScalarFindFirstOf<N>(p, len, set);
+#endif
+}
+
 string EscapeHtml(const string& from) {
-  string ret = from;
   // Read through the passed in string, and replace any unsafe
   // html tokens with the proper escape codes. The characters
   // that need to be escaped in HTML are the same five as those
-  // that need to be escaped for XML documents. You can see an
-  // example in the comment for this function in HttpUtils.h and
-  // the rest of the characters that need to be replaced can be
-  // looked up online.
-
-  // STEP 2
-  boost::replace_all(ret, "&", "&amp;");
-  boost::replace_all(ret, "\"", "&quot;");
-  boost::replace_all(ret, "\'", "&apos;");
-  boost::replace_all(ret, "<", "&lt;");
-  boost::replace_all(ret, ">", "&gt;");
-
+  // that need to be escaped for XML documents.
+  //
+  // Most strings have nothing to escape, so look for the first unsafe
+  // character before building anything.
+  const char* p = from.data();
+  size_t len = from.size();
+  size_t pos = FindFirstOf<5>(p, len, kHtmlSpecials);
+  if (pos == len)
+    return from;
+
+  string ret;
+  ret.reserve(len + len / 8 + 8);
+  size_t run_start = 0;
+  while (pos < len) {
+    ret.append(p + run_start, pos - run_start);
+    switch (p[pos]) {
+      case '&':  ret.append("&amp;", 5);  break;
+      case '"':  ret.append("&quot;", 6); break;
+      case '\'': ret.append("&apos;", 6); break;
+      case '<':  ret.append("&lt;", 4);   break;
+      default:   ret.append("&gt;", 4);   break;
+    }
+    run_start = pos + 1;
+    pos = run_start + FindFirstOf<5>(p + run_start, len - run_start,
+                                     kHtmlSpecials);
+  }
+  ret.append(p + run_start, len - run_start);
   return ret;
 }
 
 // Look for a "%XY" token in the string, where XY is a
 // hex number.  Replace the token with the appropriate ASCII
 // character, but only if 32 <= dec(XY) <= 127.
-string URIDecode(const string& from) {
+string URIDecode(std::string_view from) {
+  const char* p = from.data();
+  size_t len = from.size();
+  size_t pos = FindFirstOf<2>(p, len, kUriSpecials);
+  if (pos == len)
+    return string(from);
+
+  // Decoding never makes the string longer.
   string retstr;
-
-  // Loop through the characters in the string.
-  for (unsigned int pos = 0; pos < from.length(); pos++) {
-    // note: use pos+n<from.length() instead of pos<from.length-n
-    // to avoid overflow problems with unsigned int values
-    char c1 = from[pos];
-    char c2 = (pos+1 < from.length()) ? toupper(from[pos+1]) : ' ';
-    char c3 = (pos+2 < from.length()) ? toupper(from[pos+2]) : ' ';
-
-    // Special case the '+' for old encoders.
-    if (c1 == '+') {
-      retstr.append(1, ' ');
-      continue;
+  retstr.reserve(len);
+  size_t run_start = 0;
+  while (pos < len) {
+    retstr.append(p + run_start, pos - run_start);
+    run_start = pos + 1;
+
+    if (p[pos] == '+') {
+      // Special case the '+' for old encoders.
+      retstr.push_back(' ');
+    } else if (pos + 2 < len &&
+               kHexValues[static_cast<uint8_t>(p[pos + 1])] >= 0 &&
+               kHexValues[static_cast<uint8_t>(p[pos + 2])] >= 0) {
+      // An escape sequence; convert it if the code is reasonable, and
+      // otherwise keep the '%' as-is.
+      int code = 16 * kHexValues[static_cast<uint8_t>(p[pos + 1])] +
+                 kHexValues[static_cast<uint8_t>(p[pos + 2])];
+      if (code >= 32 && code <= 127) {
+        retstr.push_back(static_cast<char>(code));
+        run_start = pos + 3;
+      } else {
+        retstr.push_back('%');
+      }
+    } else {
+      retstr.push_back('%');
     }
+    pos = run_start + FindFirstOf<2>(p + run_start, len - run_start,
+                                     kUriSpecials);
+  }
+  retstr.append(p + run_start, len - run_start);
+  return retstr;
+}
 
-    // Is this an escape sequence?
-    if (c1 != '%') {
-      retstr.append(1, c1);
-      continue;
-    }
+// Returns true if URIDecode() would change "s".
+static bool NeedsDecode(std::string_view s) {
+  return FindFirstOf<2>(s.data(), s.size(), kUriSpecials) != s.size();
+}
 
-    // Yes.  Are the next two characters hex digits?
-    if (!((('0' <= c2) && (c2 <= '9')) ||
-          (('A' <= c2) && (c2 <= 'F')))) {
-      retstr.append(1, c1);
-      continue;
-    }
-    if (!((('0' <= c3) && (c3 <= '9')) ||
-           (('A' <= c3) && (c3 <= 'F')))) {
-      retstr.append(1, c1);
+// Returns true if the encoded field name "encoded" decodes to "field".
+static bool FieldIs(std::string_view encoded, std::string_view field) {
+  if (!NeedsDecode(encoded))
+    return encoded == field;
+  return URIDecode(encoded) == field;
+}
+
+void URLParser::Parse(std::string_view url) {
+  args_.num_args_ = 0;
+
+  // Split the URL into the path and the args components.  Anything
+  // after a second '?' is ignored.
+  size_t qmark = url.find('?');
+  path_ = url.substr(0, qmark);
+  if (qmark == std::string_view::npos)
+    return;
+  std::string_view query = url.substr(qmark + 1);
+  query = query.substr(0, query.find('?'));
+
+  // Walk through the field=val chunks, skipping any that don't have
+  // exactly one '='.
+  while (!query.empty()) {
+    size_t amp = query.find('&');
+    std::string_view chunk = query.substr(0, amp);
+    query = (amp == std::string_view::npos) ?
+            std::string_view() : query.substr(amp + 1);
+
+    size_t eq = chunk.find('=');
+    if (eq == std::string_view::npos ||
+        chunk.find('=', eq + 1) != std::string_view::npos)
       continue;
-    }
+    args_.Add(chunk.substr(0, eq), chunk.substr(eq + 1));
+  }
+}
 
-    // Yes.  Convert to a code.
-    uint8_t code = 0;
-    if (c2 >= 'A') {
-      code = 16 * (10 + (c2 - 'A'));
-    } else {
-      code = 16 * (c2 - '0');
-    }
-    if (c3 >= 'A') {
-      code += 10 + (c3 - 'A');
-    } else {
-      code += (c3 - '0');
-    }
+void URLParser::Args::Add(std::string_view field, std::string_view value) {
+  int i = 0;
+  while (i < num_args_) {
+    std::string_view other = args_[i].field;
+    if (other == field ||
+        ((NeedsDecode(field) || NeedsDecode(other)) &&
+         URIDecode(field) == URIDecode(other)))
+      break;
+    i++;
+  }
+  if (i == num_args_) {
+    if (num_args_ == kMaxArgs)
+      return;
+    args_[num_args_++].field = field;
+  }
+  args_[i].value = value;
+  args_[i].is_decoded = false;
+}
 
-    // Is the code reasonable?
-    if (!((code >= 32) && (code <= 127))) {
-      retstr.append(1, c1);
+std::string_view URLParser::Args::operator[](std::string_view field) const {
+  for (int i = 0; i < num_args_; i++) {
+    const Arg& arg = args_[i];
+    if (!FieldIs(arg.field, field))
       continue;
+    if (!NeedsDecode(arg.value))
+      return arg.value;
+    if (!arg.is_decoded) {
+      arg.decoded = URIDecode(arg.value);
+      arg.is_decoded = true;
     }
+    return arg.decoded;
+  }
+  return std::string_view();
+}
 
-    // Great!  Convert and append.
-    retstr.append(1, static_cast<char>(code));
-    pos += 2;
+string FormatHttpDate(time_t t) {
+  struct tm tm;
+  char buf[64];
+  gmtime_r(&t, &tm);
+  size_t len = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return string(buf, len);
+}
+
+bool ParseHttpDate(std::string_view date, time_t* t) {
+  // The preferred format, then the RFC 850 and asctime() ones.
+  static const char* kFormats[] = {
+    "%a, %d %b %Y %H:%M:%S GMT",
+    "%A, %d-%b-%y %H:%M:%S GMT",
+    "%a %b %e %H:%M:%S %Y",
+  };
+  char buf[64];
+  if (date.size() >= sizeof(buf))
+    return false;
+  date.copy(buf, date.size());
+  buf[date.size()] = '\0';
+
+  for (const char* format : kFormats) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(buf, format, &tm);
+    if (end != nullptr && *end == '\0') {
+      *t = timegm(&tm);
+      return true;
+    }
   }
-  return retstr;
+  return false;
 }
 
-void URLParser::Parse(const string& url) {
-  url_ = url;
+// Returns "tag" without any weakness indicator.
+static std::string_view StripWeak(std::string_view tag) {
+  if (tag.substr(0, 2) == "W/")
+    tag.remove_prefix(2);
+  return tag;
+}
 
-  // Split the URL into the path and the args components.
-  vector<string> ps;
-  boost::split(ps, url, boost::is_any_of("?"));
-  if (ps.size() < 1)
-    return;
+bool ETagListMatches(std::string_view list, std::string_view etag) {
+  etag = StripWeak(etag);
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    std::string_view tag = list.substr(0, comma);
+    list = (comma == std::string_view::npos) ?
+           std::string_view() : list.substr(comma + 1);
 
-  // Store the URI-decoded path.
-  path_ = URIDecode(ps[0]);
+    size_t first = tag.find_first_not_of(" \t");
+    if (first == std::string_view::npos)
+      continue;
+    tag = tag.substr(first, tag.find_last_not_of(" \t") - first + 1);
+    if (tag == "*" || StripWeak(tag) == etag)
+      return true;
+  }
+  return false;
+}
 
-  if (ps.size() < 2)
-    return;
+// Parse "digits", which must be nothing but decimal digits, into "n".
+static bool ParseDecimal(std::string_view digits, uint64_t* n) {
+  if (digits.empty() || digits.size() > 19)
+    return false;
+  uint64_t res = 0;
+  for (char c : digits) {
+    if (c < '0' || c > '9')
+      return false;
+    res = res * 10 + (c - '0');
+  }
+  *n = res;
+  return true;
+}
 
-  // Split the args into each field=val; chunk.
-  vector<string> vals;
-  boost::split(vals, ps[1], boost::is_any_of("&"));
-
-  // Iterate through the chunks.
-  for (unsigned int i = 0; i < vals.size(); i++) {
-    // Split the chunk into field, value.
-    string val = vals[i];
-    vector<string> fv;
-    boost::split(fv, val, boost::is_any_of("="));
-    if (fv.size() == 2) {
-      // Add the field, value to the args_ map.
-      args_[URIDecode(fv[0])] = URIDecode(fv[1]);
+bool ParseByteRanges(std::string_view value, uint64_t size,
+                     std::vector<ByteRange>* ranges) {
+  ranges->clear();
+  if (value.size() < 6 || strncasecmp(value.data(), "bytes=", 6) != 0)
+    return false;
+  value.remove_prefix(6);
+
+  size_t num_specs = 0;
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    std::string_view spec = value.substr(0, comma);
+    value = (comma == std::string_view::npos) ?
+            std::string_view() : value.substr(comma + 1);
+
+    size_t first = spec.find_first_not_of(" \t");
+    if (first == std::string_view::npos)
+      continue;  // an empty list element, which is allowed
+    spec = spec.substr(first, spec.find_last_not_of(" \t") - first + 1);
+    if (++num_specs > kMaxByteRanges)
+      return false;
+
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos)
+      return false;
+    ByteRange range;
+    if (dash == 0) {
+      // "-N" is the last N bytes.
+      uint64_t suffix;
+      if (!ParseDecimal(spec.substr(1), &suffix))
+        return false;
+      if (suffix == 0 || size == 0)
+        continue;
+      range.first = (suffix < size) ? size - suffix : 0;
+      range.last = size - 1;
+    } else {
+      // "M-N" is bytes M through N, and "M-" is everything from M on.
+      if (!ParseDecimal(spec.substr(0, dash), &range.first))
+        return false;
+      std::string_view last = spec.substr(dash + 1);
+      if (last.empty()) {
+        range.last = UINT64_MAX;
+      } else if (!ParseDecimal(last, &range.last) ||
+                 range.last < range.first) {
+        return false;
+      }
+      if (range.first >= size)
+        continue;
+      if (range.last >= size) {
+        range.last = size - 1;
+      }
     }
+    ranges->push_back(range);
+  }
+  if (num_specs == 0)
+    return false;
+
+  std::sort(ranges->begin(), ranges->end(),
+            [](const ByteRange& a, const ByteRange& b) {
+              return a.first < b.first;
+            });
+  size_t merged = 0;
+  for (size_t i = 0; i < ranges->size(); i++) {
+    ByteRange& range = (*ranges)[i];
+    if (merged > 0 && range.first <= (*ranges)[merged - 1].last + 1) {
+      ByteRange& prev = (*ranges)[merged - 1];
+      prev.last = std::max(prev.last, range.last);
+    } else {
+      (*ranges)[merged++] = range;
+    }
+  }
+  ranges->resize(merged);
+  return true;
+}
+
+bool SameFileVersion(const struct stat& a, const struct stat& b) {
+  return a.st_ino == b.st_ino && a.st_dev == b.st_dev &&
+         a.st_size == b.st_size &&
+         a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+const char* ContentTypeFor(std::string_view file_name) {
+  static const std::pair<std::string_view, const char*> kContentTypes[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"png", "image/png"},
+    {"gif", "image/gif"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"xml", "application/xml"},
+    {"txt", "text/plain"},
+  };
+
+  size_t dot = file_name.find_last_of('.');
+  if (dot == std::string_view::npos)
+    return "";
+  std::string_view extension = file_name.substr(dot + 1);
+  for (const auto& type : kContentTypes) {
+    if (extension == type.first)
+      return type.second;
   }
+  return "";
 }
 
 uint16_t GetRandPort() {
@@ -231,6 +550,24 @@ int WrappedWrite(int fd, const unsigned char* buf, int write_len) {
   return written_so_far;
 }
 
+ssize_t WrappedPread(int fd, char* buf, size_t read_len, off_t offset) {
+  size_t read_so_far = 0;
+
+  while (read_so_far < read_len) {
+    ssize_t res = pread(fd, buf + read_so_far, read_len - read_so_far,
+                        offset + read_so_far);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (res == 0)
+      break;
+    read_so_far += res;
+  }
+  return read_so_far;
+}
+
 bool ConnectToServer(const string& host_name, uint16_t port_num,
                      int* client_fd) {
   struct addrinfo hints;
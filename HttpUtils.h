@@ -16,10 +16,14 @@
 #define HW4_HTTPUTILS_H_
 
 #include <stdint.h>
+#include <sys/stat.h>   // for struct stat
+#include <sys/types.h>  // for off_t, ssize_t
+#include <time.h>       // for time_t
 
 #include <string>
+#include <string_view>
 #include <utility>
-#include <map>
+#include <vector>
 
 namespace hw4 {
 
@@ -57,7 +61,7 @@ std::string EscapeHtml(const std::string& from);
 //
 //    http://en.wikipedia.org/wiki/Percent-encoding
 //
-std::string URIDecode(const std::string& from);
+std::string URIDecode(std::string_view from);
 
 // A URL that's part of a web request has the following structure:
 //
@@ -65,29 +69,109 @@ std::string URIDecode(const std::string& from);
 //
 //      path     ?   args
 //
-// This class accepts a URL and splits it into these components and
-// URIDecode()'s them, allowing the caller to access the components
-// through convenient methods.
+// This class accepts a URL and splits it into these components,
+// allowing the caller to access them, URIDecode()'d, through
+// convenient methods.
+//
+// Parse() doesn't copy the URL: the args are kept as views into it, in
+// a small fixed-size array, and are only decoded when looked up.  The
+// URL passed to Parse() must outlive the parser.
 class URLParser {
  public:
+  // The most args a URL keeps; Parse() ignores any beyond these.
+  static const int kMaxArgs = 32;
+
+  // The args component of a URL, as a set of fields and their values.
+  class Args {
+   public:
+    Args() : num_args_(0) { }
+
+    // Returns the number of distinct fields.
+    size_t size() const { return num_args_; }
+
+    // Returns the URI-decoded value of "field", or an empty view if
+    // there's no such field.  A field given more than once takes the
+    // last value.  The view is good until the URLParser is next
+    // Parse()'d.
+    std::string_view operator[](std::string_view field) const;
+
+   private:
+    friend class URLParser;
+
+    struct Arg {
+      std::string_view field;
+      std::string_view value;
+      // The decoded value, filled in on the first lookup of a value
+      // that needs decoding.
+      mutable std::string decoded;
+      mutable bool is_decoded;
+    };
+
+    // Add field=value, or replace the value of an earlier "field".
+    void Add(std::string_view field, std::string_view value);
+
+    Arg args_[kMaxArgs];
+    int num_args_;
+  };
+
   URLParser() { }
   virtual ~URLParser() { }
 
-  void Parse(const std::string& url);
+  // Parse "url", replacing whatever this parser held before.
+  void Parse(std::string_view url);
 
   // Return the "path" component of the url, post-uri-decoding.
-  std::string path() const { return path_; }
+  std::string path() const { return URIDecode(path_); }
 
-  // Return the "args" component of the url post-uri-decoding.
-  // The args component is parsed into a map from field to value.
-  std::map<std::string, std::string> args() const { return args_; }
+  // Return the "args" component of the url.
+  const Args& args() const { return args_; }
 
  private:
-  std::string url_;
-  std::string path_;
-  std::map<std::string, std::string> args_;
+  std::string_view path_;
+  Args args_;
+};
+
+// Format "t" as an HTTP-date (RFC 7231:7.1.1.1), e.g.:
+//
+//   Sun, 06 Nov 1994 08:49:37 GMT
+//
+std::string FormatHttpDate(time_t t);
+
+// Parse an HTTP-date, in the format above or either of the obsolete
+// ones clients may still send, into "t".  Returns false if "date" isn't
+// an HTTP-date.
+bool ParseHttpDate(std::string_view date, time_t* t);
+
+// Returns true if the entity tag "etag" is among those listed in "list",
+// the value of an If-None-Match header.  Tags are compared the weak way
+// that header calls for (RFC 7232:3.2), ignoring any "W/" prefix, and
+// "*" matches any tag.
+bool ETagListMatches(std::string_view list, std::string_view etag);
+
+// A range of bytes of a file, from "first" through "last" inclusive.
+struct ByteRange {
+  uint64_t first;
+  uint64_t last;
 };
 
+// Parse the value of a Range header (RFC 7233:3.1), e.g.
+// "bytes=0-99,-500", for a file "size" bytes long.  Returns false if
+// "value" isn't a byte range set or asks for too many pieces, either of
+// which means the header should be ignored.  Otherwise, returns true,
+// and uses "ranges" to return the ranges that can be satisfied, sorted
+// by where they start, with any that overlap or touch merged; it's
+// empty if none can be.
+bool ParseByteRanges(std::string_view value, uint64_t size,
+                     std::vector<ByteRange>* ranges);
+
+// Returns true if "a" and "b", from stat(), describe the same version of
+// the same file: the same inode, size and modification time.
+bool SameFileVersion(const struct stat& a, const struct stat& b);
+
+// Returns the Content-type to serve the file "file_name" with, or "" if
+// its extension isn't one we know.
+const char* ContentTypeFor(std::string_view file_name);
+
 // Return a randomly generated port number between 10000 and 40000.
 uint16_t GetRandPort();
 
@@ -114,6 +198,14 @@ int WrappedRead(int fd, unsigned char* buf, int read_len);
 // like the connection being dropped.
 int WrappedWrite(int fd, const unsigned char* buf, int write_len);
 
+// A wrapper around "pread" that shields the caller from partial reads
+// and EINTR.
+//
+// Reads "read_len" bytes from the file descriptor fd, starting at
+// "offset", into the buffer "buf".  Returns the number of bytes read,
+// which is less than read_len only if EOF was hit, or -1 on error.
+ssize_t WrappedPread(int fd, char* buf, size_t read_len, off_t offset);
+
 // A convenience routine to manufacture a (blocking) socket to the
 // host_name and port number provided as arguments.  Hostname can
 // be a DNS name or an IP address, in string form.  On success,
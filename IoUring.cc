@@ -0,0 +1,219 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>         // for errno
+#include <stdlib.h>        // for calloc(), free()
+#include <string.h>        // for memset()
+#include <sys/mman.h>      // for mmap(), munmap()
+#include <sys/syscall.h>   // for SYS_io_uring_*
+#include <unistd.h>        // for syscall(), close()
+
+#include "./IoUring.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+namespace hw4 {
+
+// Kernels before 6.0 can't do multishot receives.  There is no way to
+// probe for that directly, so look for an opcode that arrived in the
+// same release.
+static const uint8_t kRecvMultishotProbeOp = IORING_OP_SEND_ZC;
+
+IoUring::IoUring()
+  : ring_fd_(-1), ring_mem_(MAP_FAILED), ring_mem_size_(0),
+    sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_size_(0),
+    sqe_tail_(0), buf_ring_(nullptr), buf_ring_size_(0), buf_ring_mask_(0),
+    buf_ring_tail_(0), bufs_(nullptr), buf_size_(0) { }
+
+IoUring::~IoUring() {
+  if (buf_ring_ != nullptr) {
+    munmap(buf_ring_, buf_ring_size_);
+  }
+  delete[] bufs_;
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (ring_mem_ != MAP_FAILED) {
+    munmap(ring_mem_, ring_mem_size_);
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+  }
+}
+
+bool IoUring::Init(uint32_t entries) {
+  // IORING_SETUP_COOP_TASKRUN is as new as multishot accept and provided
+  // buffer rings, so an older kernel fails right here.
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  ring_fd_ = syscall(SYS_io_uring_setup, entries, &params);
+  if (ring_fd_ == -1)
+    return false;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_EXT_ARG))
+    return false;
+
+  struct io_uring_probe* probe = static_cast<struct io_uring_probe*>(
+      calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op)));
+  Verify333(probe != nullptr);
+  bool ok = (syscall(SYS_io_uring_register, ring_fd_, IORING_REGISTER_PROBE,
+                     probe, 256) == 0 &&
+             probe->last_op >= kRecvMultishotProbeOp &&
+             (probe->ops[kRecvMultishotProbeOp].flags & IO_URING_OP_SUPPORTED));
+  free(probe);
+  if (!ok)
+    return false;
+
+  // Map the submission and completion rings (one mapping holds both),
+  // and the SQE array.
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  size_t cq_size = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+  ring_mem_size_ = (sq_size > cq_size) ? sq_size : cq_size;
+  ring_mem_ = mmap(nullptr, ring_mem_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring_mem_ == MAP_FAILED)
+    return false;
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(
+      mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED)
+    return false;
+
+  char* mem = static_cast<char*>(ring_mem_);
+  sq_head_ = reinterpret_cast<uint32_t*>(mem + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<uint32_t*>(mem + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<uint32_t*>(mem + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+  cq_head_ = reinterpret_cast<uint32_t*>(mem + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32_t*>(mem + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<uint32_t*>(mem + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(mem + params.cq_off.cqes);
+
+  // SQE i always sits in slot i of the submission ring.
+  uint32_t* array = reinterpret_cast<uint32_t*>(mem + params.sq_off.array);
+  for (uint32_t i = 0; i < sq_entries_; i++) {
+    array[i] = i;
+  }
+  return true;
+}
+
+struct io_uring_sqe* IoUring::GetSqe() {
+  uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    // Full; hand what we have to the kernel without waiting, and see
+    // whether it took any.
+    Verify333(Enter(0, -1) >= 0);
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_)
+      return nullptr;
+  }
+  struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+  sqe_tail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+bool IoUring::SubmitAndWait(int timeout_ms) {
+  return Enter(1, timeout_ms) >= 0;
+}
+
+int IoUring::Enter(uint32_t min_complete, int timeout_ms) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+  }
+  uint32_t flags = IORING_ENTER_EXT_ARG;
+  if (min_complete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  while (1) {
+    uint32_t to_submit =
+      sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    int res = syscall(SYS_io_uring_enter, ring_fd_, to_submit, min_complete,
+                      flags, &arg, sizeof(arg));
+    if (res >= 0)
+      return res;
+    if (errno == EINTR)
+      continue;
+    // Timing out, or the completion ring being too full to take more
+    // submissions until we drain it, aren't errors.
+    if (errno == ETIME || errno == EBUSY || errno == EAGAIN)
+      return 0;
+    return -1;
+  }
+}
+
+struct io_uring_cqe* IoUring::PeekCqe() {
+  uint32_t head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+    return nullptr;
+  return &cqes_[head & cq_mask_];
+}
+
+void IoUring::SeenCqe() {
+  __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUring::SetupBufferRing(uint16_t group, uint32_t num_bufs,
+                              uint32_t buf_size) {
+  Verify333(num_bufs > 0 && (num_bufs & (num_bufs - 1)) == 0);
+  buf_ring_size_ = num_bufs * sizeof(struct io_uring_buf);
+  void* mem = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return false;
+  buf_ring_ = static_cast<struct io_uring_buf_ring*>(mem);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = num_bufs;
+  reg.bgid = group;
+  if (syscall(SYS_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+              &reg, 1) != 0)
+    return false;
+
+  buf_ring_mask_ = num_bufs - 1;
+  buf_size_ = buf_size;
+  bufs_ = new char[static_cast<size_t>(num_bufs) * buf_size];
+  for (uint32_t i = 0; i < num_bufs; i++) {
+    RecycleBuffer(i);
+  }
+  return true;
+}
+
+void IoUring::RecycleBuffer(uint16_t bid) {
+  // Index the ring as a plain array rather than through "bufs": some
+  // versions of <linux/io_uring.h> declare it such that C++ puts it 8
+  // bytes past the start of the ring.
+  struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(buf_ring_) +
+                             (buf_ring_tail_ & buf_ring_mask_);
+  buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+  buf->len = buf_size_;
+  buf->bid = bid;
+  buf_ring_tail_++;
+  __atomic_store_n(&buf_ring_->tail, buf_ring_tail_, __ATOMIC_RELEASE);
+}
+
+}  // namespace hw4
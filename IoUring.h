@@ -0,0 +1,112 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_IOURING_H_
+#define HW4_IOURING_H_
+
+#include <linux/io_uring.h>  // for the io_uring structures and constants
+#include <stdint.h>          // for uint32_t, etc.
+
+namespace hw4 {
+
+// A thin wrapper around a Linux io_uring instance, talking to the kernel
+// through the raw system calls.  It maps the submission and completion
+// rings, hands out submission queue entries (SQEs) for the caller to
+// fill in, submits them in one system call, and walks the completion
+// queue entries (CQEs) that come back.
+//
+// It can also register a ring of "provided buffers" that the kernel
+// picks from when a receive completes, so that a socket doesn't need a
+// buffer of its own until data actually arrives.
+//
+// An IoUring is meant to be used by a single thread.
+class IoUring {
+ public:
+  IoUring();
+  virtual ~IoUring();
+
+  // Set up a ring with room for "entries" SQEs.  Returns false if the
+  // kernel doesn't support io_uring, or is older than the features we
+  // rely on (multishot accept and receive, provided buffer rings, and
+  // waiting with a timeout), in which case the IoUring must not be used.
+  bool Init(uint32_t entries);
+
+  // Returns a zeroed SQE to fill in.  It is submitted by the next call to
+  // SubmitAndWait(); if the submission ring is full, the SQEs queued so
+  // far are submitted right away to make room.  Returns nullptr if the
+  // kernel won't take them yet (say, because the completion ring needs
+  // draining first), in which case try again after reaping some CQEs.
+  struct io_uring_sqe* GetSqe();
+
+  // Submit every queued SQE, then wait until there is at least one CQE
+  // or "timeout_ms" milliseconds have passed (-1 means no limit).
+  // Returns false if the kernel reports an error.
+  bool SubmitAndWait(int timeout_ms);
+
+  // Returns the oldest CQE that hasn't been seen yet, or nullptr if
+  // there is none.  Call SeenCqe() once done with it.
+  struct io_uring_cqe* PeekCqe();
+  void SeenCqe();
+
+  // Register "num_bufs" buffers of "buf_size" bytes each as provided
+  // buffer group "group".  "num_bufs" must be a power of 2.  Returns
+  // false on failure.
+  bool SetupBufferRing(uint16_t group, uint32_t num_bufs, uint32_t buf_size);
+
+  // Returns provided buffer "bid", which a receive CQE names in its
+  // flags (see IORING_CQE_BUFFER_SHIFT).
+  char* buffer(uint16_t bid) const {
+    return bufs_ + static_cast<size_t>(bid) * buf_size_;
+  }
+
+  // Give provided buffer "bid" back to the kernel once its contents have
+  // been consumed.
+  void RecycleBuffer(uint16_t bid);
+
+ private:
+  // Publish the queued SQEs and call io_uring_enter().
+  int Enter(uint32_t min_complete, int timeout_ms);
+
+  int ring_fd_;
+
+  // The mapped rings.
+  void* ring_mem_;
+  size_t ring_mem_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  // The submission ring.  sqe_tail_ counts the SQEs handed out by
+  // GetSqe(), which the kernel sees once Enter() publishes it.
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t sq_mask_;
+  uint32_t sq_entries_;
+  uint32_t sqe_tail_;
+
+  // The completion ring.
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // The provided buffers, and the ring through which we hand them to
+  // the kernel.
+  struct io_uring_buf_ring* buf_ring_;
+  size_t buf_ring_size_;
+  uint32_t buf_ring_mask_;
+  uint16_t buf_ring_tail_;
+  char* bufs_;
+  uint32_t buf_size_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_IOURING_H_
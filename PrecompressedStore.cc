@@ -0,0 +1,247 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <dirent.h>     // for opendir(), readdir()
+#include <string.h>     // for strcmp(), strrchr()
+#include <sys/stat.h>   // for fstat()
+#include <unistd.h>     // for close()
+
+#ifdef HW4_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <memory>
+#include <string>
+
+#include "./FileReader.h"
+#include "./HttpCompression.h"
+#include "./HttpUtils.h"
+#include "./PrecompressedStore.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::shared_ptr;
+using std::string;
+
+namespace hw4 {
+
+// The extensions of the files worth compressing.
+static const char* kCompressibleExtensions[] = {
+  "html", "htm", "css", "js", "xml", "txt",
+};
+
+// A compressed copy is only kept if it is at most this fraction of the
+// size of the file; otherwise the savings don't pay for the decoding.
+static const double kMaxCompressedFraction = 0.9;
+
+PrecompressedStore::PrecompressedStore(const string& base_dir,
+                                       size_t max_bytes,
+                                       size_t min_file_bytes)
+  : base_dir_(base_dir), max_bytes_(max_bytes),
+    min_file_bytes_(min_file_bytes), terminate_(false) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+  Verify333(pthread_cond_init(&cond_, nullptr) == 0);
+  Verify333(pthread_create(&thread_, nullptr, &CompressorThreadFn,
+                           static_cast<void*>(this)) == 0);
+}
+
+PrecompressedStore::~PrecompressedStore() {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  terminate_ = true;
+  Verify333(pthread_cond_signal(&cond_) == 0);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  Verify333(pthread_join(thread_, nullptr) == 0);
+
+  Verify333(pthread_cond_destroy(&cond_) == 0);
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+shared_ptr<const PrecompressedStore::Variants> PrecompressedStore::Find(
+    const string& file_name, const struct stat& st, bool* const pending) {
+  *pending = false;
+  if (static_cast<size_t>(st.st_size) < min_file_bytes_ ||
+      !IsCompressible(file_name))
+    return nullptr;
+
+  shared_ptr<const Variants> res;
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  auto it = variants_.find(file_name);
+  if (it != variants_.end() && SameFileVersion(it->second->st, st)) {
+    if (it->second->gzip != nullptr || it->second->brotli != nullptr) {
+      res = it->second;
+    }
+  } else {
+    // New, or changed since it was compressed.
+    QueueLocked(file_name);
+    *pending = true;
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return res;
+}
+
+bool PrecompressedStore::IsCompressible(const string& file_name) {
+  size_t dot = file_name.find_last_of('.');
+  if (dot == string::npos)
+    return false;
+  const char* extension = file_name.c_str() + dot + 1;
+  for (const char* compressible : kCompressibleExtensions) {
+    if (strcmp(extension, compressible) == 0)
+      return true;
+  }
+  return false;
+}
+
+PrecompressedStore::Stats PrecompressedStore::GetStats() {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  Stats res = stats_;
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return res;
+}
+
+void PrecompressedStore::QueueLocked(const string& file_name) {
+  if (queued_.insert(file_name).second) {
+    queue_.push_back(file_name);
+    Verify333(pthread_cond_signal(&cond_) == 0);
+  }
+}
+
+void PrecompressedStore::QueueDirectory(const string& dir) {
+  DIR* d = opendir((base_dir_ + "/" + dir).c_str());
+  if (d == nullptr)
+    return;
+  struct dirent* dirent;
+  while ((dirent = readdir(d)) != nullptr) {
+    if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+      continue;
+
+    // Don't follow symbolic links, which could lead in circles; files
+    // reached through them are compressed when they are first asked for.
+    string name = dir.empty() ? string(dirent->d_name) :
+                                dir + "/" + dirent->d_name;
+    struct stat st;
+    if (lstat((base_dir_ + "/" + name).c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      QueueDirectory(name);
+    } else if (S_ISREG(st.st_mode) &&
+               static_cast<size_t>(st.st_size) >= min_file_bytes_ &&
+               IsCompressible(name)) {
+      Verify333(pthread_mutex_lock(&lock_) == 0);
+      QueueLocked(name);
+      Verify333(pthread_mutex_unlock(&lock_) == 0);
+    }
+  }
+  closedir(d);
+}
+
+void* PrecompressedStore::CompressorThreadFn(void* arg) {
+  PrecompressedStore* store = static_cast<PrecompressedStore*>(arg);
+  store->QueueDirectory("");
+
+  Verify333(pthread_mutex_lock(&store->lock_) == 0);
+  while (1) {
+    while (store->queue_.empty() && !store->terminate_) {
+      Verify333(pthread_cond_wait(&store->cond_, &store->lock_) == 0);
+    }
+    if (store->terminate_)
+      break;
+
+    string file_name = store->queue_.front();
+    store->queue_.pop_front();
+
+    // Compress without holding the lock.  The file stays in queued_
+    // meanwhile, so that lookups don't queue it again.
+    Verify333(pthread_mutex_unlock(&store->lock_) == 0);
+    auto variants = std::make_shared<Variants>();
+    bool ok = store->Compress(file_name, variants.get());
+    Verify333(pthread_mutex_lock(&store->lock_) == 0);
+    store->queued_.erase(file_name);
+    if (!ok)
+      continue;
+
+    // Replace the copies of the file's old version, if they leave room.
+    size_t old_bytes = 0;
+    auto it = store->variants_.find(file_name);
+    if (it != store->variants_.end()) {
+      const Variants& old = *it->second;
+      old_bytes = (old.gzip ? old.gzip->size() : 0) +
+                  (old.brotli ? old.brotli->size() : 0);
+      if (old_bytes > 0) {
+        store->stats_.files--;
+      }
+    }
+    size_t new_bytes = (variants->gzip ? variants->gzip->size() : 0) +
+                       (variants->brotli ? variants->brotli->size() : 0);
+    if (store->stats_.bytes - old_bytes + new_bytes > store->max_bytes_) {
+      variants->gzip.reset();
+      variants->brotli.reset();
+      new_bytes = 0;
+    }
+    store->stats_.bytes = store->stats_.bytes - old_bytes + new_bytes;
+    if (new_bytes > 0) {
+      store->stats_.files++;
+    }
+    store->stats_.builds++;
+    store->variants_[file_name] = std::move(variants);
+  }
+  Verify333(pthread_mutex_unlock(&store->lock_) == 0);
+  return nullptr;
+}
+
+bool PrecompressedStore::Compress(const string& file_name,
+                                  Variants* const variants) {
+  FileReader reader(base_dir_, file_name);
+  int fd;
+  if (!reader.Open(&fd, &variants->st))
+    return false;
+  size_t size = variants->st.st_size;
+  string contents(size, '\0');
+  struct stat after;
+  bool ok = (WrappedPread(fd, &contents[0], size, 0) ==
+             static_cast<ssize_t>(size) &&
+             fstat(fd, &after) == 0 && SameFileVersion(variants->st, after));
+  close(fd);
+  if (ok) {
+    CompressContents(contents, variants);
+  }
+  return ok;
+}
+
+void PrecompressedStore::CompressContents(const string& contents,
+                                          Variants* const variants) {
+  size_t size = contents.size();
+  size_t max_size = size * kMaxCompressedFraction;
+  string gzip;
+  Deflater deflater(ContentCoding::kGzip, 9);
+  deflater.Compress(contents, true, &gzip);
+  if (gzip.size() <= max_size) {
+    variants->gzip = std::make_shared<const string>(std::move(gzip));
+  }
+
+#ifdef HW4_BROTLI
+  size_t brotli_size = BrotliEncoderMaxCompressedSize(size);
+  if (brotli_size != 0) {
+    string brotli(brotli_size, '\0');
+    if (BrotliEncoderCompress(
+            BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+            reinterpret_cast<const uint8_t*>(contents.data()), &brotli_size,
+            reinterpret_cast<uint8_t*>(&brotli[0])) &&
+        brotli_size <= max_size) {
+      brotli.resize(brotli_size);
+      variants->brotli = std::make_shared<const string>(std::move(brotli));
+    }
+  }
+#endif  // HW4_BROTLI
+}
+
+}  // namespace hw4
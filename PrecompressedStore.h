@@ -0,0 +1,121 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_PRECOMPRESSEDSTORE_H_
+#define HW4_PRECOMPRESSEDSTORE_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <stddef.h>
+#include <stdint.h>     // for uint64_t, etc.
+#include <sys/stat.h>   // for struct stat
+#include <list>         // for std::list
+#include <memory>
+#include <string>       // for std::string
+#include <unordered_map>
+#include <unordered_set>
+
+namespace hw4 {
+
+// A PrecompressedStore holds compressed copies of the compressible
+// static files (HTML, CSS, JavaScript, XML and text) under a directory,
+// so that sending one to a client that accepts it compressed costs no
+// compression at all.  Each file is compressed once, as hard as the
+// codec allows: with gzip, and with brotli too if the server is built
+// with HW4_BROTLI.
+//
+// A background thread does the compressing.  It starts with a pass over
+// the whole directory, and afterwards recompresses any file that a
+// lookup finds has changed since it was compressed.  Until a file's
+// copies are ready, lookups find none, and the file is sent as it is.
+class PrecompressedStore {
+ public:
+  // The compressed copies of one version of a file.  Either copy may be
+  // null, if it wasn't enough smaller than the file to be worth keeping.
+  struct Variants {
+    struct stat st;  // the version of the file they were made from
+    std::shared_ptr<const std::string> gzip;
+    std::shared_ptr<const std::string> brotli;
+  };
+
+  // Counters, for monitoring.
+  struct Stats {
+    uint64_t files = 0;   // with at least one compressed copy
+    uint64_t bytes = 0;   // in compressed copies
+    uint64_t builds = 0;  // files compressed, counting recompressions
+  };
+
+  // Construct a store for the files under "base_dir", keeping at most
+  // "max_bytes" of compressed copies, of files at least "min_file_bytes"
+  // long.  Starts the background thread on its pass over "base_dir".
+  PrecompressedStore(const std::string& base_dir, size_t max_bytes,
+                     size_t min_file_bytes);
+
+  // Stops the background thread, even if it is in the middle of its pass.
+  virtual ~PrecompressedStore();
+
+  // Returns the copies of the file "file_name", relative to "base_dir",
+  // made from the version of it that "st" describes, or nullptr if there
+  // are none (yet).  Returns true through "pending" if there are none
+  // only because they haven't been made yet; in that case, a file that
+  // has changed is queued to be recompressed.
+  std::shared_ptr<const Variants> Find(const std::string& file_name,
+                                       const struct stat& st,
+                                       bool* const pending);
+
+  // Returns true if files named like "file_name" are worth compressing.
+  static bool IsCompressible(const std::string& file_name);
+
+  // Compress "contents" into the copies of "variants", keeping only those
+  // that are enough smaller to be worth it.  Leaves "variants->st" alone.
+  static void CompressContents(const std::string& contents,
+                               Variants* const variants);
+
+  Stats GetStats();
+
+ private:
+  // The background thread's start routine; "arg" is the store.
+  static void* CompressorThreadFn(void* arg);
+
+  // Queue the compressible files under the directory "dir", relative to
+  // base_dir_, and those under its subdirectories.
+  void QueueDirectory(const std::string& dir);
+
+  // Queue "file_name" to be compressed.  lock_ must be held.
+  void QueueLocked(const std::string& file_name);
+
+  // Compress the file "file_name" into "variants".  Returns false if the
+  // file can't be read, or changes while it is being read.
+  bool Compress(const std::string& file_name, Variants* const variants);
+
+  std::string base_dir_;
+  size_t max_bytes_;
+  size_t min_file_bytes_;
+
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+  pthread_t thread_;
+  bool terminate_;
+
+  // Guarded by lock_.  A file that didn't compress well enough, or
+  // didn't fit, is in variants_ with no copies, so that it isn't tried
+  // again until it changes.
+  std::unordered_map<std::string, std::shared_ptr<const Variants>> variants_;
+  std::list<std::string> queue_;
+  std::unordered_set<std::string> queued_;
+  Stats stats_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_PRECOMPRESSEDSTORE_H_
@@ -0,0 +1,111 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string.h>   // for memcpy(), memmove()
+#include <memory>
+#include <string_view>
+#include <utility>    // for std::move
+
+#include "./ReceiveBuffer.h"
+
+using std::string_view;
+using std::unique_ptr;
+
+namespace hw4 {
+
+// The smallest block a buffer allocates; enough for most requests.
+static const size_t kMinCapacity = 16384;
+
+// Once it is empty, a buffer gives up a block bigger than this, so that
+// one huge request doesn't tie up memory for the rest of a connection.
+static const size_t kMaxIdleCapacity = 65536;
+
+ReceiveBuffer::ReceiveBuffer()
+  : capacity_(0), begin_(0), read_(0), end_(0), scanned_(0) { }
+
+char* ReceiveBuffer::PrepareWrite(size_t min_space, size_t* const space) {
+  if (capacity_ - end_ < min_space) {
+    MakeRoom(min_space);
+  }
+  *space = capacity_ - end_;
+  return data_.get() + end_;
+}
+
+void ReceiveBuffer::Append(const char* data, size_t len) {
+  size_t space;
+  memcpy(PrepareWrite(len, &space), data, len);
+  CommitWrite(len);
+}
+
+size_t ReceiveBuffer::Scan(string_view delim) {
+  size_t unread = size();
+  if (unread < delim.size())
+    return 0;
+  string_view view(data_.get() + read_, unread);
+  size_t pos = view.find(delim, scanned_);
+  if (pos == string_view::npos) {
+    // A match could still start in the last few bytes.
+    scanned_ = unread - (delim.size() - 1);
+    return 0;
+  }
+  return pos + delim.size();
+}
+
+string_view ReceiveBuffer::Take(size_t len) {
+  string_view taken(data_.get() + read_, len);
+  read_ += len;
+  scanned_ = 0;
+  return taken;
+}
+
+void ReceiveBuffer::Release() {
+  retired_.clear();
+  begin_ = read_;
+  if (read_ == end_) {
+    begin_ = read_ = end_ = 0;
+    if (capacity_ > kMaxIdleCapacity) {
+      data_.reset();
+      capacity_ = 0;
+    }
+  }
+}
+
+void ReceiveBuffer::MakeRoom(size_t min_space) {
+  size_t unread = size();
+
+  // Sliding is enough if nothing is taken and the space freed by the
+  // bytes consumed so far is big enough.
+  if (begin_ == read_ && capacity_ - unread >= min_space) {
+    memmove(data_.get(), data_.get() + read_, unread);
+    begin_ = read_ = 0;
+    end_ = unread;
+    return;
+  }
+
+  size_t new_capacity = (capacity_ > kMinCapacity) ? capacity_ : kMinCapacity;
+  while (new_capacity - unread < min_space) {
+    new_capacity *= 2;
+  }
+  unique_ptr<char[]> new_data(new char[new_capacity]);
+  if (unread > 0) {
+    memcpy(new_data.get(), data_.get() + read_, unread);
+  }
+  if (begin_ != read_) {
+    // Views of the taken bytes still point into the old block.
+    retired_.push_back(std::move(data_));
+  }
+  data_ = std::move(new_data);
+  capacity_ = new_capacity;
+  begin_ = read_ = 0;
+  end_ = unread;
+}
+
+}  // namespace hw4
@@ -0,0 +1,91 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_RECEIVEBUFFER_H_
+#define HW4_RECEIVEBUFFER_H_
+
+#include <stddef.h>   // for size_t
+#include <memory>     // for std::unique_ptr
+#include <string_view>
+#include <vector>
+
+namespace hw4 {
+
+// A ReceiveBuffer holds the bytes a connection has received but not yet
+// finished with.  Bytes are read straight into the free space at its
+// end, and are consumed by advancing a cursor rather than by copying
+// what is left over.  The unread bytes are only slid back to the front
+// when the end runs out of room.
+//
+// Consumed bytes can stay "taken": Take() hands out a view of them that
+// stays valid, even if the buffer has to grow, until Release() says the
+// views are no longer in use.
+//
+// Scan() remembers how far it has searched, so that looking for a
+// delimiter again after more bytes arrive doesn't search the same bytes
+// over and over.  A ReceiveBuffer is not thread-safe.
+class ReceiveBuffer {
+ public:
+  ReceiveBuffer();
+  virtual ~ReceiveBuffer() { }
+
+  // Returns a pointer to at least "min_space" bytes of free space at
+  // the end of the buffer, and sets "space" to how much there is.  Use
+  // CommitWrite() to say how much of it was filled.
+  char* PrepareWrite(size_t min_space, size_t* const space);
+  void CommitWrite(size_t len) { end_ += len; }
+
+  // Copy "len" bytes onto the end of the buffer.
+  void Append(const char* data, size_t len);
+
+  // Returns the number of unread bytes up to and including the first
+  // occurrence of "delim", or 0 if they don't contain one (yet).  The
+  // search picks up where the previous unsuccessful one stopped, so the
+  // same "delim" must be used until Take() is called.
+  size_t Scan(std::string_view delim);
+
+  // Consumes "len" unread bytes, returning a view of them that stays
+  // valid until Release().
+  std::string_view Take(size_t len);
+
+  // Give up the views Take() has returned.
+  void Release();
+
+  // Returns the number of unread bytes.
+  size_t size() const { return end_ - read_; }
+
+  // Returns the size of the block the bytes are kept in.
+  size_t capacity() const { return capacity_; }
+
+ private:
+  // Make room for "min_space" more bytes at the end, by sliding the
+  // unread bytes to the front or by moving them to a bigger block.
+  void MakeRoom(size_t min_space);
+
+  std::unique_ptr<char[]> data_;
+  size_t capacity_;
+
+  // data_[begin_, read_) has been taken, data_[read_, end_) is unread,
+  // and no match for the delimiter starts in the first scanned_ unread
+  // bytes.
+  size_t begin_;
+  size_t read_;
+  size_t end_;
+  size_t scanned_;
+
+  // Blocks we outgrew while some of their bytes were taken; freed by
+  // Release().
+  std::vector<std::unique_ptr<char[]>> retired_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_RECEIVEBUFFER_H_
@@ -14,6 +14,7 @@
 
 #include <stdio.h>       // for snprintf()
 #include <unistd.h>      // for close(), fcntl()
+#include <fcntl.h>       // for fcntl()
 #include <sys/types.h>   // for socket(), getaddrinfo(), etc.
 #include <sys/socket.h>  // for socket(), getaddrinfo(), etc.
 #include <arpa/inet.h>   // for inet_ntop()
@@ -33,6 +34,9 @@ namespace hw4 {
 ServerSocket::ServerSocket(uint16_t port) {
   port_ = port;
   listen_sock_fd_ = -1;
+  nonblocking_ = false;
+  reuse_port_ = false;
+  resolve_names_ = true;
 }
 
 ServerSocket::~ServerSocket() {
@@ -108,6 +112,15 @@ bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
       continue;
     }
 
+    // If asked to, also set "SO_REUSEPORT", which lets several listening
+    // sockets bind to the same port and has the kernel load-balance new
+    // connections between them.
+    if (reuse_port_ && setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT,
+                                  &optval, sizeof(optval))) {
+      std::cerr << "setsockopt() failed: " << strerror(errno) << std::endl;
+      close(lfd);
+      continue;
+    }
 
     // Try binding the socket to the address and port number returned
     // by getaddrinfo().
@@ -143,12 +156,27 @@ bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
   return true;
 }
 
+bool ServerSocket::SetNonBlocking() {
+  if (listen_sock_fd_ == -1)
+    return false;
+
+  int flags = fcntl(listen_sock_fd_, F_GETFL, 0);
+  if (flags == -1 ||
+      fcntl(listen_sock_fd_, F_SETFL, flags | O_NONBLOCK) == -1) {
+    std::cerr << "fcntl() failed: " << strerror(errno) << std::endl;
+    return false;
+  }
+  nonblocking_ = true;
+  return true;
+}
+
 bool ServerSocket::Accept(int* const accepted_fd,
                           std::string* const client_addr,
                           uint16_t* const client_port,
                           std::string* const client_dns_name,
                           std::string* const server_addr,
-                          std::string* const server_dns_name) const {
+                          std::string* const server_dns_name,
+                          int* const error) const {
   // Accept a new connection on the listening socket listen_sock_fd_.
   // (Block until a new connection arrives.)  Return the newly accepted
   // socket, as well as information about both ends of the new connection,
@@ -157,37 +185,97 @@ bool ServerSocket::Accept(int* const accepted_fd,
   // STEP 2:
   struct sockaddr_storage c_addr;
   socklen_t c_addr_len = sizeof(c_addr);
-  char ip_str[INET6_ADDRSTRLEN];
-  char host[1024];
 
   int fd;
   while (1) {
-    fd = accept(listen_sock_fd_,
-                reinterpret_cast<struct sockaddr *>(&c_addr), &c_addr_len);
+    fd = accept4(listen_sock_fd_,
+                 reinterpret_cast<struct sockaddr *>(&c_addr), &c_addr_len,
+                 nonblocking_ ? SOCK_NONBLOCK : 0);
     if (fd < 0) {
-      if (errno == EAGAIN || errno == EINTR) {
+      if (errno == EINTR) {
         continue;
       }
-      std::cerr << "Failure on accept: " << strerror(errno) << std::endl;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (nonblocking_) {
+          // Nothing left to accept; let the caller's event loop wait.
+          if (error != nullptr) {
+            *error = EAGAIN;
+          }
+          return false;
+        }
+        continue;
+      }
+      int accept_errno = errno;
+      std::cerr << "Failure on accept: " << strerror(accept_errno)
+                << std::endl;
+      if (error != nullptr) {
+        *error = accept_errno;
+      }
       return false;
     }
     break;
   }
 
+  if (!DescribeConnection(fd, c_addr, c_addr_len, client_addr, client_port,
+                          client_dns_name, server_addr, server_dns_name)) {
+    close(fd);
+    if (error != nullptr) {
+      *error = 0;
+    }
+    return false;
+  }
+  *accepted_fd = fd;
+  return true;
+}
+
+bool ServerSocket::DescribeAccepted(int accepted_fd,
+                                    std::string* const client_addr,
+                                    uint16_t* const client_port,
+                                    std::string* const client_dns_name,
+                                    std::string* const server_addr,
+                                    std::string* const server_dns_name) const {
+  struct sockaddr_storage c_addr;
+  socklen_t c_addr_len = sizeof(c_addr);
+  if (getpeername(accepted_fd, reinterpret_cast<struct sockaddr *>(&c_addr),
+                  &c_addr_len) == -1) {
+    std::cerr << "Failed to get client address: "
+    << strerror(errno) << std::endl;
+    return false;
+  }
+  return DescribeConnection(accepted_fd, c_addr, c_addr_len, client_addr,
+                            client_port, client_dns_name, server_addr,
+                            server_dns_name);
+}
+
+bool ServerSocket::DescribeConnection(int fd,
+                                      const struct sockaddr_storage& c_addr,
+                                      socklen_t c_addr_len,
+                                      std::string* const client_addr,
+                                      uint16_t* const client_port,
+                                      std::string* const client_dns_name,
+                                      std::string* const server_addr,
+                                      std::string* const server_dns_name)
+    const {
+  char ip_str[INET6_ADDRSTRLEN];
+  char host[1024];
+
   // Get client IP address and port
   if (c_addr.ss_family == AF_INET) {
-    struct sockaddr_in *s4 = reinterpret_cast<struct sockaddr_in *>(&c_addr);
+    const struct sockaddr_in *s4 =
+      reinterpret_cast<const struct sockaddr_in *>(&c_addr);
     inet_ntop(AF_INET, &s4 -> sin_addr, ip_str, sizeof(ip_str));
     *client_port = ntohs(s4 -> sin_port);
   } else {
-    struct sockaddr_in6 *s6 = reinterpret_cast<struct sockaddr_in6 *>(&c_addr);
+    const struct sockaddr_in6 *s6 =
+      reinterpret_cast<const struct sockaddr_in6 *>(&c_addr);
     inet_ntop(AF_INET6, &s6 -> sin6_addr, ip_str, sizeof(ip_str));
     *client_port = ntohs(s6 -> sin6_port);
   }
   *client_addr = std::string(ip_str);
 
   // Get client DNS name
-  if (getnameinfo(reinterpret_cast<struct sockaddr *>(&c_addr),
+  if (resolve_names_ &&
+      getnameinfo(reinterpret_cast<const struct sockaddr *>(&c_addr),
                   c_addr_len, host, sizeof(host), nullptr, 0, 0) == 0) {
     *client_dns_name = std::string(host);
   } else {
@@ -201,7 +289,6 @@ bool ServerSocket::Accept(int* const accepted_fd,
                   &s_addr_len) == -1) {
       std::cerr << "Failed to get server address: "
       << strerror(errno) << std::endl;
-      close(fd);
       return false;
   }
 
@@ -211,21 +298,21 @@ bool ServerSocket::Accept(int* const accepted_fd,
                               <struct sockaddr_in *>(&s_addr);
     inet_ntop(AF_INET, &s4 -> sin_addr, ip_str, sizeof(ip_str));
   } else {
-    struct sockaddr_in6 *s6 = reinterpret_cast
-                              <struct sockaddr_in6 *>(&c_addr);
+    const struct sockaddr_in6 *s6 = reinterpret_cast
+                              <const struct sockaddr_in6 *>(&c_addr);
     inet_ntop(AF_INET6, &s6 -> sin6_addr, ip_str, sizeof(ip_str));
   }
   *server_addr = std::string(ip_str);
 
   // Get server DNS name
-  if (getnameinfo(reinterpret_cast<struct sockaddr *>(&s_addr),
+  if (resolve_names_ &&
+      getnameinfo(reinterpret_cast<struct sockaddr *>(&s_addr),
                   s_addr_len, host, sizeof(host),
                   nullptr, 0, NI_NAMEREQD) == 0) {
     *server_dns_name = std::string(host);
   } else {
     *server_dns_name = *server_addr;
   }
-  *accepted_fd = fd;
   return true;
 }
 
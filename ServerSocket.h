@@ -35,6 +35,21 @@ class ServerSocket {
   // The destructor closes the listening socket if it is open.
   virtual ~ServerSocket();
 
+  // Ask BindAndListen() to set SO_REUSEPORT on the listening socket, so
+  // that several ServerSockets (in this or other processes) can listen
+  // on the same port.  The kernel then spreads incoming connections
+  // across all of them.  Must be called before BindAndListen().
+  void set_reuse_port(bool reuse_port) { reuse_port_ = reuse_port; }
+
+  // By default, Accept() looks up the DNS names of both ends of each new
+  // connection, which can stall the caller for as long as the resolver
+  // takes.  Passing false makes Accept() skip those lookups and return
+  // the numeric addresses as the DNS names instead; see DnsCache.h for
+  // a way to resolve them off the accept path.
+  void set_resolve_names(bool resolve_names) {
+    resolve_names_ = resolve_names;
+  }
+
   // This function causes the ServerSocket to attempt to create a
   // listening socket and to bind it to the given port number on
   // whatever IP address the host OS recommends for us.  The caller
@@ -55,6 +70,15 @@ class ServerSocket {
   // - listen_fd: the file descriptor for the listening socket.
   bool BindAndListen(int ai_family, int* const listen_fd);
 
+  // This function switches the listening socket created by
+  // BindAndListen() into non-blocking mode, so that it can be driven by
+  // an event loop (e.g., epoll).  Afterwards, Accept() never blocks: if
+  // no connection is pending, it returns false with errno set to EAGAIN.
+  // The client sockets it returns are non-blocking as well.
+  //
+  // Returns false if the socket isn't listening or fcntl() fails.
+  bool SetNonBlocking();
+
   // This function causes the ServerSocket to attempt to accept
   // an incoming connection from a client.  On failure, returns false.
   // On success, it returns true, and also returns (via output
@@ -72,25 +96,59 @@ class ServerSocket {
   //
   // - client_dnsname: a C++ string object containing the DNS name
   //   of the client or a string representation of the IP addresss
-  //   if there is no valid DNS name
+  //   if there is no valid DNS name (or set_resolve_names(false) was
+  //   called)
   //
   // - server_addr: a C++ string object containing a printable
   //   representation of the server IP address for the connection
   //
   // - server_dnsname: a C++ string object containing the DNS name
   //   of the server or a string representation of the IP addresss
-  //   if there is no valid DNS name
+  //   if there is no valid DNS name (or set_resolve_names(false) was
+  //   called)
+  //
+  // On failure, if "error" isn't nullptr, it is set to say why:
+  // EAGAIN if no connection is pending (in non-blocking mode), the
+  // errno accept() failed with (e.g., ECONNABORTED or EMFILE), or 0 if
+  // a connection was accepted but couldn't be described, and has been
+  // closed.  Only EAGAIN means the backlog is empty.
   bool Accept(int* const accepted_fd,
               std::string* const client_addr,
               uint16_t* const client_port,
               std::string* const client_dns_name,
               std::string* const server_addr,
-              std::string* const server_dns_name) const;
+              std::string* const server_dns_name,
+              int* const error = nullptr) const;
+
+  // For a connection that was accepted on the listening socket some
+  // other way (e.g., through io_uring), look up the same information
+  // Accept() returns.  Returns false on failure; either way, the caller
+  // still owns "accepted_fd".
+  bool DescribeAccepted(int accepted_fd,
+                        std::string* const client_addr,
+                        uint16_t* const client_port,
+                        std::string* const client_dns_name,
+                        std::string* const server_addr,
+                        std::string* const server_dns_name) const;
 
  private:
+  // The part of Accept() and DescribeAccepted() that runs once the
+  // client's address "c_addr" is known.
+  bool DescribeConnection(int fd,
+                          const struct sockaddr_storage& c_addr,
+                          socklen_t c_addr_len,
+                          std::string* const client_addr,
+                          uint16_t* const client_port,
+                          std::string* const client_dns_name,
+                          std::string* const server_addr,
+                          std::string* const server_dns_name) const;
+
   uint16_t port_;
   int listen_sock_fd_;
   int sock_family_;  // either AF_INET or AF_INET6 for ipv4 or ipv6/v4
+  bool nonblocking_;  // set by SetNonBlocking()
+  bool reuse_port_;   // set by set_reuse_port()
+  bool resolve_names_;  // set by set_resolve_names()
 };
 
 }  // namespace hw4
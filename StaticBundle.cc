@@ -0,0 +1,422 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <dirent.h>       // for opendir(), readdir()
+#include <errno.h>        // for errno
+#include <fcntl.h>        // for open()
+#include <stdio.h>        // for rename()
+#include <string.h>       // for memcmp(), strcmp()
+#include <sys/mman.h>     // for mmap(), munmap()
+#include <sys/stat.h>     // for fstat(), lstat()
+#include <unistd.h>       // for pread(), pwrite(), close()
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./FileReader.h"
+#include "./HttpUtils.h"
+#include "./PrecompressedStore.h"
+#include "./StaticBundle.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace hw4 {
+
+// Identifies a bundle, and the version of its layout.
+static const char kMagic[8] = {'3', '3', '3', 'B', 'N', 'D', 'L', '\1'};
+static const uint32_t kVersion = 1;
+
+// Written as it is, so that it reads back differently on a machine of
+// the other byte order.
+static const uint32_t kByteOrderMark = 0x01020304;
+
+// Each file's contents start on a boundary of this many bytes, so that
+// a page of the mapping never holds more than one file's.
+static const uint64_t kPageSize = 4096;
+
+// How many seeds to try for a bucket before trying a bigger table.
+static const uint32_t kMaxSeedTries = 1 << 16;
+
+// Marks a slot that no file has been placed in yet.
+static const uint32_t kNoFile = UINT32_MAX;
+
+// A bundle starts with a Header, in a page of its own.  The files'
+// contents follow, each followed by its compressed copies, and then the
+// buckets' seeds, the slots, and the files' names and content types.
+// Offsets are from the start of the bundle.
+struct StaticBundle::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_files;
+  uint32_t num_buckets;
+  uint32_t num_slots;
+  uint32_t unused;
+  uint64_t seeds_offset;  // num_buckets uint32_t's
+  uint64_t slots_offset;  // num_slots SlotRecords
+  uint64_t total_size;
+};
+
+// A slot of the hash table.  An empty one has a name_length of 0.
+struct StaticBundle::SlotRecord {
+  uint64_t name_offset;  // the name, followed by the content type
+  uint32_t name_length;
+  uint32_t type_length;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t gzip_offset;
+  uint64_t gzip_size;
+  uint64_t brotli_offset;
+  uint64_t brotli_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t hash;
+};
+
+// Returns a hash of "bytes" that is different for each "seed": FNV-1a,
+// finished off so that every bit of it depends on every byte.
+static uint64_t Hash(string_view bytes, uint64_t seed) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+  for (unsigned char c : bytes) {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Returns true if "length" bytes starting at "offset" fit in "size".
+static bool Fits(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+// Rounds "offset" up to a multiple of "alignment".
+static uint64_t Align(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Write all "size" bytes at "data" to "fd", starting at "offset".
+static bool WriteAt(int fd, const void* data, size_t size, uint64_t offset) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t res = pwrite(fd, p, size, offset);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    p += res;
+    size -= res;
+    offset += res;
+  }
+  return true;
+}
+
+// Add the names of the regular files under the directory "dir",
+// relative to "base_dir", and those under its subdirectories, to
+// "names".
+static void ListFiles(const string& base_dir, const string& dir,
+                      vector<string>* const names) {
+  DIR* d = opendir((base_dir + "/" + dir).c_str());
+  if (d == nullptr)
+    return;
+  struct dirent* dirent;
+  while ((dirent = readdir(d)) != nullptr) {
+    if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+      continue;
+
+    // Don't follow symbolic links, which could lead in circles, or out of
+    // the directory.
+    string name = dir.empty() ? string(dirent->d_name) :
+                                dir + "/" + dirent->d_name;
+    struct stat st;
+    if (lstat((base_dir + "/" + name).c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      ListFiles(base_dir, name, names);
+    } else if (S_ISREG(st.st_mode)) {
+      names->push_back(name);
+    }
+  }
+  closedir(d);
+}
+
+// Find a seed for each of "num_buckets" buckets that hashes the names in
+// it to slots no other name has, out of "num_slots", and return the
+// seeds through "seeds" and the index of the name in each slot through
+// "slots".  The biggest buckets, which are the hardest to place, go
+// first.  Returns false if some bucket can't be placed.
+static bool PlaceNames(const vector<string>& names, uint32_t num_buckets,
+                       uint32_t num_slots, vector<uint32_t>* const seeds,
+                       vector<uint32_t>* const slots) {
+  vector<vector<uint32_t>> buckets(num_buckets);
+  for (uint32_t i = 0; i < names.size(); i++) {
+    buckets[Hash(names[i], 0) % num_buckets].push_back(i);
+  }
+  vector<uint32_t> order(num_buckets);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&buckets](uint32_t a, uint32_t b) {
+                     return buckets[a].size() > buckets[b].size();
+                   });
+
+  seeds->assign(num_buckets, 0);
+  slots->assign(num_slots, kNoFile);
+  vector<uint32_t> placed;
+  for (uint32_t b : order) {
+    const vector<uint32_t>& bucket = buckets[b];
+    if (bucket.empty())
+      break;
+    uint32_t seed;
+    for (seed = 1; seed < kMaxSeedTries; seed++) {
+      placed.clear();
+      for (uint32_t i : bucket) {
+        uint32_t slot = Hash(names[i], seed) % num_slots;
+        if ((*slots)[slot] != kNoFile ||
+            std::find(placed.begin(), placed.end(), slot) != placed.end())
+          break;
+        placed.push_back(slot);
+      }
+      if (placed.size() == bucket.size())
+        break;
+    }
+    if (seed == kMaxSeedTries)
+      return false;
+    for (size_t k = 0; k < bucket.size(); k++) {
+      (*slots)[placed[k]] = bucket[k];
+    }
+    (*seeds)[b] = seed;
+  }
+  return true;
+}
+
+bool StaticBundle::WriteBundle(int fd, const string& dir,
+                               const vector<string>& names,
+                               size_t min_compress_bytes) {
+  vector<SlotRecord> records(names.size());
+  string strings;  // the names and content types
+  uint64_t offset = kPageSize;
+  for (size_t i = 0; i < names.size(); i++) {
+    // Read the file in, making sure it doesn't change as we do.
+    FileReader reader(dir, names[i]);
+    int file_fd;
+    struct stat st, after;
+    if (!reader.Open(&file_fd, &st))
+      return false;
+    string contents(st.st_size, '\0');
+    bool ok = (WrappedPread(file_fd, &contents[0], contents.size(), 0) ==
+               static_cast<ssize_t>(contents.size()) &&
+               fstat(file_fd, &after) == 0 && SameFileVersion(st, after));
+    close(file_fd);
+    if (!ok)
+      return false;
+
+    SlotRecord& record = records[i];
+    const char* content_type = ContentTypeFor(names[i]);
+    record.name_offset = strings.size();
+    record.name_length = names[i].size();
+    record.type_length = strlen(content_type);
+    strings += names[i];
+    strings += content_type;
+    record.mtime_sec = st.st_mtim.tv_sec;
+    record.mtime_nsec = st.st_mtim.tv_nsec;
+    record.hash = Hash(contents, 0);
+
+    offset = Align(offset, kPageSize);
+    record.data_offset = offset;
+    record.data_size = contents.size();
+    if (!WriteAt(fd, contents.data(), contents.size(), offset))
+      return false;
+    offset += contents.size();
+
+    PrecompressedStore::Variants variants;
+    if (contents.size() >= min_compress_bytes &&
+        PrecompressedStore::IsCompressible(names[i])) {
+      PrecompressedStore::CompressContents(contents, &variants);
+    }
+    record.gzip_offset = record.brotli_offset = 0;
+    record.gzip_size = record.brotli_size = 0;
+    if (variants.gzip != nullptr) {
+      record.gzip_offset = offset;
+      record.gzip_size = variants.gzip->size();
+      if (!WriteAt(fd, variants.gzip->data(), variants.gzip->size(), offset))
+        return false;
+      offset += variants.gzip->size();
+    }
+    if (variants.brotli != nullptr) {
+      record.brotli_offset = offset;
+      record.brotli_size = variants.brotli->size();
+      if (!WriteAt(fd, variants.brotli->data(), variants.brotli->size(),
+                   offset))
+        return false;
+      offset += variants.brotli->size();
+    }
+  }
+
+  // A table a quarter bigger than it has to be is usually easy to place
+  // every name in; if it isn't, try a bigger one.
+  uint32_t num_buckets = names.size() / 2 + 1;
+  uint32_t num_slots = names.size() + names.size() / 4 + 1;
+  vector<uint32_t> seeds, slots;
+  while (!PlaceNames(names, num_buckets, num_slots, &seeds, &slots)) {
+    num_slots += num_slots / 4 + 1;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrderMark;
+  header.num_files = names.size();
+  header.num_buckets = num_buckets;
+  header.num_slots = num_slots;
+  header.seeds_offset = Align(offset, sizeof(uint64_t));
+  header.slots_offset = Align(header.seeds_offset +
+                              num_buckets * sizeof(uint32_t),
+                              sizeof(uint64_t));
+  uint64_t strings_offset = header.slots_offset +
+                            num_slots * sizeof(SlotRecord);
+  header.total_size = strings_offset + strings.size();
+
+  vector<SlotRecord> table(num_slots);
+  memset(table.data(), 0, table.size() * sizeof(table[0]));
+  for (uint32_t slot = 0; slot < num_slots; slot++) {
+    if (slots[slot] != kNoFile) {
+      table[slot] = records[slots[slot]];
+      table[slot].name_offset += strings_offset;
+    }
+  }
+  return WriteAt(fd, seeds.data(), seeds.size() * sizeof(seeds[0]),
+                 header.seeds_offset) &&
+         WriteAt(fd, table.data(), table.size() * sizeof(table[0]),
+                 header.slots_offset) &&
+         WriteAt(fd, strings.data(), strings.size(), strings_offset) &&
+         WriteAt(fd, &header, sizeof(header), 0) &&
+         ftruncate(fd, header.total_size) == 0;
+}
+
+StaticBundle::StaticBundle()
+  : base_(nullptr), size_(0), num_files_(0), num_buckets_(0),
+    num_slots_(0), seeds_(nullptr), slots_(nullptr) { }
+
+StaticBundle::~StaticBundle() { }
+
+bool StaticBundle::Build(const string& dir, const string& path,
+                         size_t min_compress_bytes) {
+  vector<string> names;
+  ListFiles(dir, "", &names);
+  std::sort(names.begin(), names.end());
+  if (names.size() >= kNoFile / 2)
+    return false;
+
+  string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd == -1)
+    return false;
+  bool ok = WriteBundle(fd, dir, names, min_compress_bytes);
+  ok = (close(fd) == 0) && ok;
+  if (ok && rename(tmp_path.c_str(), path.c_str()) == 0)
+    return true;
+  unlink(tmp_path.c_str());
+  return false;
+}
+
+bool StaticBundle::Open(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<uint64_t>(st.st_size) >= sizeof(Header)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+
+  // The mapping lasts as long as anything, like a response, needs it.
+  size_t size = st.st_size;
+  std::shared_ptr<const void> mapping(
+      static_cast<const void*>(addr),
+      [size](const void* p) { munmap(const_cast<void*>(p), size); });
+
+  // Only the header is checked now, so that opening a bundle costs the
+  // same however many files it has; each slot is checked when it is
+  // looked up.
+  const Header* header = static_cast<const Header*>(addr);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion ||
+      header->byte_order != kByteOrderMark ||
+      header->total_size != size ||
+      header->num_buckets == 0 ||
+      header->num_slots < header->num_files ||
+      header->num_slots == 0 ||
+      header->seeds_offset % alignof(uint32_t) != 0 ||
+      header->slots_offset % alignof(SlotRecord) != 0 ||
+      !Fits(header->seeds_offset,
+            uint64_t(header->num_buckets) * sizeof(uint32_t), size) ||
+      !Fits(header->slots_offset,
+            uint64_t(header->num_slots) * sizeof(SlotRecord), size))
+    return false;
+
+  mapping_ = std::move(mapping);
+  base_ = static_cast<const char*>(addr);
+  size_ = size;
+  num_files_ = header->num_files;
+  num_buckets_ = header->num_buckets;
+  num_slots_ = header->num_slots;
+  seeds_ = reinterpret_cast<const uint32_t*>(base_ + header->seeds_offset);
+  slots_ = reinterpret_cast<const SlotRecord*>(base_ + header->slots_offset);
+  return true;
+}
+
+bool StaticBundle::Lookup(string_view name, File* const file) const {
+  if (num_files_ == 0 || name.empty())
+    return false;
+  uint32_t seed = seeds_[Hash(name, 0) % num_buckets_];
+  const SlotRecord& record = slots_[Hash(name, seed) % num_slots_];
+  if (record.name_length != name.size() ||
+      !Fits(record.name_offset,
+            uint64_t(record.name_length) + record.type_length, size_) ||
+      string_view(base_ + record.name_offset, record.name_length) != name ||
+      !Fits(record.data_offset, record.data_size, size_) ||
+      !Fits(record.gzip_offset, record.gzip_size, size_) ||
+      !Fits(record.brotli_offset, record.brotli_size, size_))
+    return false;
+
+  file->contents = string_view(base_ + record.data_offset, record.data_size);
+  file->gzip = string_view(base_ + record.gzip_offset, record.gzip_size);
+  file->brotli = string_view(base_ + record.brotli_offset,
+                             record.brotli_size);
+  file->content_type = string_view(base_ + record.name_offset +
+                                   record.name_length, record.type_length);
+  file->mtime.tv_sec = record.mtime_sec;
+  file->mtime.tv_nsec = record.mtime_nsec;
+  file->hash = record.hash;
+  return true;
+}
+
+}  // namespace hw4
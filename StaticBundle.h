@@ -0,0 +1,101 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_STATICBUNDLE_H_
+#define HW4_STATICBUNDLE_H_
+
+#include <stddef.h>
+#include <stdint.h>     // for uint64_t, etc.
+#include <time.h>       // for struct timespec
+#include <memory>
+#include <string>       // for std::string
+#include <string_view>
+#include <vector>
+
+namespace hw4 {
+
+// A StaticBundle is every static file under a directory, packed into
+// one read-only file that the server maps into memory and serves from
+// directly, so that it starts in constant time however many files there
+// are, and never goes to the file system for one.  The bundle333 tool
+// ("bundle333 static_dir bundle_file") builds it ahead of time.
+//
+// The bundle holds each file's contents, starting on a page boundary,
+// and the compressed copies of it that PrecompressedStore would make.
+// They are found through a minimal perfect hash of the files' names
+// (hash and displace: a name's bucket picks the seed that hashes it to
+// its slot), so a lookup reads exactly one slot, and then compares the
+// name stored there with the one asked for, so that a name that isn't
+// in the bundle, like one that climbs out of the directory, is never
+// served.  Everything is in the byte order of the machine that built
+// the bundle, which has to match the server's; Open() checks that, and
+// that every table the bundle claims to have fits inside it.
+class StaticBundle {
+ public:
+  // One file in the bundle.  The views point into the mapping.
+  struct File {
+    std::string_view contents;
+    std::string_view gzip;    // empty if there is no gzip copy
+    std::string_view brotli;  // empty if there is no brotli copy
+    std::string_view content_type;  // empty if unknown
+    struct timespec mtime;    // of the file the bundle was built from
+    uint64_t hash;            // of the contents
+  };
+
+  StaticBundle();
+  virtual ~StaticBundle();
+
+  // Pack the regular files under the directory "dir", and those under
+  // its subdirectories, into a new bundle at "path", with compressed
+  // copies of the compressible ones at least "min_compress_bytes" long.
+  // Symbolic links aren't followed.  The bundle is written to a
+  // temporary file and renamed into place, so a server never maps a
+  // half-written one.  Returns false on failure.
+  static bool Build(const std::string& dir, const std::string& path,
+                    size_t min_compress_bytes);
+
+  // Map the bundle at "path".  Returns false if it can't be mapped, or
+  // isn't a valid bundle.
+  bool Open(const std::string& path);
+
+  // Find the file "name", relative to the bundled directory, and return
+  // it through "file".  Returns false if there is no such file.
+  bool Lookup(std::string_view name, File* const file) const;
+
+  // Returns the mapping, which keeps the views of any File alive for as
+  // long as it is held.
+  const std::shared_ptr<const void>& mapping() const { return mapping_; }
+
+  uint32_t num_files() const { return num_files_; }
+
+ private:
+  // The bundle's layout (see StaticBundle.cc).
+  struct Header;
+  struct SlotRecord;
+
+  // Pack the files "names", under "dir", into the empty file "fd".
+  static bool WriteBundle(int fd, const std::string& dir,
+                          const std::vector<std::string>& names,
+                          size_t min_compress_bytes);
+
+  std::shared_ptr<const void> mapping_;
+  const char* base_;
+  size_t size_;
+  uint32_t num_files_;
+  uint32_t num_buckets_;
+  uint32_t num_slots_;
+  const uint32_t* seeds_;
+  const SlotRecord* slots_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_STATICBUNDLE_H_
@@ -9,6 +9,8 @@
  * author.
  */
 
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <iostream>
 
@@ -20,121 +22,496 @@ extern "C" {
 
 namespace hw4 {
 
-// This is the thread start routine, i.e., the function that threads
-// are born into.
-void* ThreadLoop(void* t_pool);
+// How many Tasks fit in each worker's own queue.  Must be a power of 2.
+static const size_t kQueueCapacity = 1024;
 
-ThreadPool::ThreadPool(uint32_t num_threads) {
-  // Initialize our member variables.
+// How many times an idle worker looks for work before going to sleep.
+static const int kSpinRounds = 64;
+
+// How often the manager of an elastic pool checks whether to grow it,
+// and how many checks in a row must find every worker busy while tasks
+// are waiting before it does.
+static const int kManageIntervalMs = 10;
+static const int kGrowChecks = 2;
+
+// How long a worker of an elastic pool sleeps without work before it
+// retires (as long as the pool has more than its minimum).
+static const int kRetireIdleMs = 5000;
+
+// The pool and worker index of the current thread, if it is a worker.
+// Dispatch() from a worker puts the task on that worker's own queue.
+static thread_local ThreadPool* tls_pool = nullptr;
+static thread_local uint32_t tls_worker = 0;
+
+// Tell the CPU we are in a spin loop.
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds.
+static uint64_t NowNs() {
+  struct timespec ts;
+  Verify333(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns the CLOCK_MONOTONIC time "ms" milliseconds from now, for
+// pthread_cond_timedwait().
+static struct timespec DeadlineAfterMs(int ms) {
+  struct timespec ts;
+  Verify333(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  ts.tv_sec += ms / 1000;
+  ts.tv_nsec += (ms % 1000) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  return ts;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool::TaskQueue
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::TaskQueue::TaskQueue()
+  : enqueue_pos_(0), dequeue_pos_(0) {
+  slots_ = new Slot[kQueueCapacity];
+  for (size_t i = 0; i < kQueueCapacity; i++) {
+    slots_[i].seq.store(i, std::memory_order_relaxed);
+    slots_[i].task = nullptr;
+  }
+}
+
+ThreadPool::TaskQueue::~TaskQueue() {
+  delete[] slots_;
+}
+
+bool ThreadPool::TaskQueue::Push(Task* t) {
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (1) {
+    Slot* slot = &slots_[pos & (kQueueCapacity - 1)];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // The slot is free; try to claim it.
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        slot->task = t;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // full
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+ThreadPool::Task* ThreadPool::TaskQueue::Pop() {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (1) {
+    Slot* slot = &slots_[pos & (kQueueCapacity - 1)];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff =
+      static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      // The slot holds a task; try to claim it.
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        Task* t = slot->task;
+        slot->seq.store(pos + kQueueCapacity, std::memory_order_release);
+        return t;
+      }
+    } else if (diff < 0) {
+      return nullptr;  // empty
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool ThreadPool::TaskQueue::Empty() const {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  const Slot* slot = &slots_[pos & (kQueueCapacity - 1)];
+  return slot->seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(uint32_t num_threads)
+  : ThreadPool(num_threads, num_threads) { }
+
+ThreadPool::ThreadPool(uint32_t min_threads, uint32_t max_threads)
+  : terminate_threads_(false), min_threads_(min_threads),
+    max_threads_(max_threads), num_active_(0), has_manager_(false),
+    num_pending_(0), num_busy_(0), high_water_mark_(0), next_queue_(0),
+    overflow_len_(0), num_sleeping_(0) {
+  Verify333(min_threads > 0 && min_threads <= max_threads);
+
+  // Initialize our member variables.  The condition variables use the
+  // monotonic clock, since idle workers and the manager wait on them
+  // with timeouts.
   num_threads_running_ = 0;
-  terminate_threads_ = false;
   Verify333(pthread_mutex_init(&q_lock_, nullptr) == 0);
-  Verify333(pthread_cond_init(&q_cond_, nullptr) == 0);
+  pthread_condattr_t attr;
+  Verify333(pthread_condattr_init(&attr) == 0);
+  Verify333(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+  Verify333(pthread_cond_init(&q_cond_, &attr) == 0);
+  Verify333(pthread_cond_init(&manager_cond_, &attr) == 0);
+  Verify333(pthread_condattr_destroy(&attr) == 0);
 
-  // Allocate the array of pthread structures.
-  thread_array_ = new pthread_t[num_threads];
+  // Allocate every slot the pool may ever use up front, so that workers
+  // can look at each other's queues without locking.
+  workers_ = new Worker[max_threads];
+  live_slots_ = new std::atomic<uint32_t>[max_threads];
+  for (uint32_t i = 0; i < max_threads; i++) {
+    workers_[i].pool = this;
+    workers_[i].index = i;
+    workers_[i].state = kSlotEmpty;
+    workers_[i].startup = false;
+    live_slots_[i].store(0, std::memory_order_relaxed);
+  }
 
-  // Spawn the threads one by one, passing them a pointer to self
-  // as the argument to the thread start routine.
+  // Spawn the first min_threads workers, then wait at the barrier until
+  // all of them are born and initialized.
+  Verify333(pthread_barrier_init(&start_barrier_, nullptr,
+                                 min_threads + 1) == 0);
   Verify333(pthread_mutex_lock(&q_lock_) == 0);
-  for (uint32_t i = 0; i < num_threads; i++) {
-    Verify333(pthread_create(&(thread_array_[i]),
-                             nullptr,
-                             &ThreadLoop,
-                             static_cast<void*>(this)) == 0);
+  for (uint32_t i = 0; i < min_threads; i++) {
+    Verify333(StartWorker(true));
   }
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  int res = pthread_barrier_wait(&start_barrier_);
+  Verify333(res == 0 || res == PTHREAD_BARRIER_SERIAL_THREAD);
+  Verify333(pthread_barrier_destroy(&start_barrier_) == 0);
 
-  // Wait for all of the threads to be born and initialized.
-  while (num_threads_running_ != num_threads) {
-    Verify333(pthread_mutex_unlock(&q_lock_) == 0);
-    sleep(1);  // give another thread the chance to acquire the lock
-    Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  // An elastic pool needs a manager to grow it.
+  if (min_threads < max_threads) {
+    has_manager_ = true;
+    Verify333(pthread_create(&manager_, nullptr, &ManagerLoop,
+                             static_cast<void*>(this)) == 0);
   }
-  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
 
   // Done!  The thread pool is ready, and all of the worker threads
-  // are initialized and waiting on q_cond_ to be notified of available
-  // work.
+  // are initialized and looking for work.
 }
 
 ThreadPool:: ~ThreadPool() {
+  // Tell all of the worker threads (and the manager) to terminate, and
+  // wake up any that are asleep so they notice.
   Verify333(pthread_mutex_lock(&q_lock_) == 0);
-  uint32_t num_threads = num_threads_running_;
-
-  // Tell all of the worker threads to terminate.
   terminate_threads_ = true;
+  Verify333(pthread_cond_broadcast(&q_cond_) == 0);
+  Verify333(pthread_cond_signal(&manager_cond_) == 0);
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
 
-  // Join with the running threads 1-by-1 until they have all died.
-  for (uint32_t i = 0; i < num_threads; i++) {
-    // Use a sledgehammer and broadcast every loop iteration, just to
-    // be extra-certain that worker threads wake up and see the terminate flag.
-    Verify333(pthread_cond_broadcast(&q_cond_) == 0);
-    Verify333(pthread_mutex_unlock(&q_lock_) == 0);
-    Verify333(pthread_join(thread_array_[i], nullptr) == 0);
-    Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  // Join with the manager first, so that no new workers start, then with
+  // the workers (including retired ones) 1-by-1 until they have all died.
+  if (has_manager_) {
+    Verify333(pthread_join(manager_, nullptr) == 0);
   }
-
-  // All of the worker threads are dead, so clean up the thread
-  // structures.
-  Verify333(num_threads_running_ == 0);
-  if (thread_array_ != nullptr) {
-    delete[] thread_array_;
+  for (uint32_t i = 0; i < max_threads_; i++) {
+    if (workers_[i].state != kSlotEmpty) {
+      Verify333(pthread_join(workers_[i].thread, nullptr) == 0);
+    }
   }
-  thread_array_ = nullptr;
-  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  Verify333(num_threads_running_ == 0);
 
-  // Empty the task queue, serially issuing any remaining work.
+  // Empty the task queues, serially issuing any remaining work.
+  for (uint32_t i = 0; i < max_threads_; i++) {
+    Task* nextTask;
+    while ((nextTask = workers_[i].queue.Pop()) != nullptr) {
+      nextTask->func_(nextTask);
+    }
+  }
   while (!work_queue_.empty()) {
     Task* nextTask = work_queue_.front();
     work_queue_.pop_front();
     nextTask->func_(nextTask);
   }
+
+  // All of the worker threads are dead, so clean up the worker
+  // structures.
+  delete[] workers_;
+  workers_ = nullptr;
+  delete[] live_slots_;
+  live_slots_ = nullptr;
+  Verify333(pthread_cond_destroy(&manager_cond_) == 0);
+  Verify333(pthread_cond_destroy(&q_cond_) == 0);
+  Verify333(pthread_mutex_destroy(&q_lock_) == 0);
 }
 
 // Enqueue a Task for dispatch.
 void ThreadPool::Dispatch(Task* t) {
-  Verify333(pthread_mutex_lock(&q_lock_) == 0);
   Verify333(terminate_threads_ == false);
+  Enqueue(t);
+  WakeWorkers(1);
+}
+
+// Enqueue a batch of Tasks for dispatch.
+void ThreadPool::Dispatch(Task* const* tasks, uint32_t num_tasks) {
+  Verify333(terminate_threads_ == false);
+  for (uint32_t i = 0; i < num_tasks; i++) {
+    Enqueue(tasks[i]);
+  }
+  WakeWorkers(num_tasks);
+}
+
+// Enqueue a Task for dispatch, unless too many are waiting already.
+bool ThreadPool::TryDispatch(Task* t) {
+  uint32_t limit = high_water_mark_.load(std::memory_order_relaxed);
+  if (limit != 0 && num_pending_.load(std::memory_order_relaxed) >= limit)
+    return false;
+  Dispatch(t);
+  return true;
+}
+
+// Enqueue as many of a batch of Tasks as fit under the high-water mark.
+uint32_t ThreadPool::TryDispatch(Task* const* tasks, uint32_t num_tasks) {
+  uint32_t limit = high_water_mark_.load(std::memory_order_relaxed);
+  if (limit != 0) {
+    uint32_t pending = num_pending_.load(std::memory_order_relaxed);
+    uint32_t room = (pending < limit) ? limit - pending : 0;
+    if (num_tasks > room) {
+      num_tasks = room;
+    }
+  }
+  if (num_tasks > 0) {
+    Dispatch(tasks, num_tasks);
+  }
+  return num_tasks;
+}
+
+bool ThreadPool::StartWorker(bool startup) {
+  for (uint32_t i = 0; i < max_threads_; i++) {
+    Worker* w = &workers_[i];
+    if (w->state == kSlotRunning)
+      continue;
+    if (w->state == kSlotRetired) {
+      // The old thread has already let go of q_lock_ for good, so this
+      // can't deadlock.
+      Verify333(pthread_join(w->thread, nullptr) == 0);
+    }
+    w->state = kSlotRunning;
+    w->startup = startup;
+    // Publish the slot before counting it, so that Enqueue() never picks
+    // an entry of live_slots_ that hasn't been filled in.
+    live_slots_[num_active_.load()].store(i, std::memory_order_relaxed);
+    num_active_.fetch_add(1);
+    Verify333(pthread_create(&(w->thread),
+                             nullptr,
+                             &ThreadLoop,
+                             static_cast<void*>(w)) == 0);
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::Enqueue(Task* t) {
+  // A worker dispatching more work keeps it local; everybody else
+  // spreads their tasks round-robin across the workers that are running
+  // now.  (A slot with no thread would only be drained by stealing.)
+  // Should the next queue be full, try the next live ones.
+  uint32_t live = num_active_.load();
+  uint32_t next = (tls_pool == this) ? 0 :
+                  next_queue_.fetch_add(1, std::memory_order_relaxed);
+
+  // Stamp and count the task before it becomes visible, so that a worker
+  // can't take it (and uncount it) first.
+  t->enqueue_ns_ = NowNs();
+  num_pending_.fetch_add(1);
+
+  // Try a few queues before falling back to the (locked) overflow queue.
+  for (uint32_t i = 0; i < live && i < 4; i++) {
+    uint32_t slot = (i == 0 && tls_pool == this) ? tls_worker :
+                    live_slots_[(next + i) % live].load(
+                        std::memory_order_relaxed);
+    if (workers_[slot].queue.Push(t))
+      return;
+  }
+  Verify333(pthread_mutex_lock(&q_lock_) == 0);
   work_queue_.push_back(t);
-  Verify333(pthread_cond_signal(&q_cond_) == 0);
+  overflow_len_.fetch_add(1);
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+}
+
+void ThreadPool::WakeWorkers(uint32_t num_tasks) {
+  // Pairs with the fence in ThreadLoop(): either a worker going to sleep
+  // sees the task we just queued, or we see that it is going to sleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_sleeping_.load(std::memory_order_relaxed) == 0)
+    return;
+
+  Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  if (num_tasks == 1) {
+    Verify333(pthread_cond_signal(&q_cond_) == 0);
+  } else {
+    Verify333(pthread_cond_broadcast(&q_cond_) == 0);
+  }
   Verify333(pthread_mutex_unlock(&q_lock_) == 0);
 }
 
+ThreadPool::Task* ThreadPool::FindTask(uint32_t self) {
+  Task* t = workers_[self].queue.Pop();
+
+  // Our queue is empty, so steal from the others.  That includes the
+  // queues of slots with no thread right now.
+  for (uint32_t i = 1; i < max_threads_ && t == nullptr; i++) {
+    t = workers_[(self + i) % max_threads_].queue.Pop();
+  }
+
+  if (t == nullptr && overflow_len_.load() != 0) {
+    Verify333(pthread_mutex_lock(&q_lock_) == 0);
+    if (!work_queue_.empty()) {
+      t = work_queue_.front();
+      work_queue_.pop_front();
+      overflow_len_.fetch_sub(1);
+    }
+    Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  }
+
+  if (t != nullptr) {
+    num_pending_.fetch_sub(1);
+    t->queue_wait_ns_ = NowNs() - t->enqueue_ns_;
+  }
+  return t;
+}
+
 // This is the main loop that all worker threads are born into.  They
-// wait for a signal on the work queue condition variable, then they
-// grab work off the queue.  Threads return (i.e., terminate)
-// when they notice that terminate_threads_ is true.
-void* ThreadLoop(void* t_pool) {
-  ThreadPool* pool = static_cast<ThreadPool*>(t_pool);
-
-  // Grab the lock, increment the thread count so that the ThreadPool
-  // constructor knows this new thread is alive.
+// look for work in their own queue and then everybody else's, and go to
+// sleep on q_cond_ when there is none.  Threads return (i.e., terminate)
+// when they notice that terminate_threads_ is true, or when they retire
+// from an elastic pool after sitting idle for too long.
+void* ThreadPool::ThreadLoop(void* arg) {
+  Worker* self = static_cast<Worker*>(arg);
+  ThreadPool* pool = self->pool;
+  tls_pool = pool;
+  tls_worker = self->index;
+  bool elastic = (pool->min_threads_ < pool->max_threads_);
+
+  // Grab the lock, increment the thread count, and (if the constructor
+  // is waiting for us) tell the constructor this new thread is alive.
   Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
   pool->num_threads_running_++;
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+  if (self->startup) {
+    int res = pthread_barrier_wait(&(pool->start_barrier_));
+    Verify333(res == 0 || res == PTHREAD_BARRIER_SERIAL_THREAD);
+  }
 
   // This is our main thread work loop.
+  int idle_rounds = 0;
   while (pool->terminate_threads_ == false) {
-    // Wait to be signaled that something has happened.
-    Verify333(pthread_cond_wait(&(pool->q_cond_), &(pool->q_lock_)) == 0);
+    ThreadPool::Task* nextTask = pool->FindTask(self->index);
+    if (nextTask != nullptr) {
+      // We picked up a Task, so invoke the task function, then go look
+      // for the next one.
+      idle_rounds = 0;
+      pool->num_busy_.fetch_add(1);
+      nextTask->func_(nextTask);
+      pool->num_busy_.fetch_sub(1);
+      continue;
+    }
 
-    // Keep trying to dequeue work until the work queue is empty.
-    while (!pool->work_queue_.empty() && (pool->terminate_threads_ == false)) {
-      ThreadPool::Task* nextTask = pool->work_queue_.front();
-      pool->work_queue_.pop_front();
+    // Nothing to do.  Spin for a little while, since more work often
+    // shows up right away, then go to sleep.
+    if (++idle_rounds < kSpinRounds) {
+      CpuRelax();
+      continue;
+    }
+    idle_rounds = 0;
 
-      // We picked up a Task, so invoke the task function with the
-      // lock released, then check so see if more tasks are waiting to
-      // be picked up.
+    Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+    pool->num_sleeping_.fetch_add(1);
+    // Pairs with the fence in WakeWorkers(); look one last time, now that
+    // any Dispatch() from here on is sure to see us asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool has_work = (pool->overflow_len_.load() != 0);
+    for (uint32_t i = 0; i < pool->max_threads_ && !has_work; i++) {
+      has_work = !pool->workers_[i].queue.Empty();
+    }
+    bool retire = false;
+    if (!has_work && pool->terminate_threads_ == false) {
+      if (!elastic) {
+        Verify333(pthread_cond_wait(&(pool->q_cond_),
+                                    &(pool->q_lock_)) == 0);
+      } else {
+        struct timespec deadline = DeadlineAfterMs(kRetireIdleMs);
+        int res = pthread_cond_timedwait(&(pool->q_cond_), &(pool->q_lock_),
+                                         &deadline);
+        Verify333(res == 0 || res == ETIMEDOUT);
+        // Our own queue may have picked up work meanwhile; the others'
+        // queues can be stolen from by whoever is left.
+        retire = (res == ETIMEDOUT && pool->terminate_threads_ == false &&
+                  pool->num_active_.load() > pool->min_threads_ &&
+                  self->queue.Empty());
+      }
+    }
+    pool->num_sleeping_.fetch_sub(1);
+    if (retire) {
+      // Move the last live slot into our place before uncounting it.
+      uint32_t active = pool->num_active_.load();
+      for (uint32_t i = 0; i < active; i++) {
+        if (pool->live_slots_[i].load() == self->index) {
+          pool->live_slots_[i].store(pool->live_slots_[active - 1].load());
+          break;
+        }
+      }
+      pool->num_active_.fetch_sub(1);
+      pool->num_threads_running_--;
+      self->state = kSlotRetired;
       Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
-      nextTask->func_(nextTask);
-      Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+      return nullptr;
     }
+    Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
   }
 
   // All done, exit.
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
   pool->num_threads_running_--;
   Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
   return nullptr;
 }
 
+// The manager of an elastic pool wakes up every kManageIntervalMs.  If
+// tasks have been waiting while every worker was busy (or blocked) in a
+// task for kGrowChecks checks in a row, it adds workers: one per waiting
+// task, but never more than doubling the pool at once.  Shrinking is up
+// to the workers themselves; see ThreadLoop().
+void* ThreadPool::ManagerLoop(void* arg) {
+  ThreadPool* pool = static_cast<ThreadPool*>(arg);
+  int saturated_checks = 0;
+
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  while (pool->terminate_threads_ == false) {
+    struct timespec deadline = DeadlineAfterMs(kManageIntervalMs);
+    int res = pthread_cond_timedwait(&(pool->manager_cond_),
+                                     &(pool->q_lock_), &deadline);
+    Verify333(res == 0 || res == ETIMEDOUT);
+    if (pool->terminate_threads_)
+      break;
+
+    uint32_t active = pool->num_active_.load();
+    uint32_t pending = pool->num_pending_.load();
+    if (pending == 0 || pool->num_busy_.load() < active) {
+      saturated_checks = 0;
+      continue;
+    }
+    if (++saturated_checks < kGrowChecks)
+      continue;
+    saturated_checks = 0;
+
+    uint32_t grow = (pending < active) ? pending : active;
+    for (uint32_t i = 0; i < grow; i++) {
+      if (!pool->StartWorker(false))
+        break;
+    }
+  }
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+  return nullptr;
+}
+
 }  // namespace hw4
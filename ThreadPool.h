@@ -17,6 +17,8 @@ extern "C" {
 }
 
 #include <stdint.h>   // for uint32_t, etc.
+#include <stddef.h>   // for size_t
+#include <atomic>     // for std::atomic
 #include <list>       // for std::list
 
 namespace hw4 {
@@ -28,6 +30,18 @@ namespace hw4 {
 // pointer in the task to process it.  When it is done processing the
 // task, the thread returns to the pool to receive and process the next
 // available task.
+//
+// Each worker has its own bounded, lock-free task queue.  Dispatch()
+// spreads tasks across the queues without taking a lock, and a worker
+// whose queue runs dry steals from the others.  An idle worker spins
+// briefly before going to sleep, and Dispatch() only takes a lock to
+// wake a worker when some worker is actually asleep.
+//
+// A pool can also be elastic, running anywhere between a minimum and a
+// maximum number of workers.  A manager thread adds workers when tasks
+// are piling up while the existing workers are busy (or blocked) in
+// their tasks, and workers that sit idle for a while retire until only
+// the minimum is left.
 class ThreadPool {
  public:
   // Construct a new ThreadPool with a certain number of worker
@@ -35,8 +49,25 @@ class ThreadPool {
   //
   //  - num_threads:  the number of threads in the pool.
   explicit ThreadPool(uint32_t num_threads);
+
+  // Construct an elastic ThreadPool that starts with "min_threads"
+  // worker threads and grows to at most "max_threads" under load.
+  ThreadPool(uint32_t min_threads, uint32_t max_threads);
+
   virtual ~ThreadPool();
 
+  // Returns the number of worker threads currently in the pool.
+  uint32_t num_threads() const { return num_active_.load(); }
+
+  // Returns the number of Tasks waiting for a worker.
+  uint32_t num_queued() const { return num_pending_.load(); }
+
+  // Set the most Tasks that TryDispatch() lets wait for a worker at
+  // once.  0 (the default) means no limit.
+  void set_high_water_mark(uint32_t num_tasks) {
+    high_water_mark_ = num_tasks;
+  }
+
   // This inner class defines what a Task is.  A worker thread will
   // pull a task off the task queue and invoke the thread_task_fn
   // function pointer inside of it, passing it the Task* itself as an
@@ -50,22 +81,49 @@ class ThreadPool {
    public:
     // "f" is the task function that a worker thread should invoke to
     // process the task.
-    explicit Task(thread_task_fn func) : func_(func) { }
+    explicit Task(thread_task_fn func)
+      : func_(func), enqueue_ns_(0), queue_wait_ns_(0) { }
+
+    // How long (in nanoseconds) the task waited in the queue before a
+    // worker picked it up.  Valid once the task function is running.
+    uint64_t queue_wait_ns() const { return queue_wait_ns_; }
 
     // The dispatch function.
     thread_task_fn func_;
+
+   private:
+    friend class ThreadPool;
+
+    // When the task was queued (CLOCK_MONOTONIC), and how long it waited.
+    uint64_t enqueue_ns_;
+    uint64_t queue_wait_ns_;
   };
 
   // Customers use Dispatch() to enqueue a Task for dispatch to a
   // worker thread.
   void Dispatch(Task* t);
 
-  // A lock and condition variable that worker threads and the
-  // Dispatch function use to guard the Task queue.
+  // Enqueue "num_tasks" Tasks at once.  This is cheaper than calling
+  // Dispatch() on each of them, since sleeping workers are woken up
+  // once for the whole batch.
+  void Dispatch(Task* const* tasks, uint32_t num_tasks);
+
+  // Like Dispatch(), but refuses the Task (and returns false) if the
+  // high-water mark's worth of Tasks are already waiting.  The caller
+  // still owns a refused Task.
+  bool TryDispatch(Task* t);
+
+  // The batch version of TryDispatch().  Enqueues the first Tasks of
+  // "tasks", up to the high-water mark, and returns how many it took.
+  uint32_t TryDispatch(Task* const* tasks, uint32_t num_tasks);
+
+  // A lock and condition variable that idle worker threads sleep on.
+  // q_lock_ also guards work_queue_.
   pthread_mutex_t q_lock_;
   pthread_cond_t  q_cond_;
 
-  // The queue of Tasks waiting to be dispatched to a worker thread.
+  // The overflow queue for Tasks that didn't fit in any worker's own
+  // queue.  Normally empty.
   std::list<Task*> work_queue_;
 
   // This should be set to "true" when it is time for the worker
@@ -73,16 +131,122 @@ class ThreadPool {
   // destroyed.  A worker thread will check this variable before
   // picking up its next piece of work; if it is true, the worker
   // threads will terminate.
-  bool terminate_threads_;
+  std::atomic<bool> terminate_threads_;
 
   // This variable stores how many threads are currently running.  As
   // worker threads are born, they increment it, and as worker threads
-  // terminate, they decrement it.
+  // terminate (or retire), they decrement it.  Guarded by q_lock_.
   uint32_t num_threads_running_;
 
  private:
-  // The pthreads pthread_t structures representing each thread.
-  pthread_t* thread_array_;
+  // A bounded, lock-free, multi-producer multi-consumer FIFO of Tasks
+  // (Dmitry Vyukov's array-based queue).  Each slot carries a sequence
+  // number that tells producers and consumers whose turn it is.
+  class TaskQueue {
+   public:
+    TaskQueue();
+    ~TaskQueue();
+
+    // Returns false if the queue is full.
+    bool Push(Task* t);
+
+    // Returns nullptr if the queue is empty.
+    Task* Pop();
+
+    // A snapshot; may be stale by the time the caller looks at it.
+    bool Empty() const;
+
+   private:
+    struct Slot {
+      std::atomic<size_t> seq;
+      Task* task;
+    };
+
+    Slot* slots_;
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+  };
+
+  // The states of a worker slot.
+  enum SlotState {
+    kSlotEmpty,    // no thread
+    kSlotRunning,  // a live worker thread
+    kSlotRetired,  // the thread has exited but hasn't been joined yet
+  };
+
+  // One worker slot: a thread and its queue.  Every slot has a queue,
+  // even when it has no thread; the other workers steal from it.
+  struct Worker {
+    ThreadPool* pool;
+    uint32_t index;
+    pthread_t thread;
+    SlotState state;  // guarded by q_lock_
+    bool startup;     // meets the constructor at start_barrier_
+    TaskQueue queue;
+  };
+
+  // This is the thread start routine, i.e., the function that threads
+  // are born into.  "arg" is the thread's Worker.
+  static void* ThreadLoop(void* arg);
+
+  // The start routine of the manager thread of an elastic pool.
+  static void* ManagerLoop(void* arg);
+
+  // Start a worker thread in an empty or retired slot.  Must be called
+  // with q_lock_ held.  Returns false if every slot is running.
+  bool StartWorker(bool startup);
+
+  // Put one Task on some worker's queue (or the overflow queue) without
+  // waking anybody up.
+  void Enqueue(Task* t);
+
+  // Find a Task for worker "self": first its own queue, then the other
+  // workers' queues, then the overflow queue.  Returns nullptr if there
+  // is no work anywhere.
+  Task* FindTask(uint32_t self);
+
+  // Wake up to "num_tasks" sleeping workers, if any are asleep.
+  void WakeWorkers(uint32_t num_tasks);
+
+  // The worker slots; max_threads_ of them, of which num_active_ have a
+  // running thread.  The first num_active_ entries of live_slots_ are
+  // the indices of those slots, in no particular order.  Both change
+  // under q_lock_, but Enqueue() reads them without it.
+  uint32_t min_threads_;
+  uint32_t max_threads_;
+  Worker* workers_;
+  std::atomic<uint32_t> num_active_;
+  std::atomic<uint32_t>* live_slots_;
+
+  // The constructor and its first min_threads_ workers meet here once
+  // the workers are up and running.
+  pthread_barrier_t start_barrier_;
+
+  // The manager thread of an elastic pool, and the condition variable
+  // (used with q_lock_) that it sleeps on between checks.
+  bool has_manager_;
+  pthread_t manager_;
+  pthread_cond_t manager_cond_;
+
+  // How many Tasks are queued, and how many workers are inside a task
+  // function (running or blocked).  The manager uses these to decide
+  // when to grow the pool.
+  std::atomic<uint32_t> num_pending_;
+  std::atomic<uint32_t> num_busy_;
+
+  // See set_high_water_mark().
+  std::atomic<uint32_t> high_water_mark_;
+
+  // Where the next Dispatch() from outside the pool starts looking, as
+  // an index into live_slots_.
+  std::atomic<uint32_t> next_queue_;
+
+  // How many Tasks are in work_queue_, so that workers can skip the lock
+  // when it is empty.
+  std::atomic<uint32_t> overflow_len_;
+
+  // How many workers are asleep (or about to be) on q_cond_.
+  std::atomic<uint32_t> num_sleeping_;
 };
 
 }  // namespace hw4
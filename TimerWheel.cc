@@ -0,0 +1,92 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <iterator>
+#include <vector>
+
+#include "./TimerWheel.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::vector;
+
+namespace hw4 {
+
+TimerWheel::TimerWheel(uint32_t num_slots, uint32_t tick_ms, uint64_t now_ms)
+  : num_slots_(num_slots), tick_ms_(tick_ms), slots_(num_slots),
+    current_tick_(now_ms / tick_ms) {
+  Verify333(num_slots > 0 && tick_ms > 0);
+}
+
+void TimerWheel::Schedule(uint64_t key, uint64_t deadline_ms) {
+  // A deadline in a tick we've already processed goes in the next one.
+  uint64_t tick = TickOf(deadline_ms);
+  if (tick <= current_tick_) {
+    tick = current_tick_ + 1;
+  }
+  uint32_t slot = tick % num_slots_;
+
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    Location& loc = it->second;
+    if (loc.slot == slot) {
+      loc.pos->deadline_ms = deadline_ms;
+      return;
+    }
+    // Move the timer over without reallocating it.
+    slots_[slot].splice(slots_[slot].end(), slots_[loc.slot], loc.pos);
+    loc.slot = slot;
+    loc.pos->deadline_ms = deadline_ms;
+    return;
+  }
+
+  slots_[slot].push_back(Timer{key, deadline_ms});
+  index_[key] = Location{slot, std::prev(slots_[slot].end())};
+}
+
+void TimerWheel::Cancel(uint64_t key) {
+  auto it = index_.find(key);
+  if (it == index_.end())
+    return;
+  slots_[it->second.slot].erase(it->second.pos);
+  index_.erase(it);
+}
+
+void TimerWheel::Expire(uint64_t now_ms, vector<uint64_t>* const expired) {
+  uint64_t now_tick = now_ms / tick_ms_;
+  if (now_tick <= current_tick_)
+    return;
+
+  // Visit each slot whose tick has come up since the last call, but
+  // never more than once around the wheel.
+  uint64_t num_ticks = now_tick - current_tick_;
+  if (num_ticks > num_slots_) {
+    num_ticks = num_slots_;
+  }
+  for (uint64_t i = 1; i <= num_ticks; i++) {
+    Slot& slot = slots_[(now_tick - num_ticks + i) % num_slots_];
+    for (auto it = slot.begin(); it != slot.end(); ) {
+      // Timers due on a later turn of the wheel stay where they are.
+      if (TickOf(it->deadline_ms) > now_tick) {
+        ++it;
+        continue;
+      }
+      expired->push_back(it->key);
+      index_.erase(it->key);
+      it = slot.erase(it);
+    }
+  }
+  current_tick_ = now_tick;
+}
+
+}  // namespace hw4
@@ -0,0 +1,87 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_TIMERWHEEL_H_
+#define HW4_TIMERWHEEL_H_
+
+#include <stdint.h>   // for uint32_t, etc.
+#include <list>       // for std::list
+#include <unordered_map>
+#include <vector>
+
+namespace hw4 {
+
+// A TimerWheel keeps one deadline per key (e.g., per connection) and
+// reports the keys whose deadlines have passed.  It is a hashed timing
+// wheel: time is cut into ticks, and each deadline goes into the slot
+// its tick hashes to, so that scheduling, rescheduling and cancelling
+// are all O(1) no matter how many timers there are.  A deadline more
+// than one turn of the wheel away simply stays put for extra turns.
+//
+// Times are in milliseconds on any clock that doesn't go backwards (the
+// callers use CLOCK_MONOTONIC).  Deadlines fire up to one tick late.
+// A TimerWheel is not thread-safe.
+class TimerWheel {
+ public:
+  // Construct a wheel of "num_slots" slots, each "tick_ms" long, whose
+  // time starts at "now_ms".
+  TimerWheel(uint32_t num_slots, uint32_t tick_ms, uint64_t now_ms);
+  virtual ~TimerWheel() { }
+
+  // Set the deadline of "key" to "deadline_ms", replacing any deadline
+  // it already had.
+  void Schedule(uint64_t key, uint64_t deadline_ms);
+
+  // Forget the deadline of "key", if it has one.
+  void Cancel(uint64_t key);
+
+  // Advance the wheel to "now_ms", appending the keys whose deadlines
+  // have passed to "expired" and forgetting their deadlines.
+  void Expire(uint64_t now_ms, std::vector<uint64_t>* const expired);
+
+  // Returns how long to wait (e.g., in epoll_wait()) before calling
+  // Expire() again: a tick if there are any timers, or -1 if none.
+  int timeout_ms() const { return index_.empty() ? -1 : tick_ms_; }
+
+  // Returns the number of keys with a deadline.
+  uint32_t size() const { return index_.size(); }
+
+ private:
+  struct Timer {
+    uint64_t key;
+    uint64_t deadline_ms;
+  };
+  typedef std::list<Timer> Slot;
+
+  // Where a key's timer lives.
+  struct Location {
+    uint32_t slot;
+    Slot::iterator pos;
+  };
+
+  // The first tick that starts at or after "ms", so that timers never
+  // fire early.
+  uint64_t TickOf(uint64_t ms) const {
+    return (ms + tick_ms_ - 1) / tick_ms_;
+  }
+
+  uint32_t num_slots_;
+  uint32_t tick_ms_;
+  std::vector<Slot> slots_;
+  std::unordered_map<uint64_t, Location> index_;
+
+  // The last tick that Expire() has processed.
+  uint64_t current_tick_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_TIMERWHEEL_H_
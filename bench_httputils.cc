@@ -0,0 +1,166 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// A small benchmark for the string routines in HttpUtils that run on
+// every request and every rendered result.  It times them against the
+// straightforward implementations they replaced, on inputs shaped like
+// what the server actually sees: query strings, document names and
+// search terms, most of which have nothing to escape or decode.
+//
+// Usage: ./bench_httputils [iterations]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include <string>
+#include <vector>
+
+#include "./HttpUtils.h"
+
+using std::string;
+using std::vector;
+
+// The five-pass version of hw4::EscapeHtml().
+static string ReferenceEscapeHtml(const string& from) {
+  string ret = from;
+  boost::replace_all(ret, "&", "&amp;");
+  boost::replace_all(ret, "\"", "&quot;");
+  boost::replace_all(ret, "\'", "&apos;");
+  boost::replace_all(ret, "<", "&lt;");
+  boost::replace_all(ret, ">", "&gt;");
+  return ret;
+}
+
+// The character-at-a-time version of hw4::URIDecode().
+static string ReferenceURIDecode(const string& from) {
+  string retstr;
+  for (unsigned int pos = 0; pos < from.length(); pos++) {
+    char c1 = from[pos];
+    char c2 = (pos+1 < from.length()) ? toupper(from[pos+1]) : ' ';
+    char c3 = (pos+2 < from.length()) ? toupper(from[pos+2]) : ' ';
+    if (c1 == '+') {
+      retstr.append(1, ' ');
+      continue;
+    }
+    if (c1 != '%') {
+      retstr.append(1, c1);
+      continue;
+    }
+    if (!((('0' <= c2) && (c2 <= '9')) || (('A' <= c2) && (c2 <= 'F')))) {
+      retstr.append(1, c1);
+      continue;
+    }
+    if (!((('0' <= c3) && (c3 <= '9')) || (('A' <= c3) && (c3 <= 'F')))) {
+      retstr.append(1, c1);
+      continue;
+    }
+    uint8_t code = 16 * ((c2 >= 'A') ? 10 + (c2 - 'A') : (c2 - '0'));
+    code += (c3 >= 'A') ? 10 + (c3 - 'A') : (c3 - '0');
+    if (!((code >= 32) && (code <= 127))) {
+      retstr.append(1, c1);
+      continue;
+    }
+    retstr.append(1, static_cast<char>(code));
+    pos += 2;
+  }
+  return retstr;
+}
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs "fn" over every input "iterations" times, and returns the
+// average number of nanoseconds per call.
+template <typename Fn>
+static double TimeCalls(Fn fn, const vector<string>& inputs,
+                        int iterations, size_t* sink) {
+  double start = NowSeconds();
+  for (int i = 0; i < iterations; i++) {
+    for (const string& in : inputs) {
+      *sink += fn(in).size();
+    }
+  }
+  double elapsed = NowSeconds() - start;
+  return elapsed * 1e9 / (static_cast<double>(iterations) * inputs.size());
+}
+
+template <typename Fn, typename RefFn>
+static bool Compare(const char* name, Fn fn, RefFn ref,
+                    const vector<string>& inputs, int iterations) {
+  for (const string& in : inputs) {
+    if (fn(in) != ref(in)) {
+      fprintf(stderr, "%s: mismatch on \"%s\"\n", name, in.c_str());
+      return false;
+    }
+  }
+  size_t sink = 0;
+  double old_ns = TimeCalls(ref, inputs, iterations, &sink);
+  double new_ns = TimeCalls(fn, inputs, iterations, &sink);
+  printf("%-22s %9.1f ns/call -> %7.1f ns/call  (%.1fx)  [%zu]\n",
+         name, old_ns, new_ns, old_ns / new_ns, sink % 10);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int iterations = (argc > 1) ? atoi(argv[1]) : 20000;
+  if (iterations <= 0) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Document names, as rendered into result links.
+  vector<string> names = {
+    "test_tree/bash-4.2/support/man2html.c",
+    "test_tree/books/artofwar.txt",
+    "test_tree/enron_email/7.txt",
+    "test_tree/tiny/home-on-the-range.txt",
+    "http://www.cs.washington.edu/education/courses/cse333/",
+    "test_tree/books/ulysses.txt",
+  };
+  // Search terms, echoed back on the results page.
+  vector<string> terms = {
+    "home", "the range", "deer & antelope", "\"where seldom\"",
+    "discouraging word", "a <b>bold</b> query",
+  };
+  // Request URIs and query strings, before decoding.
+  vector<string> uris = {
+    "/static/test_tree/books/artofwar.txt",
+    "/query?terms=home+on+the+range",
+    "terms=deer%20%26%20antelope",
+    "/static/test_tree/bash-4.2/support/man2html.c",
+    "/query?terms=%22where+seldom%22+is+heard",
+    "/static/test_tree/tiny/home-on-the-range.txt",
+  };
+  // A long, mostly clean string, like a large result page fragment.
+  string page;
+  for (int i = 0; i < 64; i++) {
+    page += "<li>" + names[i % names.size()] + "</li>";
+  }
+
+  bool ok = true;
+  ok &= Compare("EscapeHtml(names)", hw4::EscapeHtml, ReferenceEscapeHtml,
+                names, iterations);
+  ok &= Compare("EscapeHtml(terms)", hw4::EscapeHtml, ReferenceEscapeHtml,
+                terms, iterations);
+  ok &= Compare("EscapeHtml(page)", hw4::EscapeHtml, ReferenceEscapeHtml,
+                {page}, iterations / 10 + 1);
+  ok &= Compare("URIDecode(uris)", hw4::URIDecode, ReferenceURIDecode,
+                uris, iterations);
+  ok &= Compare("URIDecode(names)", hw4::URIDecode, ReferenceURIDecode,
+                names, iterations);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
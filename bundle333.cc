@@ -0,0 +1,48 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "./HttpServer.h"
+#include "./StaticBundle.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+// Packs a directory of static files into a bundle for
+// "http333d --bundle=PATH" to serve (see StaticBundle.h).  Compressed
+// copies are made of the same files the server would precompress.
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " staticfiles_directory bundle_file"
+         << endl;
+    return EXIT_FAILURE;
+  }
+
+  hw4::HttpServerOptions options;
+  if (!hw4::StaticBundle::Build(argv[1], argv[2],
+                                options.compression_min_bytes)) {
+    cerr << "Couldn't bundle " << argv[1] << " into " << argv[2] << endl;
+    return EXIT_FAILURE;
+  }
+
+  hw4::StaticBundle bundle;
+  if (!bundle.Open(argv[2])) {
+    cerr << "Couldn't open the new bundle " << argv[2] << endl;
+    return EXIT_FAILURE;
+  }
+  cout << "bundled " << bundle.num_files() << " file(s) into " << argv[2]
+       << endl;
+  return EXIT_SUCCESS;
+}
@@ -18,8 +18,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <stdint.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <list>
 
@@ -54,6 +57,20 @@ static void GetPortAndPath(int argc,
                     string* const path,
                     list<string>* const indices);
 
+// Parse the optional "--name=value" settings that may come before the
+// port number, and remove them from argv.
+//
+// Params:
+// - argc: number of arguments
+// - argv: array of arguments; the options are removed in place
+// - options: output parameter returning the server settings
+//
+// Returns the number of arguments left in argv.  Calls Usage() on an
+// unknown option or a malformed value.
+static int GetOptions(int argc,
+                      char** argv,
+                      hw4::HttpServerOptions* const options);
+
 int main(int argc, char** argv) {
   // Print out welcome message.
   cout << "Welcome to http333d, the UW cse333 web server!" << endl;
@@ -71,12 +88,14 @@ int main(int argc, char** argv) {
   uint16_t port_num;
   string static_dir;
   list<string> indices;
+  hw4::HttpServerOptions options;
+  argc = GetOptions(argc, argv, &options);
   GetPortAndPath(argc, argv, &port_num, &static_dir, &indices);
   cout << "    port: " << port_num << endl;
   cout << "    path: " << static_dir << endl;
 
   // Run the server.
-  hw4::HttpServer hs(port_num, static_dir, indices);
+  hw4::HttpServer hs(port_num, static_dir, indices, options);
   if (!hs.Run()) {
     cerr << "  server failed to run!?" << endl;
   }
@@ -87,11 +106,162 @@ int main(int argc, char** argv) {
 
 
 static void Usage(char* prog_name) {
-  cerr << "Usage: " << prog_name << " port staticfiles_directory indices+";
-  cerr << endl;
+  cerr << "Usage: " << prog_name
+       << " [options] port staticfiles_directory indices+" << endl;
+  cerr << "Options:" << endl;
+  cerr << "  --listeners=N       SO_REUSEPORT listeners, each with its own "
+       << "event loop (0 = one per CPU; default 1)" << endl;
+  cerr << "  --lazy-dns=0|1      resolve client names in the background "
+       << "instead of on accept (default 1)" << endl;
+  cerr << "  --min-threads=N     worker threads to start with (default 4)"
+       << endl;
+  cerr << "  --max-threads=N     most worker threads to grow to under load "
+       << "(default 100)" << endl;
+  cerr << "  --max-queued=N      requests that may wait for a worker before "
+       << "new ones get 503 (0 = no limit; default 1024)" << endl;
+  cerr << "  --idle-timeout=S    seconds a keep-alive connection may sit "
+       << "idle (0 = never time out; default 60)" << endl;
+  cerr << "  --header-timeout=S  seconds a client may take to send a "
+       << "request header (0 = never time out; default 10)" << endl;
+  cerr << "  --max-requests=N    requests per connection (0 = no limit; "
+       << "default 1000)" << endl;
+  cerr << "  --io-uring=0|1      do socket I/O through io_uring, if the "
+       << "kernel supports it (default 0)" << endl;
+  cerr << "  --compression-level=N" << endl
+       << "                      zlib level to gzip dynamic pages at "
+       << "(0 = off; default 6)" << endl;
+  cerr << "  --compression-min-bytes=N" << endl
+       << "                      smallest dynamic page to compress "
+       << "(default 1024)" << endl;
+  cerr << "  --cache-control=PREFIX:VALUE" << endl
+       << "                      send \"Cache-Control: VALUE\" with static "
+       << "files under the URI PREFIX" << endl
+       << "                      (may be repeated; the longest matching "
+       << "prefix wins)" << endl;
+  cerr << "  --content-cache-bytes=N" << endl
+       << "                      bytes of memory to cache static files "
+       << "in (0 = off; default 64MB)" << endl;
+  cerr << "  --content-cache-max-file=N" << endl
+       << "                      biggest static file to keep in memory "
+       << "(default 1MB)" << endl;
+  cerr << "  --content-cache-max-fds=N" << endl
+       << "                      bigger static files to keep open "
+       << "(default 256)" << endl;
+  cerr << "  --precompress-bytes=N" << endl
+       << "                      bytes of compressed copies of static text "
+       << "files to keep (0 = off; default 64MB)" << endl;
+  cerr << "  --stats-path=URI    serve the server's counters as plain text "
+       << "at URI (default: none)" << endl;
+  cerr << "  --bundle=PATH       serve static files from the bundle at PATH, "
+       << "built by bundle333, instead of the directory" << endl;
   exit(EXIT_FAILURE);
 }
 
+// Parse "value" as a non-negative integer, calling Usage() if it isn't one.
+static uint32_t ParseUint(char* prog_name, const char* name,
+                          const char* value) {
+  char* end;
+  errno = 0;
+  unsigned long res = strtoul(value, &end, 10);  // NOLINT(runtime/int)
+  if (errno != 0 || end == value || *end != '\0' || value[0] == '-' ||
+      res > UINT32_MAX) {
+    cerr << "Invalid value for --" << name << ": " << value << endl;
+    Usage(prog_name);
+  }
+  return static_cast<uint32_t>(res);
+}
+
+static int GetOptions(int argc,
+                      char** argv,
+                      hw4::HttpServerOptions* const options) {
+  int remaining = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      argv[remaining++] = argv[i];
+      continue;
+    }
+
+    string opt(argv[i] + 2);
+    size_t eq = opt.find('=');
+    if (eq == string::npos) {
+      cerr << "Option " << argv[i] << " needs a value." << endl;
+      Usage(argv[0]);
+    }
+    string name = opt.substr(0, eq);
+    const char* value = argv[i] + 2 + eq + 1;
+
+    if (name == "listeners") {
+      options->num_listeners = ParseUint(argv[0], "listeners", value);
+    } else if (name == "lazy-dns") {
+      options->lazy_dns = (ParseUint(argv[0], "lazy-dns", value) != 0);
+    } else if (name == "min-threads") {
+      options->min_threads = ParseUint(argv[0], "min-threads", value);
+    } else if (name == "max-threads") {
+      options->max_threads = ParseUint(argv[0], "max-threads", value);
+    } else if (name == "max-queued") {
+      options->max_queued = ParseUint(argv[0], "max-queued", value);
+    } else if (name == "idle-timeout") {
+      options->idle_timeout_secs = ParseUint(argv[0], "idle-timeout", value);
+    } else if (name == "header-timeout") {
+      options->header_timeout_secs =
+        ParseUint(argv[0], "header-timeout", value);
+    } else if (name == "io-uring") {
+      options->io_uring = (ParseUint(argv[0], "io-uring", value) != 0);
+    } else if (name == "compression-level") {
+      options->compression_level =
+        ParseUint(argv[0], "compression-level", value);
+      if (options->compression_level > 9) {
+        cerr << "Need --compression-level <= 9." << endl;
+        Usage(argv[0]);
+      }
+    } else if (name == "compression-min-bytes") {
+      options->compression_min_bytes =
+        ParseUint(argv[0], "compression-min-bytes", value);
+    } else if (name == "cache-control") {
+      const char* colon = strchr(value, ':');
+      if (colon == nullptr || colon == value || colon[1] == '\0') {
+        cerr << "Invalid value for --cache-control: " << value << endl;
+        Usage(argv[0]);
+      }
+      options->cache_control.emplace_back(string(value, colon - value),
+                                          string(colon + 1));
+    } else if (name == "content-cache-bytes") {
+      options->content_cache_bytes =
+        ParseUint(argv[0], "content-cache-bytes", value);
+    } else if (name == "content-cache-max-file") {
+      options->content_cache_max_file_bytes =
+        ParseUint(argv[0], "content-cache-max-file", value);
+    } else if (name == "content-cache-max-fds") {
+      options->content_cache_max_fds =
+        ParseUint(argv[0], "content-cache-max-fds", value);
+    } else if (name == "precompress-bytes") {
+      options->precompress_bytes =
+        ParseUint(argv[0], "precompress-bytes", value);
+    } else if (name == "stats-path") {
+      if (value[0] != '/') {
+        cerr << "Need --stats-path to start with '/'." << endl;
+        Usage(argv[0]);
+      }
+      options->stats_path = value;
+    } else if (name == "bundle") {
+      options->bundle_path = value;
+    } else if (name == "max-requests") {
+      options->max_requests_per_connection =
+        ParseUint(argv[0], "max-requests", value);
+    } else {
+      cerr << "Unknown option " << argv[i] << endl;
+      Usage(argv[0]);
+    }
+  }
+  if (options->min_threads == 0 ||
+      options->max_threads < options->min_threads) {
+    cerr << "Need 0 < --min-threads <= --max-threads." << endl;
+    Usage(argv[0]);
+  }
+  argv[remaining] = nullptr;
+  return remaining;
+}
+
 static void GetPortAndPath(int argc,
                     char** argv,
                     uint16_t* const port,
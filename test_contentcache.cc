@@ -0,0 +1,155 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./ContentCache.h"
+#include "./test_suite.h"
+#include "./test_util.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace hw4 {
+
+// Insert the file "path" into "cache" under "key", as the server does.
+static shared_ptr<const ContentCache::Entry> InsertFile(
+    ContentCache* cache, const string& key, const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return nullptr;
+  ContentCache::Entry entry;
+  entry.file = std::make_shared<const OpenFile>(fd);
+  entry.path = path;
+  if (fstat(fd, &entry.st) != 0)
+    return nullptr;
+  return cache->Insert(key, std::move(entry));
+}
+
+TEST(Test_ContentCache, TestContentCacheBasic) {
+  HW4Environment::OpenTestCase();
+  TempDir tmp("test_contentcache");
+  ASSERT_FALSE(tmp.path().empty());
+  const string& dir = tmp.path();
+  string small = dir + "/small.txt";
+  string big = dir + "/big.txt";
+  WriteFile(small, "hello, world\n");
+  WriteFile(big, string(2000, 'x'));
+
+  ContentCache cache(16 * 16 * 1024, 1000, 16);
+  ASSERT_EQ(nullptr, cache.Lookup("small.txt"));
+
+  // A small file is served from memory, with its metadata, and without
+  // holding the file open.
+  shared_ptr<const ContentCache::Entry> entry =
+    InsertFile(&cache, "small.txt", small);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_NE(nullptr, entry->contents);
+  ASSERT_EQ(nullptr, entry->file);
+  ASSERT_EQ("hello, world\n", *entry->contents);
+  ASSERT_EQ(13, entry->st.st_size);
+  ASSERT_EQ(small, entry->path);
+  entry = cache.Lookup("small.txt");
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ("hello, world\n", *entry->contents);
+
+  // A file over the per-file bound is kept open instead.
+  entry = InsertFile(&cache, "big.txt", big);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(nullptr, entry->contents);
+  ASSERT_NE(nullptr, entry->file);
+  entry = cache.Lookup("big.txt");
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(2000, entry->st.st_size);
+
+  ContentCache::Stats stats = cache.GetStats();
+  ASSERT_EQ(2U, stats.hits);
+  ASSERT_EQ(1U, stats.misses);
+  ASSERT_EQ(2U, stats.entries);
+  ASSERT_EQ(1U, stats.fds);
+  ASSERT_LT(13U, stats.bytes);
+  ASSERT_GT(2000U, stats.bytes);
+
+}
+
+TEST(Test_ContentCache, TestContentCacheEviction) {
+  HW4Environment::OpenTestCase();
+  TempDir tmp("test_contentcache");
+  ASSERT_FALSE(tmp.path().empty());
+  const string& dir = tmp.path();
+
+  // Each of the 16 shards has room for one of the small files, so
+  // caching 40 of them has to evict at least 24.
+  size_t budget = 16 * (sizeof(ContentCache::Entry) + 1000);
+  ContentCache cache(budget, 600, 16);
+  for (int i = 0; i < 40; i++) {
+    string path = dir + "/" + std::to_string(i);
+    WriteFile(path, string(600, 'a' + i % 26));
+    ASSERT_NE(nullptr, InsertFile(&cache, std::to_string(i), path));
+    unlink(path.c_str());
+  }
+  ContentCache::Stats stats = cache.GetStats();
+  ASSERT_LE(24U, stats.evictions);
+  ASSERT_EQ(40U, stats.entries + stats.evictions);
+  ASSERT_GE(budget, stats.bytes);
+
+  // Likewise, each shard may hold one of the big files open.
+  for (int i = 0; i < 40; i++) {
+    string path = dir + "/big" + std::to_string(i);
+    WriteFile(path, string(601, 'a' + i % 26));
+    ASSERT_NE(nullptr, InsertFile(&cache, "big" + std::to_string(i), path));
+    unlink(path.c_str());
+  }
+  stats = cache.GetStats();
+  ASSERT_GE(16U, stats.fds);
+  ASSERT_GE(budget, stats.bytes);
+}
+
+TEST(Test_ContentCache, TestContentCacheInvalidation) {
+  HW4Environment::OpenTestCase();
+  TempDir tmp("test_contentcache");
+  ASSERT_FALSE(tmp.path().empty());
+  const string& dir = tmp.path();
+  string path = dir + "/page.html";
+  WriteFile(path, "<p>old</p>");
+
+  ContentCache cache(16 * 16 * 1024, 1024, 16);
+  ASSERT_NE(nullptr, InsertFile(&cache, "page.html", path));
+  ASSERT_NE(nullptr, cache.Lookup("page.html"));
+
+  // Whether the change is noticed by the watcher thread or by the lookup
+  // checking the file, the old contents are never served again once it
+  // has been.
+  WriteFile(path, "<p>new and longer</p>");
+  shared_ptr<const ContentCache::Entry> entry;
+  for (int i = 0; i < 50; i++) {
+    entry = cache.Lookup("page.html");
+    if (entry == nullptr)
+      break;
+    usleep(20000);  // 0.02s
+  }
+  ASSERT_EQ(nullptr, entry);
+  ASSERT_EQ(1U, cache.GetStats().invalidations);
+
+  entry = InsertFile(&cache, "page.html", path);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ("<p>new and longer</p>", *entry->contents);
+  entry = cache.Lookup("page.html");
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ("<p>new and longer</p>", *entry->contents);
+}
+
+}  // namespace hw4
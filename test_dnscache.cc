@@ -0,0 +1,54 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <unistd.h>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./DnsCache.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace hw4 {
+
+TEST(Test_DnsCache, TestDnsCacheBasic) {
+  HW4Environment::OpenTestCase();
+  DnsCache cache(2, 60);
+
+  // A miss never waits for the resolver: it returns the numeric
+  // address right away.
+  ASSERT_EQ("127.0.0.1", cache.Lookup("127.0.0.1"));
+  ASSERT_EQ(1U, cache.size());
+
+  // The background thread eventually fills in an answer.  Whether or not
+  // the address has a DNS name here, the lookup never comes back empty.
+  string name;
+  for (int i = 0; i < 50; i++) {
+    name = cache.Lookup("127.0.0.1");
+    if (name != "127.0.0.1")
+      break;
+    usleep(100000);  // 0.1s
+  }
+  ASSERT_FALSE(name.empty());
+
+  // Something that isn't a numeric address can't be resolved, and comes
+  // back unchanged.
+  ASSERT_EQ("not-an-address", cache.Lookup("not-an-address"));
+
+  // The cache never grows past its bound.
+  cache.Lookup("10.0.0.1");
+  cache.Lookup("10.0.0.2");
+  cache.Lookup("10.0.0.3");
+  ASSERT_GE(2U, cache.size());
+}
+
+}  // namespace hw4
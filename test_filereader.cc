@@ -9,6 +9,10 @@
  * author.
  */
 
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "./FileReader.h"
 
 #include "gtest/gtest.h"
@@ -47,4 +51,43 @@ TEST(Test_FileReader, TestFileReaderBasic) {
   HW4Environment::AddPoints(5);
 }
 
+TEST(Test_FileReader, TestFileReaderStat) {
+  HW4Environment::OpenTestCase();
+
+  struct stat st;
+  FileReader f(".", "test_files/hextext.txt");
+  ASSERT_TRUE(f.Stat(&st));
+  ASSERT_EQ(4800, st.st_size);
+
+  // Directories, missing files and files outside the base directory
+  // can't be served, so they don't stat either.
+  f = FileReader(".", "test_files");
+  ASSERT_FALSE(f.Stat(&st));
+  f = FileReader(".", "non-existent");
+  ASSERT_FALSE(f.Stat(&st));
+  f = FileReader("./test_files", "../Makefile");
+  ASSERT_FALSE(f.Stat(&st));
+}
+
+TEST(Test_FileReader, TestFileReaderOpen) {
+  HW4Environment::OpenTestCase();
+
+  int fd;
+  struct stat st;
+  FileReader f(".", "test_files/transparent.gif");
+  ASSERT_TRUE(f.Open(&fd, &st));
+  ASSERT_EQ(43, st.st_size);
+  char buf[64];
+  ASSERT_EQ(43, pread(fd, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf, "GIF89a", 6));
+  close(fd);
+
+  f = FileReader(".", "test_files");
+  ASSERT_FALSE(f.Open(&fd, &st));
+  f = FileReader(".", "non-existent");
+  ASSERT_FALSE(f.Open(&fd, &st));
+  f = FileReader("./test_files", "../Makefile");
+  ASSERT_FALSE(f.Open(&fd, &st));
+}
+
 }  // namespace hw4
@@ -0,0 +1,50 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HtmlTemplate.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace hw4 {
+
+TEST(Test_HtmlTemplate, TestHtmlTemplateRender) {
+  HW4Environment::OpenTestCase();
+
+  HtmlTemplate plain("<p>no slots</p>");
+  ASSERT_EQ(0U, plain.num_slots());
+  string out;
+  plain.Render({}, &out);
+  ASSERT_EQ("<p>no slots</p>", out);
+
+  // Slots at the start, middle and end, and one value used twice.
+  HtmlTemplate link("{pre}<a href=\"{url}\">{url}</a>{post}");
+  ASSERT_EQ(4U, link.num_slots());
+  out = "before ";
+  link.Render({"[", "/x", "/x", "]"}, &out);
+  ASSERT_EQ("before [<a href=\"/x\">/x</a>]", out);
+
+  // Rendering appends, and empty values are fine.
+  link.Render({"", "/y", "", ""}, &out);
+  ASSERT_EQ("before [<a href=\"/x\">/x</a>]<a href=\"/y\"></a>", out);
+
+  // Adjacent slots.
+  HtmlTemplate pair("{a}{b}");
+  ASSERT_EQ(2U, pair.num_slots());
+  out.clear();
+  pair.Render({"1", "2"}, &out);
+  ASSERT_EQ("12", out);
+}
+
+}  // namespace hw4
@@ -0,0 +1,165 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <zlib.h>
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HttpCompression.h"
+#include "./HttpResponse.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace hw4 {
+
+// Decompress "compressed", a gzip or zlib stream, into "plain".
+static bool Inflate(const string& compressed, string* plain) {
+  z_stream z = {};
+  if (inflateInit2(&z, 15 + 32) != Z_OK)  // detect gzip or zlib
+    return false;
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+  z.avail_in = compressed.size();
+  int res;
+  char buf[4096];
+  do {
+    z.next_out = reinterpret_cast<Bytef*>(buf);
+    z.avail_out = sizeof(buf);
+    res = inflate(&z, Z_NO_FLUSH);
+    plain->append(buf, sizeof(buf) - z.avail_out);
+  } while (res == Z_OK);
+  inflateEnd(&z);
+  return res == Z_STREAM_END;
+}
+
+// Produces "count" rows of a results-like page.
+class RowSource : public HttpResponse::BodySource {
+ public:
+  explicit RowSource(int count) : count_(count), next_(0) { }
+  bool Next(string* chunk) override {
+    chunk->append(Row(next_++));
+    return next_ < count_;
+  }
+  static string Row(int i) {
+    return "<div><li><a href=\"/static/doc" + std::to_string(i) +
+           ".txt\">doc" + std::to_string(i) + ".txt</a></li></div>";
+  }
+
+ private:
+  int count_;
+  int next_;
+};
+
+TEST(Test_HttpCompression, TestHttpCompressionNegotiate) {
+  HW4Environment::OpenTestCase();
+  ASSERT_EQ(ContentCoding::kIdentity, NegotiateCoding(""));
+  ASSERT_EQ(ContentCoding::kIdentity, NegotiateCoding("br, identity"));
+  ASSERT_EQ(ContentCoding::kGzip, NegotiateCoding("gzip, deflate, br"));
+  ASSERT_EQ(ContentCoding::kGzip, NegotiateCoding("deflate, GZIP"));
+  ASSERT_EQ(ContentCoding::kDeflate, NegotiateCoding("gzip;q=0.5, deflate"));
+  ASSERT_EQ(ContentCoding::kDeflate, NegotiateCoding("gzip; q=0, *"));
+  ASSERT_EQ(ContentCoding::kGzip, NegotiateCoding("*"));
+  ASSERT_EQ(ContentCoding::kIdentity, NegotiateCoding("*;q=0"));
+  ASSERT_EQ(ContentCoding::kGzip, NegotiateCoding("x-gzip"));
+
+  // Precompressed files may also come in brotli, which dynamic pages
+  // never do.
+  ASSERT_EQ(ContentCoding::kIdentity, NegotiateCoding("br"));
+  ASSERT_EQ(1.0, AcceptedQValue("gzip, br", ContentCoding::kBrotli));
+  ASSERT_EQ(0.5, AcceptedQValue("gzip, br;q=0.5", ContentCoding::kBrotli));
+  ASSERT_EQ(0.0, AcceptedQValue("gzip", ContentCoding::kBrotli));
+  ASSERT_EQ(0.2, AcceptedQValue("*;q=0.2", ContentCoding::kBrotli));
+  ASSERT_EQ(1.0, AcceptedQValue("x-gzip", ContentCoding::kGzip));
+}
+
+TEST(Test_HttpCompression, TestHttpCompressionDeflater) {
+  HW4Environment::OpenTestCase();
+  string plain;
+  for (int i = 0; i < 2000; i++) {
+    plain += RowSource::Row(i);
+  }
+
+  for (ContentCoding coding : {ContentCoding::kGzip, ContentCoding::kDeflate}) {
+    // Several times, so that later rounds reuse the thread's contexts.
+    for (int round = 0; round < 3; round++) {
+      Deflater deflater(coding, 6);
+      string compressed;
+      deflater.Compress(plain.substr(0, 1000), false, &compressed);
+
+      // Each flushed piece can be decompressed on its own.
+      z_stream z = {};
+      ASSERT_EQ(Z_OK, inflateInit2(&z, 15 + 32));
+      string first(1000, '\0');
+      z.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+      z.avail_in = compressed.size();
+      z.next_out = reinterpret_cast<Bytef*>(&first[0]);
+      z.avail_out = first.size();
+      ASSERT_EQ(Z_OK, inflate(&z, Z_SYNC_FLUSH));
+      ASSERT_EQ(0U, z.avail_out);
+      ASSERT_EQ(plain.substr(0, 1000), first);
+      inflateEnd(&z);
+
+      deflater.Compress(plain.substr(1000), true, &compressed);
+      ASSERT_LT(compressed.size(), plain.size() / 4);
+      string decompressed;
+      ASSERT_TRUE(Inflate(compressed, &decompressed));
+      ASSERT_EQ(plain, decompressed);
+    }
+  }
+}
+
+TEST(Test_HttpCompression, TestHttpCompressionResponse) {
+  HW4Environment::OpenTestCase();
+
+  // A response whose whole body is known.
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("<html>");
+  rep.AppendToBody(std::make_shared<const string>(string(5000, 'x')));
+  CompressResponse(ContentCoding::kGzip, 6, &rep);
+  ASSERT_FALSE(rep.is_streamed());
+  string headers = rep.GenerateHeaders();
+  ASSERT_NE(string::npos, headers.find("Content-Encoding: gzip\r\n"));
+  ASSERT_NE(string::npos, headers.find("Vary: Accept-Encoding\r\n"));
+  string body = rep.GenerateResponseString().substr(headers.size());
+  ASSERT_EQ(rep.body_size(), body.size());
+  string plain;
+  ASSERT_TRUE(Inflate(body, &plain));
+  ASSERT_EQ("<html>" + string(5000, 'x'), plain);
+
+  // A streamed one stays streamed, and the source's output follows the
+  // body in the same compressed stream.
+  HttpResponse streamed;
+  streamed.set_protocol("HTTP/1.1");
+  streamed.set_response_code(200);
+  streamed.set_message("OK");
+  streamed.AppendToBody("<html>");
+  streamed.set_body_source(std::make_shared<RowSource>(500));
+  CompressResponse(ContentCoding::kDeflate, 1, &streamed);
+  ASSERT_TRUE(streamed.is_streamed());
+  ASSERT_LT(0U, streamed.body_size());
+  streamed.DrainBodySource();
+  string expected = "<html>";
+  for (int i = 0; i < 500; i++) {
+    expected += RowSource::Row(i);
+  }
+  body = streamed.GenerateResponseString();
+  body = body.substr(body.find("\r\n\r\n") + 4);
+  plain.clear();
+  ASSERT_TRUE(Inflate(body, &plain));
+  ASSERT_EQ(expected, plain);
+}
+
+}  // namespace hw4
@@ -16,6 +16,9 @@ extern "C" {
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
 #include <string>
 
 #include "./HttpConnection.h"
@@ -254,6 +257,342 @@ TEST(Test_HttpConnection, TestHttpConnectionPartialRead) {
   close(spair[1]);
 }
 
+TEST(Test_HttpConnection, TestHttpConnectionNonBlocking) {
+  HW4Environment::OpenTestCase();
+
+  // The event loop drives HttpConnection through a non-blocking socket.
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // Nothing has been sent yet, so reading must not block.
+  bool eof = true;
+  HttpRequest req;
+  ASSERT_TRUE(hc.ReadAvailable(SIZE_MAX, &eof));
+  ASSERT_FALSE(eof);
+  ASSERT_FALSE(hc.ParseBufferedRequest(&req));
+
+  // One and a half requests arrive; only the first can be parsed.  A
+  // read stops at its budget, and leaves the rest in the socket.
+  string reqs = "GET /foo HTTP/1.1\r\nHost: a\r\n\r\nGET /bar HTTP/1.1\r\n";
+  ASSERT_EQ(static_cast<int>(reqs.size()),
+            WrappedWrite(spair[1], (unsigned char*) reqs.c_str(),
+                         static_cast<int>(reqs.size())));
+  ASSERT_TRUE(hc.ReadAvailable(10, &eof));
+  ASSERT_EQ(10U, hc.buffered_bytes());
+  ASSERT_FALSE(hc.ParseBufferedRequest(&req));
+  ASSERT_TRUE(hc.ReadAvailable(SIZE_MAX, &eof));
+  ASSERT_TRUE(hc.ParseBufferedRequest(&req));
+  ASSERT_EQ("/foo", req.uri());
+  ASSERT_FALSE(hc.ParseBufferedRequest(&req));
+
+  // The rest of the second request arrives, followed by EOF.
+  string tail = "\r\n";
+  ASSERT_EQ(2, WrappedWrite(spair[1], (unsigned char*) tail.c_str(), 2));
+  shutdown(spair[1], SHUT_WR);
+  ASSERT_TRUE(hc.ReadAvailable(SIZE_MAX, &eof));
+  ASSERT_TRUE(eof);
+  ASSERT_TRUE(hc.ParseBufferedRequest(&req));
+  ASSERT_EQ("/bar", req.uri());
+  ASSERT_EQ(0U, hc.buffered_bytes());
+
+  // Queued output is only written by FlushQueuedOutput().
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("hi");
+  hc.QueueResponse(rep);
+  ASSERT_TRUE(hc.has_queued_output());
+  ASSERT_TRUE(hc.FlushQueuedOutput());
+  ASSERT_FALSE(hc.has_queued_output());
+
+  unsigned char buf[1024] = { 0 };
+  string expected = "HTTP/1.1 200 OK\r\nContent-length: 2\r\n\r\nhi";
+  ASSERT_EQ(static_cast<int>(expected.size()),
+            WrappedRead(spair[1], buf, sizeof(buf)));
+  ASSERT_EQ(expected, (const char*) buf);
+
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, TestHttpConnectionBatchedOutput) {
+  HW4Environment::OpenTestCase();
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // Queue more responses than one writev() takes, and more bytes than
+  // the socket buffer holds, so that some writes stop partway through a
+  // response.
+  string expected;
+  for (int i = 0; i < 200; i++) {
+    HttpResponse rep;
+    rep.set_protocol("HTTP/1.1");
+    rep.set_response_code(200);
+    rep.set_message("OK");
+    rep.AppendToBody(string(1000 + i, 'a' + (i % 26)));
+    hc.QueueResponse(rep);
+    expected += rep.GenerateResponseString();
+  }
+
+  // Everything arrives, in order, however the writes get split up.
+  string received;
+  char buf[65536];
+  while (hc.has_queued_output() || received.size() < expected.size()) {
+    ASSERT_TRUE(hc.FlushQueuedOutput());
+    ssize_t res;
+    while ((res = read(spair[1], buf, sizeof(buf))) > 0) {
+      received.append(buf, res);
+    }
+  }
+  ASSERT_EQ(expected, received);
+
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, TestHttpConnectionSegmentedBody) {
+  HW4Environment::OpenTestCase();
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // A file bigger than the chunks file segments are read in.
+  char path[] = "/tmp/test_httpconnection.XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  unlink(path);
+  string contents;
+  for (int i = 0; i < 200000; i++) {
+    contents += static_cast<char>('a' + (i * 7) % 26);
+  }
+  ASSERT_EQ(static_cast<int>(contents.size()),
+            WrappedWrite(fd, (unsigned char*) contents.c_str(),
+                         static_cast<int>(contents.size())));
+  auto file = std::make_shared<const OpenFile>(fd);
+
+  // Owned, shared and file segments, in that order and mixed up.
+  auto shared = std::make_shared<const string>("<shared>");
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("head ");
+  rep.AppendToBody(string("and more"));
+  rep.AppendToBody(shared);
+  rep.AppendFileToBody(file, 10, 150000);
+  rep.AppendToBody(shared);
+  rep.AppendFileToBody(file, 0, 5);
+  rep.AppendToBody("tail");
+  string body = "head and more<shared>" + contents.substr(10, 150000) +
+                "<shared>" + contents.substr(0, 5) + "tail";
+  ASSERT_EQ(body.size(), rep.body_size());
+  ASSERT_EQ(6U, rep.body().size());
+  string expected = rep.GenerateHeaders() + body;
+  ASSERT_EQ(expected, rep.GenerateResponseString());
+
+  hc.QueueResponse(rep);
+  hc.QueueResponse(std::move(rep));
+  expected += expected;
+  ASSERT_EQ(0U, rep.body_size());
+
+  string received;
+  char buf[65536];
+  while (hc.has_queued_output() || received.size() < expected.size()) {
+    ASSERT_TRUE(hc.FlushQueuedOutput());
+    ssize_t res;
+    while ((res = read(spair[1], buf, sizeof(buf))) > 0) {
+      received.append(buf, res);
+    }
+  }
+  ASSERT_EQ(expected, received);
+
+  // A file that turns out shorter than the response says fails the
+  // connection rather than leaving the client waiting.
+  HttpResponse truncated;
+  truncated.set_protocol("HTTP/1.1");
+  truncated.set_response_code(200);
+  truncated.set_message("OK");
+  truncated.AppendFileToBody(file, contents.size() - 10, 20);
+  hc.QueueResponse(std::move(truncated));
+  ASSERT_FALSE(hc.FlushQueuedOutput());
+
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, TestHttpConnectionPreserialized) {
+  HW4Environment::OpenTestCase();
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.set_content_type("text/html");
+  rep.AppendToBody("<html>");
+  rep.AppendToBody(std::make_shared<const string>("page"));
+  rep.AppendToBody("</html>");
+  string expected = rep.GenerateResponseString();
+
+  // Copies share the serialized response, and the body.
+  rep.Preserialize();
+  ASSERT_NE(nullptr, rep.serialized());
+  ASSERT_EQ(expected, *rep.serialized());
+  ASSERT_EQ(1U, rep.body().size());
+  HttpResponse copy(rep);
+  ASSERT_EQ(rep.serialized(), copy.serialized());
+  ASSERT_EQ(rep.body()[0].bytes().data(), copy.body()[0].bytes().data());
+
+  // Changing a copy drops its serialized form, but not the original's.
+  HttpResponse closing(rep);
+  closing.set_header("Connection", "close");
+  ASSERT_EQ(nullptr, closing.serialized());
+  ASSERT_NE(nullptr, rep.serialized());
+  closing.set_header_block(std::make_shared<const string>("X-Block: 1\r\n"));
+  string closing_expected = closing.GenerateResponseString();
+  ASSERT_NE(string::npos, closing_expected.find(
+      "Connection: close\r\nX-Block: 1\r\nContent-length: "));
+
+  hc.QueueResponse(rep);
+  hc.QueueResponse(std::move(copy));
+  hc.QueueResponse(std::move(closing));
+  expected = expected + expected + closing_expected;
+
+  string received;
+  char buf[4096];
+  while (hc.has_queued_output() || received.size() < expected.size()) {
+    ASSERT_TRUE(hc.FlushQueuedOutput());
+    ssize_t res;
+    while ((res = read(spair[1], buf, sizeof(buf))) > 0) {
+      received.append(buf, res);
+    }
+  }
+  ASSERT_EQ(expected, received);
+
+  close(spair[1]);
+}
+
+// Produces "count" chunks of "x"s, the i-th one i+1 bytes long.
+class CountingSource : public HttpResponse::BodySource {
+ public:
+  explicit CountingSource(int count) : count_(count), next_(0) { }
+  bool Next(string* chunk) override {
+    chunk->append(++next_, 'x');
+    return next_ < count_;
+  }
+
+ private:
+  int count_;
+  int next_;
+};
+
+TEST(Test_HttpConnection, TestHttpConnectionChunkedOutput) {
+  HW4Environment::OpenTestCase();
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // A streamed response goes out with its body so far as the first
+  // chunk; the caller feeds the rest through QueueChunk().
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody(string(20, 'h'));
+  rep.set_body_source(std::make_shared<CountingSource>(3));
+  ASSERT_TRUE(rep.is_streamed());
+  hc.QueueResponse(std::move(rep));
+  auto source = rep.ReleaseBodySource();
+  string chunk;
+  bool more;
+  do {
+    more = source->Next(&chunk);
+    hc.QueueChunk(std::move(chunk));
+    chunk.clear();
+  } while (more);
+  hc.QueueLastChunk();
+
+  string expected = "HTTP/1.1 200 OK\r\nTransfer-encoding: chunked\r\n\r\n";
+  expected += "14\r\n" + string(20, 'h') + "\r\n";
+  expected += "1\r\nx\r\n2\r\nxx\r\n3\r\nxxx\r\n0\r\n\r\n";
+  ASSERT_EQ(expected.size(), hc.queued_bytes());
+  ASSERT_TRUE(hc.FlushQueuedOutput());
+  ASSERT_EQ(0U, hc.queued_bytes());
+  unsigned char buf[1024] = { 0 };
+  ASSERT_EQ(static_cast<int>(expected.size()),
+            WrappedRead(spair[1], buf, sizeof(buf)));
+  ASSERT_EQ(expected, (const char*) buf);
+
+  // Draining the source turns it into an ordinary response.
+  HttpResponse drained;
+  drained.set_protocol("HTTP/1.1");
+  drained.set_response_code(200);
+  drained.set_message("OK");
+  drained.AppendToBody("h");
+  drained.set_body_source(std::make_shared<CountingSource>(3));
+  drained.DrainBodySource();
+  ASSERT_FALSE(drained.is_streamed());
+  ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-length: 7\r\n\r\nhxxxxxx",
+            drained.GenerateResponseString());
+
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, TestHttpConnectionParseInPlace) {
+  HW4Environment::OpenTestCase();
+  HttpConnection hc(-1);
+
+  string reqs = "GET /foo HTTP/1.1\r\n";
+  reqs += "Host: SomeHost.foo.bar\r\n";
+  reqs += "X-Dup: first\r\n";
+  reqs += "no colon here\r\n";
+  reqs += "x-dup:  second \r\n";
+  reqs += "\r\n";
+  reqs += "GET  /bar  HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n";
+  hc.AppendReceived(reqs.data(), reqs.size());
+
+  HttpRequest htreq1, htreq2, htreq3;
+  ASSERT_TRUE(hc.ParseBufferedRequest(&htreq1));
+  ASSERT_TRUE(hc.ParseBufferedRequest(&htreq2));
+  ASSERT_FALSE(hc.ParseBufferedRequest(&htreq3));
+
+  // Bytes that arrive while the requests are still in use must not
+  // disturb them.
+  string more = "GET /baz HTTP/1.1\r\n";
+  for (int i = 0; i < 200; i++) {
+    more += "Other: " + string(100, 'x') + "\r\n";
+  }
+  more += "\r\n";
+  hc.AppendReceived(more.data(), more.size());
+  ASSERT_EQ(more.size(), hc.buffered_bytes());
+
+  // Names match in any case, and values come back as sent.
+  ASSERT_EQ("GET", htreq1.method());
+  ASSERT_EQ("/foo", htreq1.uri());
+  ASSERT_EQ("HTTP/1.1", htreq1.version());
+  ASSERT_EQ("SomeHost.foo.bar", htreq1.GetHeaderValue("host"));
+  ASSERT_EQ("SomeHost.foo.bar", htreq1.GetHeaderValue("HOST"));
+  ASSERT_EQ("second", htreq1.GetHeaderValue("X-Dup"));
+  ASSERT_EQ("", htreq1.GetHeaderValue("connection"));
+  ASSERT_EQ(2, htreq1.GetHeaderCount());
+  ASSERT_EQ("/bar", htreq2.uri());
+  ASSERT_EQ("HTTP/1.0", htreq2.version());
+  ASSERT_EQ("Keep-Alive", htreq2.GetHeaderValue("connection"));
+
+  // A copy that owns its text outlives the buffer.
+  HttpRequest owned(htreq2);
+  owned.TakeOwnership();
+  hc.ReleaseRequests();
+  ASSERT_TRUE(hc.ParseBufferedRequest(&htreq3));
+  ASSERT_EQ("/baz", htreq3.uri());
+  ASSERT_EQ(1, htreq3.GetHeaderCount());
+  HttpRequest copy = owned;
+  ASSERT_EQ("/bar", copy.uri());
+  ASSERT_EQ("Keep-Alive", copy.GetHeaderValue("Connection"));
+}
+
 static void WritePartialRequests(void* args) {
   int socket = *static_cast<int*>(args);
   // Write three requests on the socket.
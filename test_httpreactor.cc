@@ -0,0 +1,364 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HttpReactor.h"
+#include "./HttpUtils.h"
+#include "./ServerSocket.h"
+#include "./test_suite.h"
+#include "./test_util.h"
+
+using std::string;
+using std::unique_ptr;
+
+namespace hw4 {
+
+// Lets the workers' "/block" requests finish.
+static std::atomic<int> num_blocked(0);
+static std::atomic<bool> unblock(false);
+
+// Produces "chunk0", "chunk1" and "chunk2".
+class TestBodySource : public HttpResponse::BodySource {
+ public:
+  bool Next(string* chunk) override {
+    chunk->append("chunk" + std::to_string(next_++));
+    return next_ < 3;
+  }
+
+ private:
+  int next_ = 0;
+};
+
+// The reactor's request handler.  The body of the response is the URI,
+// except that "/stream" streams its body from a TestBodySource.
+// "/block" waits until "unblock" is set, and "/sleep/<ms>" sleeps for
+// that many milliseconds first.
+static HttpResponse HandleTestRequest(const HttpRequest& request,
+                                      void* arg) {
+  string uri(request.uri());
+  if (uri == "/block") {
+    num_blocked++;
+    while (!unblock.load()) {
+      usleep(1000);  // 0.001s
+    }
+  } else if (uri.substr(0, 7) == "/sleep/") {
+    usleep(atoi(uri.c_str() + 7) * 1000);
+  }
+
+  HttpResponse resp;
+  resp.set_protocol("HTTP/1.1");
+  resp.set_response_code(200);
+  resp.set_message("OK");
+  resp.set_content_type("text/plain");
+  if (uri == "/stream") {
+    resp.set_body_source(std::make_shared<TestBodySource>());
+  } else {
+    resp.AppendToBody(uri);
+  }
+  return resp;
+}
+
+// A reactor listening on an ephemeral port.  Configure it through
+// reactor(), then Start() its event loop on a thread of its own; the
+// loop is stopped when the TestReactor is destroyed.
+class TestReactor {
+ public:
+  explicit TestReactor(uint32_t num_threads) : socket_(0), running_(false) {
+    int listen_fd;
+    if (!socket_.BindAndListen(AF_INET6, &listen_fd) ||
+        !socket_.SetNonBlocking())
+      return;
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                    &addr_len) != 0)
+      return;
+    port_ = ntohs(addr.sin6_port);
+    reactor_.reset(new HttpReactor(&socket_, listen_fd, num_threads,
+                                   num_threads, &HandleTestRequest, nullptr));
+  }
+
+  ~TestReactor() {
+    if (running_) {
+      reactor_->Stop();
+      void* ok;
+      pthread_join(thread_, &ok);
+    }
+  }
+
+  // Returns false if the reactor couldn't be set up.
+  bool Start() {
+    if (reactor_ == nullptr)
+      return false;
+    running_ = (pthread_create(&thread_, nullptr, &RunFn,
+                               reactor_.get()) == 0);
+    return running_;
+  }
+
+  HttpReactor* reactor() { return reactor_.get(); }
+
+  // Returns a new connection to the reactor, or -1.
+  int Connect() {
+    int fd;
+    return ConnectToServer("127.0.0.1", port_, &fd) ? fd : -1;
+  }
+
+ private:
+  static void* RunFn(void* arg) {
+    return static_cast<HttpReactor*>(arg)->Run() ? arg : nullptr;
+  }
+
+  ServerSocket socket_;
+  uint16_t port_;
+  unique_ptr<HttpReactor> reactor_;
+  pthread_t thread_;
+  bool running_;
+};
+
+TEST(Test_HttpReactor, TestHttpReactorBasic) {
+  HW4Environment::OpenTestCase();
+  TestReactor server(2);
+  ASSERT_TRUE(server.Start());
+
+  // Requests on one keep-alive connection are answered one by one.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /hello HTTP/1.1\r\n\r\n"));
+  string resp = ReadResponse(fd);
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(resp.size() - 6, resp.find("/hello"));
+  ASSERT_TRUE(Send(fd, "GET /again HTTP/1.1\r\n\r\n"));
+  resp = ReadResponse(fd);
+  ASSERT_EQ(resp.size() - 6, resp.find("/again"));
+
+  // The connection ends after a request that asks it to.
+  ASSERT_TRUE(Send(fd, "GET /bye HTTP/1.1\r\nConnection: close\r\n\r\n"));
+  resp.clear();
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  ASSERT_EQ(resp.size() - 4, resp.find("/bye"));
+  close(fd);
+
+  HttpReactor::Stats stats = server.reactor()->GetStats();
+  ASSERT_EQ(3U, stats.tasks);
+  ASSERT_LE(stats.max_queue_wait_ns, stats.queue_wait_ns);
+}
+
+TEST(Test_HttpReactor, TestHttpReactorPipelining) {
+  HW4Environment::OpenTestCase();
+  TestReactor server(4);
+  ASSERT_TRUE(server.Start());
+
+  // The requests are handled in parallel, and the earlier ones take
+  // longer, but their responses still go out in order.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /sleep/300 HTTP/1.1\r\n\r\n"
+                       "GET /sleep/200 HTTP/1.1\r\n\r\n"
+                       "GET /sleep/100 HTTP/1.1\r\n\r\n"
+                       "GET /sleep/0 HTTP/1.1\r\nConnection: close\r\n\r\n"));
+  string resp;
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  close(fd);
+  size_t pos300 = resp.find("/sleep/300");
+  size_t pos200 = resp.find("/sleep/200");
+  size_t pos100 = resp.find("/sleep/100");
+  size_t pos0 = resp.find("/sleep/0");
+  ASSERT_NE(string::npos, pos0);
+  ASSERT_LT(pos300, pos200);
+  ASSERT_LT(pos200, pos100);
+  ASSERT_LT(pos100, pos0);
+}
+
+TEST(Test_HttpReactor, TestHttpReactorStreaming) {
+  HW4Environment::OpenTestCase();
+  TestReactor server(2);
+  ASSERT_TRUE(server.Start());
+
+  // An HTTP/1.1 client gets the body in chunks, followed by the response
+  // to its next request.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /stream HTTP/1.1\r\n\r\n"
+                       "GET /next HTTP/1.1\r\nConnection: close\r\n\r\n"));
+  string resp;
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  close(fd);
+  size_t body = resp.find("\r\n\r\n");
+  ASSERT_NE(string::npos, body);
+  ASSERT_NE(string::npos, resp.find("Transfer-encoding: chunked"));
+  ASSERT_EQ(body + 4, resp.find("6\r\nchunk0\r\n6\r\nchunk1\r\n"
+                                "6\r\nchunk2\r\n0\r\n\r\nHTTP/1.1 200 OK"));
+  ASSERT_EQ(resp.size() - 5, resp.find("/next"));
+
+  // An HTTP/1.0 client gets the whole body at once instead.
+  fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /stream HTTP/1.0\r\nConnection: close\r\n\r\n"));
+  resp.clear();
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  close(fd);
+  ASSERT_EQ(string::npos, resp.find("chunked"));
+  ASSERT_NE(string::npos, resp.find("Content-length: 18\r\n"));
+  ASSERT_EQ(resp.size() - 18, resp.find("chunk0chunk1chunk2"));
+}
+
+TEST(Test_HttpReactor, TestHttpReactorIoUring) {
+  HW4Environment::OpenTestCase();
+  TestReactor server(4);
+  ASSERT_NE(nullptr, server.reactor());
+  if (!server.reactor()->UseIoUring()) {
+    std::cout << "io_uring is not available; skipping." << std::endl;
+    return;
+  }
+  ASSERT_TRUE(server.Start());
+
+  // The same requests as above, through the other event loop.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /hello HTTP/1.1\r\n\r\n"));
+  string resp = ReadResponse(fd);
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(resp.size() - 6, resp.find("/hello"));
+  ASSERT_TRUE(Send(fd, "GET /sleep/200 HTTP/1.1\r\n\r\n"
+                       "GET /stream HTTP/1.1\r\n\r\n"
+                       "GET /sleep/0 HTTP/1.1\r\nConnection: close\r\n\r\n"));
+  resp.clear();
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  close(fd);
+  size_t pos200 = resp.find("/sleep/200");
+  size_t pos_stream = resp.find("6\r\nchunk0\r\n6\r\nchunk1\r\n"
+                                "6\r\nchunk2\r\n0\r\n\r\n");
+  size_t pos0 = resp.find("/sleep/0");
+  ASSERT_NE(string::npos, pos0);
+  ASSERT_LT(pos200, pos_stream);
+  ASSERT_LT(pos_stream, pos0);
+
+  // A client that pipelines more than the reactor buffers is read from
+  // again as its responses go out, rather than disconnected.
+  const int kNumRequests = 10000;
+  string pad(100, 'x');
+  string requests;
+  for (int i = 0; i < kNumRequests; i++) {
+    requests += "GET /" + std::to_string(i) + "/" + pad + " HTTP/1.1\r\n";
+    if (i == kNumRequests - 1) {
+      requests += "Connection: close\r\n";
+    }
+    requests += "\r\n";
+  }
+  ASSERT_LT(1U << 20, requests.size());
+  fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  resp.clear();
+  ASSERT_TRUE(Exchange(fd, requests, &resp));
+  close(fd);
+  size_t pos = 0;
+  for (int i = 0; i < kNumRequests; i++) {
+    pos = resp.find("\r\n\r\n/" + std::to_string(i) + "/", pos);
+    ASSERT_NE(string::npos, pos);
+  }
+}
+
+TEST(Test_HttpReactor, TestHttpReactorShedding) {
+  HW4Environment::OpenTestCase();
+  num_blocked = 0;
+  unblock = false;
+  TestReactor server(1);
+  ASSERT_NE(nullptr, server.reactor());
+  server.reactor()->set_max_queued(1);
+  ASSERT_TRUE(server.Start());
+
+  // Tie up the only worker.
+  int busy_fd = server.Connect();
+  ASSERT_NE(-1, busy_fd);
+  ASSERT_TRUE(Send(busy_fd, "GET /block HTTP/1.1\r\n\r\n"));
+  for (int i = 0; i < 500 && num_blocked.load() == 0; i++) {
+    usleep(10000);  // 0.01s
+  }
+  ASSERT_EQ(1, num_blocked.load());
+
+  // More requests than fit in the queue: the reactor answers the rest
+  // with a 503 itself, and closes the connection after it.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n"
+                       "GET /c HTTP/1.1\r\n\r\n"));
+  unblock = true;
+  string resp;
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  close(fd);
+  size_t pos = resp.rfind("HTTP/1.1 ");
+  ASSERT_NE(string::npos, pos);
+  ASSERT_EQ(pos, resp.find("HTTP/1.1 503 Service Unavailable\r\n", pos));
+  ASSERT_NE(string::npos, resp.find("Retry-After: 1\r\n", pos));
+  ASSERT_NE(string::npos, resp.find("Connection: close\r\n", pos));
+  ASSERT_EQ(string::npos, resp.find("/c"));
+
+  // The blocked request still completes.
+  resp = ReadResponse(busy_fd);
+  ASSERT_EQ(resp.size() - 6, resp.find("/block"));
+  close(busy_fd);
+}
+
+TEST(Test_HttpReactor, TestHttpReactorLimits) {
+  HW4Environment::OpenTestCase();
+  TestReactor server(2);
+  ASSERT_NE(nullptr, server.reactor());
+  server.reactor()->set_timeouts(200, 200);
+  server.reactor()->set_max_requests(2);
+  ASSERT_TRUE(server.Start());
+
+  // A connection that sends nothing is closed once it has been idle too
+  // long.
+  int fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  string resp;
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  ASSERT_EQ("", resp);
+  close(fd);
+
+  // A client too slow with its header gets a 408.
+  fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /slow HTTP/1.1\r\n"));
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 408 Request Timeout\r\n"));
+  ASSERT_NE(string::npos, resp.find("Connection: close\r\n"));
+  close(fd);
+
+  // The response to the last request a connection may make says that
+  // the connection ends, and it does.
+  fd = server.Connect();
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(Send(fd, "GET /1 HTTP/1.1\r\n\r\n"));
+  resp = ReadResponse(fd);
+  ASSERT_EQ(resp.size() - 6, resp.find("\r\n\r\n/1"));
+  ASSERT_EQ(string::npos, resp.find("Connection: close"));
+  ASSERT_TRUE(Send(fd, "GET /2 HTTP/1.1\r\n\r\n"));
+  resp.clear();
+  ASSERT_TRUE(ReadUntilClosed(fd, &resp));
+  ASSERT_EQ(resp.size() - 6, resp.find("\r\n\r\n/2"));
+  ASSERT_NE(string::npos, resp.find("Connection: close\r\n"));
+  close(fd);
+}
+
+}  // namespace hw4
@@ -0,0 +1,283 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./HttpServer.h"
+#include "./HttpUtils.h"
+#include "./test_suite.h"
+#include "./test_util.h"
+
+using std::list;
+using std::string;
+using std::unique_ptr;
+
+namespace hw4 {
+
+// The file that the tests ask for, 20 bytes of text.
+static const char* const kFileContents = "0123456789abcdefghij";
+
+// An HttpServer on a random port, serving "digits.txt" from a fresh
+// directory.  Start() runs it on a thread of its own until the
+// TestServer is destroyed.
+class TestServer {
+ public:
+  TestServer() : dir_("test_httpserver"), running_(false) {
+    WriteFile(dir_.path() + "/digits.txt", kFileContents);
+    HttpServerOptions options;
+    options.min_threads = 2;
+    options.precompress_bytes = 0;
+    port_ = GetRandPort();
+    server_.reset(new HttpServer(port_, dir_.path(),
+                                 list<string>{"unit_test_indices/tiny.idx"},
+                                 options));
+  }
+
+  ~TestServer() {
+    if (running_) {
+      server_->Stop();
+      pthread_join(thread_, nullptr);
+    }
+  }
+
+  // Start the server, and wait until it answers a request.  Returns
+  // false if it doesn't.
+  bool Start() {
+    if (dir_.path().empty() ||
+        pthread_create(&thread_, nullptr, &RunFn, server_.get()) != 0)
+      return false;
+    running_ = true;
+    for (int i = 0; i < 500; i++) {
+      int fd = Connect();
+      if (fd != -1) {
+        string resp;
+        bool ok = Send(fd, "GET /static/digits.txt HTTP/1.1\r\n"
+                           "Connection: close\r\n\r\n") &&
+                  ReadUntilClosed(fd, &resp);
+        close(fd);
+        if (ok && resp.find("HTTP/1.1 200 OK\r\n") == 0)
+          return true;
+      }
+      usleep(10000);  // 0.01s
+    }
+    return false;
+  }
+
+  // Returns a new connection to the server, or -1.
+  int Connect() {
+    int fd;
+    return ConnectToServer("127.0.0.1", port_, &fd) ? fd : -1;
+  }
+
+  // Send "request", which should ask to close the connection, and
+  // return everything the server sends back.
+  string Fetch(const string& request) {
+    string resp;
+    int fd = Connect();
+    if (fd == -1)
+      return resp;
+    if (!Send(fd, request) || !ReadUntilClosed(fd, &resp)) {
+      resp.clear();
+    }
+    close(fd);
+    return resp;
+  }
+
+ private:
+  static void* RunFn(void* arg) {
+    return static_cast<HttpServer*>(arg)->Run() ? arg : nullptr;
+  }
+
+  TempDir dir_;
+  uint16_t port_;
+  unique_ptr<HttpServer> server_;
+  pthread_t thread_;
+  bool running_;
+};
+
+// Returns the value of the header "name" in the response "resp", or ""
+// if it has none.
+static string HeaderValue(const string& resp, const string& name) {
+  size_t end = resp.find("\r\n\r\n");
+  size_t pos = resp.find("\r\n" + name + ": ");
+  if (pos == string::npos || pos >= end)
+    return "";
+  pos += name.size() + 4;
+  return resp.substr(pos, resp.find("\r\n", pos) - pos);
+}
+
+// Returns the body of the response "resp".
+static string Body(const string& resp) {
+  size_t end = resp.find("\r\n\r\n");
+  return (end == string::npos) ? "" : resp.substr(end + 4);
+}
+
+TEST(Test_HttpServer, TestHttpServerRanges) {
+  HW4Environment::OpenTestCase();
+  TestServer server;
+  ASSERT_TRUE(server.Start());
+  const string kRequest = "GET /static/digits.txt HTTP/1.1\r\n"
+                          "Connection: close\r\n";
+
+  // The whole file, with the validators a later If-Range can use.
+  string resp = server.Fetch(kRequest + "\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ("bytes", HeaderValue(resp, "Accept-Ranges"));
+  ASSERT_EQ(kFileContents, Body(resp));
+  string etag = HeaderValue(resp, "ETag");
+  string last_modified = HeaderValue(resp, "Last-Modified");
+  ASSERT_NE("", etag);
+  ASSERT_NE("", last_modified);
+
+  // One range.
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 206 Partial Content\r\n"));
+  ASSERT_EQ("text/plain", HeaderValue(resp, "Content-type"));
+  ASSERT_EQ("bytes 2-5/20", HeaderValue(resp, "Content-Range"));
+  ASSERT_EQ("4", HeaderValue(resp, "Content-length"));
+  ASSERT_EQ("2345", Body(resp));
+
+  // Several ranges, as a multipart/byteranges body.
+  resp = server.Fetch(kRequest + "Range: bytes=0-1,-3\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 206 Partial Content\r\n"));
+  string content_type = HeaderValue(resp, "Content-type");
+  const string kPrefix = "multipart/byteranges; boundary=";
+  ASSERT_EQ(0U, content_type.find(kPrefix));
+  string boundary = content_type.substr(kPrefix.size());
+  ASSERT_NE("", boundary);
+  ASSERT_EQ("", HeaderValue(resp, "Content-Range"));
+  string body = "\r\n--" + boundary + "\r\n"
+                "Content-type: text/plain\r\n"
+                "Content-Range: bytes 0-1/20\r\n"
+                "\r\n"
+                "01"
+                "\r\n--" + boundary + "\r\n"
+                "Content-type: text/plain\r\n"
+                "Content-Range: bytes 17-19/20\r\n"
+                "\r\n"
+                "hij"
+                "\r\n--" + boundary + "--\r\n";
+  ASSERT_EQ(body, Body(resp));
+  ASSERT_EQ(std::to_string(body.size()), HeaderValue(resp, "Content-length"));
+
+  // Ranges that touch are merged into one.
+  resp = server.Fetch(kRequest + "Range: bytes=0-3,4-7\r\n\r\n");
+  ASSERT_EQ("bytes 0-7/20", HeaderValue(resp, "Content-Range"));
+  ASSERT_EQ("01234567", Body(resp));
+
+  // A range that starts past the end can't be satisfied.
+  resp = server.Fetch(kRequest + "Range: bytes=30-40\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 416 Range Not Satisfiable\r\n"));
+  ASSERT_EQ("bytes */20", HeaderValue(resp, "Content-Range"));
+  ASSERT_EQ("", Body(resp));
+
+  // A Range header that doesn't parse is ignored.
+  resp = server.Fetch(kRequest + "Range: lines=1-2\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+
+  // If-Range only gets the range with a strong validator that matches;
+  // otherwise the client's copy is stale, and it gets the whole file.
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n"
+                      "If-Range: " + etag + "\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 206 Partial Content\r\n"));
+  ASSERT_EQ("2345", Body(resp));
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n"
+                      "If-Range: " + last_modified + "\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 206 Partial Content\r\n"));
+  ASSERT_EQ("2345", Body(resp));
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n"
+                      "If-Range: \"stale\"\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n"
+                      "If-Range: W/" + etag + "\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+  resp = server.Fetch(kRequest + "Range: bytes=2-5\r\n"
+                      "If-Range: Thu, 01 Jan 1970 00:00:00 GMT\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+}
+
+TEST(Test_HttpServer, TestHttpServerConditional) {
+  HW4Environment::OpenTestCase();
+  TestServer server;
+  ASSERT_TRUE(server.Start());
+  const string kRequest = "GET /static/digits.txt HTTP/1.1\r\n";
+  const string kLastRequest = kRequest + "Connection: close\r\n\r\n";
+
+  string resp = server.Fetch(kLastRequest);
+  string etag = HeaderValue(resp, "ETag");
+  string last_modified = HeaderValue(resp, "Last-Modified");
+  ASSERT_NE("", etag);
+  ASSERT_NE("", last_modified);
+
+  // A 304 has the file's validators but no length and no body, so the
+  // response to the next request on the connection follows its headers
+  // straight away.
+  resp = server.Fetch(kRequest + "If-None-Match: " + etag + "\r\n\r\n" +
+                      kLastRequest);
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 304 Not Modified\r\n"));
+  ASSERT_EQ(etag, HeaderValue(resp, "ETag"));
+  ASSERT_EQ(last_modified, HeaderValue(resp, "Last-Modified"));
+  ASSERT_EQ("", HeaderValue(resp, "Content-length"));
+  size_t next = resp.find("\r\n\r\n") + 4;
+  ASSERT_EQ(next, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp.substr(next)));
+
+  // Any tag in the list will do, as will "*".
+  resp = server.Fetch(kRequest + "If-None-Match: \"other\", " + etag +
+                      "\r\nConnection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 304 Not Modified\r\n"));
+  resp = server.Fetch(kRequest + "If-None-Match: *\r\n"
+                      "Connection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 304 Not Modified\r\n"));
+  resp = server.Fetch(kRequest + "If-None-Match: \"other\"\r\n"
+                      "Connection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+
+  // Likewise for a copy that is as new as the file.
+  resp = server.Fetch(kRequest + "If-Modified-Since: " + last_modified +
+                      "\r\n\r\n" + kLastRequest);
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 304 Not Modified\r\n"));
+  ASSERT_EQ("", HeaderValue(resp, "Content-length"));
+  next = resp.find("\r\n\r\n") + 4;
+  ASSERT_EQ(next, resp.find("HTTP/1.1 200 OK\r\n"));
+  resp = server.Fetch(kRequest + "If-Modified-Since: "
+                      "Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+                      "Connection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+
+  // If-None-Match wins over If-Modified-Since, whichever way they
+  // disagree.
+  resp = server.Fetch(kRequest + "If-None-Match: \"other\"\r\n"
+                      "If-Modified-Since: " + last_modified + "\r\n"
+                      "Connection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 200 OK\r\n"));
+  ASSERT_EQ(kFileContents, Body(resp));
+  resp = server.Fetch(kRequest + "If-None-Match: " + etag + "\r\n"
+                      "If-Modified-Since: "
+                      "Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+                      "Connection: close\r\n\r\n");
+  ASSERT_EQ(0U, resp.find("HTTP/1.1 304 Not Modified\r\n"));
+}
+
+}  // namespace hw4
@@ -14,6 +14,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "./HttpUtils.h"
 #include "./FileReader.h"
@@ -78,6 +80,119 @@ TEST(Test_HttpUtils, TestHttpUtilsURLParser) {
   ASSERT_EQ("baz", p.args()["bam"]);
 }
 
+TEST(Test_HttpUtils, TestHttpUtilsURLParserArgs) {
+  HW4Environment::OpenTestCase();
+
+  URLParser p;
+  string url("/q%20x?terms=a+%26+b&%74erms2=c&bad&worse=d=e&terms2=f?g=h");
+  p.Parse(url);
+  ASSERT_EQ("/q x", p.path());
+  ASSERT_EQ((unsigned) 2, p.args().size());
+  ASSERT_EQ("a & b", p.args()["terms"]);
+  ASSERT_EQ("f", p.args()["terms2"]);
+  ASSERT_TRUE(p.args()["bad"].empty());
+  ASSERT_TRUE(p.args()["worse"].empty());
+  ASSERT_TRUE(p.args()["g"].empty());
+
+  // Values that don't need decoding are views into the URL itself.
+  string plain("/foo?a=1&b=two");
+  p.Parse(plain);
+  std::string_view b = p.args()["b"];
+  ASSERT_EQ("two", b);
+  ASSERT_EQ(plain.data() + plain.size() - 3, b.data());
+
+  // Parsing again replaces the old args.
+  p.Parse("/foo");
+  ASSERT_EQ((unsigned) 0, p.args().size());
+  ASSERT_TRUE(p.args()["a"].empty());
+}
+
+TEST(Test_HttpUtils, TestHttpUtilsHttpDates) {
+  HW4Environment::OpenTestCase();
+
+  // The example from RFC 7231:7.1.1.1, in each of its formats.
+  time_t t = 784111777;
+  ASSERT_EQ("Sun, 06 Nov 1994 08:49:37 GMT", FormatHttpDate(t));
+  time_t parsed = 0;
+  ASSERT_TRUE(ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT", &parsed));
+  ASSERT_EQ(t, parsed);
+  parsed = 0;
+  ASSERT_TRUE(ParseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT", &parsed));
+  ASSERT_EQ(t, parsed);
+  parsed = 0;
+  ASSERT_TRUE(ParseHttpDate("Sun Nov  6 08:49:37 1994", &parsed));
+  ASSERT_EQ(t, parsed);
+
+  ASSERT_FALSE(ParseHttpDate("", &parsed));
+  ASSERT_FALSE(ParseHttpDate("yesterday", &parsed));
+  ASSERT_FALSE(ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT junk", &parsed));
+}
+
+TEST(Test_HttpUtils, TestHttpUtilsETagListMatches) {
+  HW4Environment::OpenTestCase();
+
+  ASSERT_TRUE(ETagListMatches("\"abc\"", "\"abc\""));
+  ASSERT_TRUE(ETagListMatches("\"x\", \"abc\"", "\"abc\""));
+  ASSERT_TRUE(ETagListMatches("\"x\",\t\"abc\" ", "\"abc\""));
+  ASSERT_TRUE(ETagListMatches("W/\"abc\"", "\"abc\""));
+  ASSERT_TRUE(ETagListMatches("*", "\"abc\""));
+  ASSERT_FALSE(ETagListMatches("\"abcd\"", "\"abc\""));
+  ASSERT_FALSE(ETagListMatches("abc", "\"abc\""));
+  ASSERT_FALSE(ETagListMatches(" , ", "\"abc\""));
+}
+
+TEST(Test_HttpUtils, TestHttpUtilsParseByteRanges) {
+  HW4Environment::OpenTestCase();
+  std::vector<ByteRange> ranges;
+
+  ASSERT_TRUE(ParseByteRanges("bytes=0-99", 1000, &ranges));
+  ASSERT_EQ(1U, ranges.size());
+  ASSERT_EQ(0U, ranges[0].first);
+  ASSERT_EQ(99U, ranges[0].last);
+
+  // Open-ended and suffix ranges are clipped to the file.
+  ASSERT_TRUE(ParseByteRanges("bytes=900-", 1000, &ranges));
+  ASSERT_EQ(1U, ranges.size());
+  ASSERT_EQ(900U, ranges[0].first);
+  ASSERT_EQ(999U, ranges[0].last);
+  ASSERT_TRUE(ParseByteRanges("Bytes=-5000", 1000, &ranges));
+  ASSERT_EQ(1U, ranges.size());
+  ASSERT_EQ(0U, ranges[0].first);
+  ASSERT_EQ(999U, ranges[0].last);
+
+  // Several ranges come back sorted, with overlapping and adjacent ones
+  // merged.
+  ASSERT_TRUE(ParseByteRanges("bytes=500-599, 0-9,5-19,20-29 ,-10",
+                              1000, &ranges));
+  ASSERT_EQ(3U, ranges.size());
+  ASSERT_EQ(0U, ranges[0].first);
+  ASSERT_EQ(29U, ranges[0].last);
+  ASSERT_EQ(500U, ranges[1].first);
+  ASSERT_EQ(599U, ranges[1].last);
+  ASSERT_EQ(990U, ranges[2].first);
+  ASSERT_EQ(999U, ranges[2].last);
+
+  // Ranges past the end can't be satisfied, but aren't errors.
+  ASSERT_TRUE(ParseByteRanges("bytes=1000-1999,-0", 1000, &ranges));
+  ASSERT_TRUE(ranges.empty());
+  ASSERT_TRUE(ParseByteRanges("bytes=2000-,10-19", 1000, &ranges));
+  ASSERT_EQ(1U, ranges.size());
+  ASSERT_EQ(10U, ranges[0].first);
+
+  // Malformed headers, and ones with too many ranges, are ignored.
+  ASSERT_FALSE(ParseByteRanges("bytes=", 1000, &ranges));
+  ASSERT_FALSE(ParseByteRanges("bytes=10-5", 1000, &ranges));
+  ASSERT_FALSE(ParseByteRanges("bytes=a-b", 1000, &ranges));
+  ASSERT_FALSE(ParseByteRanges("items=0-9", 1000, &ranges));
+  ASSERT_FALSE(ParseByteRanges("bytes=0-99999999999999999999", 1000,
+                               &ranges));
+  string many = "bytes=0-0";
+  for (int i = 1; i < 20; i++) {
+    many += "," + std::to_string(i * 2) + "-" + std::to_string(i * 2);
+  }
+  ASSERT_FALSE(ParseByteRanges(many, 1000, &ranges));
+}
+
 TEST(Test_HttpUtils, TestHttpUtilsIsPathSafe) {
   HW4Environment::OpenTestCase();
 
@@ -145,6 +260,41 @@ TEST(Test_HttpUtils, TestEscapeHtml) {
   HW4Environment::AddPoints(15);
 }
 
+TEST(Test_HttpUtils, TestHttpUtilsLongInputs) {
+  HW4Environment::OpenTestCase();
+
+  // Put one character needing work at every offset of strings long
+  // enough to cover the vectorized scans and their scalar tails.
+  for (size_t len = 1; len < 80; len++) {
+    for (size_t i = 0; i < len; i++) {
+      string clean(len, 'a');
+
+      string html = clean;
+      html[i] = '<';
+      string escaped = clean.substr(0, i) + "&lt;" + clean.substr(i + 1);
+      ASSERT_EQ(escaped, EscapeHtml(html));
+
+      string plus = clean;
+      plus[i] = '+';
+      string spaced = clean;
+      spaced[i] = ' ';
+      ASSERT_EQ(spaced, URIDecode(plus));
+
+      string encoded = clean.substr(0, i) + "%7e" + clean.substr(i + 1);
+      string decoded = clean;
+      decoded[i] = '~';
+      ASSERT_EQ(decoded, URIDecode(encoded));
+    }
+    ASSERT_EQ(string(len, 'a'), EscapeHtml(string(len, 'a')));
+    ASSERT_EQ(string(len, 'a'), URIDecode(string(len, 'a')));
+  }
+
+  // Escapes cut off by the end of the string are left alone.
+  ASSERT_EQ(string(40, 'a') + "%4", URIDecode(string(40, 'a') + "%4"));
+  ASSERT_EQ(string(40, 'a') + "%", URIDecode(string(40, 'a') + "%"));
+  ASSERT_EQ("%A", URIDecode("%%41"));
+}
+
 TEST(Test_HttpUtils, TestHttpUtilsWrappedReadWrite) {
   string filedata = "This is a test; this is only a test.\n";
 
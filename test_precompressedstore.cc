@@ -0,0 +1,110 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./PrecompressedStore.h"
+#include "./test_suite.h"
+#include "./test_util.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace hw4 {
+
+// Decompress "gzip", which should hold "size" bytes, into "plain".
+static bool Gunzip(const string& gzip, size_t size, string* plain) {
+  z_stream z = {};
+  if (inflateInit2(&z, 15 + 16) != Z_OK)
+    return false;
+  plain->resize(size);
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(gzip.data()));
+  z.avail_in = gzip.size();
+  z.next_out = reinterpret_cast<Bytef*>(&(*plain)[0]);
+  z.avail_out = size;
+  int res = inflate(&z, Z_FINISH);
+  inflateEnd(&z);
+  return res == Z_STREAM_END && z.avail_out == 0;
+}
+
+// Look "file_name" up in "store" as it is on disk now, waiting up to a
+// couple of seconds for it to be compressed.
+static shared_ptr<const PrecompressedStore::Variants> WaitFor(
+    PrecompressedStore* store, const string& dir, const string& file_name) {
+  struct stat st;
+  if (stat((dir + "/" + file_name).c_str(), &st) != 0)
+    return nullptr;
+  shared_ptr<const PrecompressedStore::Variants> variants;
+  bool pending = true;
+  for (int i = 0; i < 100 && pending; i++) {
+    variants = store->Find(file_name, st, &pending);
+    if (pending) {
+      usleep(20000);  // 0.02s
+    }
+  }
+  return variants;
+}
+
+TEST(Test_PrecompressedStore, TestPrecompressedStoreBasic) {
+  HW4Environment::OpenTestCase();
+  TempDir tmp("test_precompressedstore");
+  ASSERT_FALSE(tmp.path().empty());
+  const string& dir = tmp.path();
+  string sub = dir + "/sub";
+  ASSERT_EQ(0, mkdir(sub.c_str(), 0700));
+  string page;
+  for (int i = 0; i < 200; i++) {
+    page += "<p>paragraph " + std::to_string(i) + "</p>\n";
+  }
+  WriteFile(sub + "/page.html", page);
+  WriteFile(dir + "/tiny.txt", "too small");
+  WriteFile(dir + "/image.gif", page);
+
+  // The pass over the directory finds files in subdirectories.
+  PrecompressedStore store(dir, 1 << 20, 1024);
+  shared_ptr<const PrecompressedStore::Variants> variants =
+    WaitFor(&store, dir, "sub/page.html");
+  ASSERT_NE(nullptr, variants);
+  ASSERT_NE(nullptr, variants->gzip);
+  ASSERT_GT(page.size(), variants->gzip->size());
+  string plain;
+  ASSERT_TRUE(Gunzip(*variants->gzip, page.size(), &plain));
+  ASSERT_EQ(page, plain);
+
+  // Small files, and files that aren't text, aren't compressed.
+  ASSERT_EQ(nullptr, WaitFor(&store, dir, "tiny.txt"));
+  ASSERT_EQ(nullptr, WaitFor(&store, dir, "image.gif"));
+  ASSERT_FALSE(PrecompressedStore::IsCompressible("image.gif"));
+  ASSERT_TRUE(PrecompressedStore::IsCompressible("a/b.css"));
+
+  // A changed file is recompressed the first time it is looked up, and
+  // its old copies are never handed out for it.
+  string new_page = page + page;
+  WriteFile(sub + "/page.html", new_page);
+  variants = WaitFor(&store, dir, "sub/page.html");
+  ASSERT_NE(nullptr, variants);
+  ASSERT_TRUE(Gunzip(*variants->gzip, new_page.size(), &plain));
+  ASSERT_EQ(new_page, plain);
+
+  PrecompressedStore::Stats stats = store.GetStats();
+  ASSERT_EQ(1U, stats.files);
+  ASSERT_EQ(variants->gzip->size() +
+            (variants->brotli ? variants->brotli->size() : 0), stats.bytes);
+  ASSERT_EQ(2U, stats.builds);
+}
+
+}  // namespace hw4
@@ -0,0 +1,74 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string.h>
+#include <string>
+#include <string_view>
+
+#include "gtest/gtest.h"
+#include "./ReceiveBuffer.h"
+#include "./test_suite.h"
+
+using std::string;
+using std::string_view;
+
+namespace hw4 {
+
+TEST(Test_ReceiveBuffer, TestReceiveBufferBasic) {
+  HW4Environment::OpenTestCase();
+  ReceiveBuffer buf;
+  ASSERT_EQ(0U, buf.size());
+  ASSERT_EQ(0U, buf.Scan("\r\n\r\n"));
+
+  // A delimiter that arrives a piece at a time is still found.
+  buf.Append("GET / HTTP/1.1\r\n\r", 17);
+  ASSERT_EQ(0U, buf.Scan("\r\n\r\n"));
+  buf.Append("\nGET /x", 7);
+  ASSERT_EQ(18U, buf.Scan("\r\n\r\n"));
+  string_view first = buf.Take(18);
+  ASSERT_EQ("GET / HTTP/1.1\r\n\r\n", first);
+  ASSERT_EQ(6U, buf.size());
+  ASSERT_EQ(0U, buf.Scan("\r\n\r\n"));
+
+  // Growing the buffer doesn't move bytes that have been taken.
+  size_t old_capacity = buf.capacity();
+  string big(8 * old_capacity, 'x');
+  buf.Append(big.data(), big.size());
+  ASSERT_GT(buf.capacity(), old_capacity);
+  ASSERT_EQ("GET / HTTP/1.1\r\n\r\n", first);
+  buf.Append("\r\n\r\n", 4);
+  ASSERT_EQ(6U + big.size() + 4, buf.Scan("\r\n\r\n"));
+  string_view second = buf.Take(buf.size());
+  ASSERT_EQ("GET /x" + big + "\r\n\r\n", second);
+  ASSERT_EQ(0U, buf.size());
+
+  // Once released and empty, a big block is given back.
+  buf.Release();
+  ASSERT_EQ(0U, buf.capacity());
+
+  // Consumed bytes make room for new ones without growing.
+  buf.Append("abc", 3);
+  size_t capacity = buf.capacity();
+  for (int i = 0; i < 1000; i++) {
+    size_t space;
+    char* dst = buf.PrepareWrite(1000, &space);
+    ASSERT_GE(space, 1000U);
+    memset(dst, 'a' + (i % 26), 1000);
+    buf.CommitWrite(1000);
+    ASSERT_EQ(3U, buf.Take(3).size());
+    ASSERT_EQ(string(997, 'a' + (i % 26)), buf.Take(997));
+    buf.Release();
+  }
+  ASSERT_EQ(capacity, buf.capacity());
+  ASSERT_EQ(3U, buf.size());
+}
+
+}  // namespace hw4
@@ -0,0 +1,125 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./StaticBundle.h"
+#include "./test_suite.h"
+#include "./test_util.h"
+
+using std::string;
+
+namespace hw4 {
+
+// Returns the contents of the file "path".
+static string ReadFile(const string& path) {
+  string contents;
+  int fd = open(path.c_str(), O_RDONLY);
+  char buf[4096];
+  ssize_t res;
+  while (fd != -1 && (res = read(fd, buf, sizeof(buf))) > 0) {
+    contents.append(buf, res);
+  }
+  close(fd);
+  return contents;
+}
+
+TEST(Test_StaticBundle, TestStaticBundleBasic) {
+  HW4Environment::OpenTestCase();
+  TempDir tmp("test_staticbundle");
+  ASSERT_FALSE(tmp.path().empty());
+  string dir = tmp.path() + "/files";
+  ASSERT_EQ(0, mkdir(dir.c_str(), 0700));
+  string sub = dir + "/sub";
+  ASSERT_EQ(0, mkdir(sub.c_str(), 0700));
+  const int kNumFiles = 500;
+  for (int i = 0; i < kNumFiles; i++) {
+    WriteFile(sub + "/file" + std::to_string(i) + ".gif",
+              "GIF" + std::to_string(i));
+  }
+  string page;
+  for (int i = 0; i < 200; i++) {
+    page += "<p>paragraph " + std::to_string(i) + "</p>\n";
+  }
+  WriteFile(dir + "/page.html", page);
+  ASSERT_EQ(0, symlink("page.html", (dir + "/link.html").c_str()));
+
+  string path = dir + ".bundle";
+  ASSERT_TRUE(StaticBundle::Build(dir, path, 1024));
+  StaticBundle bundle;
+  ASSERT_TRUE(bundle.Open(path));
+  ASSERT_EQ(static_cast<uint32_t>(kNumFiles + 1), bundle.num_files());
+
+  // Every file is found, with its contents and type, and only those
+  // worth compressing have compressed copies.
+  StaticBundle::File file;
+  for (int i = 0; i < kNumFiles; i++) {
+    ASSERT_TRUE(bundle.Lookup("sub/file" + std::to_string(i) + ".gif",
+                              &file));
+    ASSERT_EQ("GIF" + std::to_string(i), file.contents);
+    ASSERT_EQ("image/gif", file.content_type);
+    ASSERT_TRUE(file.gzip.empty());
+  }
+  ASSERT_TRUE(bundle.Lookup("page.html", &file));
+  ASSERT_EQ(page, file.contents);
+  ASSERT_EQ("text/html", file.content_type);
+  ASSERT_FALSE(file.gzip.empty());
+  string plain(page.size(), '\0');
+  uLongf plain_size = plain.size();
+  z_stream z = {};
+  ASSERT_EQ(Z_OK, inflateInit2(&z, 15 + 16));
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(file.gzip.data()));
+  z.avail_in = file.gzip.size();
+  z.next_out = reinterpret_cast<Bytef*>(&plain[0]);
+  z.avail_out = plain_size;
+  ASSERT_EQ(Z_STREAM_END, inflate(&z, Z_FINISH));
+  inflateEnd(&z);
+  ASSERT_EQ(page, plain);
+
+  // Contents start on page boundaries.
+  ASSERT_EQ(0U, (file.contents.data() -
+                 static_cast<const char*>(bundle.mapping().get())) % 4096);
+
+  // Names that aren't in the bundle, however close, aren't found, and
+  // neither are symbolic links.
+  ASSERT_FALSE(bundle.Lookup("link.html", &file));
+  ASSERT_FALSE(bundle.Lookup("sub/file500.gif", &file));
+  ASSERT_FALSE(bundle.Lookup("sub/../page.html", &file));
+  ASSERT_FALSE(bundle.Lookup("/page.html", &file));
+  ASSERT_FALSE(bundle.Lookup("", &file));
+
+  // A damaged bundle doesn't open.
+  string contents = ReadFile(path);
+  string bad_path = path + ".bad";
+  WriteFile(bad_path, contents.substr(0, contents.size() - 1));
+  StaticBundle truncated;
+  ASSERT_FALSE(truncated.Open(bad_path));
+  WriteFile(bad_path, "X" + contents.substr(1));
+  StaticBundle bad_magic;
+  ASSERT_FALSE(bad_magic.Open(bad_path));
+
+  // An empty directory makes an empty bundle.
+  string empty = dir + "/empty";
+  ASSERT_EQ(0, mkdir(empty.c_str(), 0700));
+  ASSERT_TRUE(StaticBundle::Build(empty, bad_path, 1024));
+  StaticBundle empty_bundle;
+  ASSERT_TRUE(empty_bundle.Open(bad_path));
+  ASSERT_EQ(0U, empty_bundle.num_files());
+  ASSERT_FALSE(empty_bundle.Lookup("page.html", &file));
+}
+
+}  // namespace hw4
@@ -10,6 +10,7 @@
  */
 
 #include <unistd.h>
+#include <atomic>
 
 #include "gtest/gtest.h"
 extern "C" {
@@ -62,4 +63,114 @@ TEST(Test_ThreadPool, TestThreadPoolBasic) {
   ASSERT_EQ((uint32_t) 300, workcount);
 }
 
+static std::atomic<uint32_t> batchcount(0);
+
+// Counts the tasks that ran.
+void TestBatchTaskFn(ThreadPool::Task* t) {
+  batchcount++;
+  delete t;
+}
+
+TEST(Test_ThreadPool, TestThreadPoolBatchDispatch) {
+  HW4Environment::OpenTestCase();
+  ThreadPool tp(4);
+
+  // Dispatch more tasks than the workers' queues hold, in batches, so
+  // that some of them overflow.
+  const uint32_t kNumTasks = 10000;
+  ThreadPool::Task* batch[100];
+  for (uint32_t i = 0; i < kNumTasks; i += 100) {
+    for (uint32_t j = 0; j < 100; j++) {
+      batch[j] = new ThreadPool::Task(TestBatchTaskFn);
+    }
+    tp.Dispatch(batch, 100);
+  }
+
+  // Every task runs exactly once, without the pool being torn down.
+  for (int i = 0; i < 100 && batchcount < kNumTasks; i++) {
+    usleep(50000);  // 0.05s
+  }
+  ASSERT_EQ(kNumTasks, batchcount.load());
+}
+
+static std::atomic<bool> blocked_release(false);
+static std::atomic<uint32_t> blocked_done(0);
+
+// Blocks until the test releases it.
+void TestBlockedTaskFn(ThreadPool::Task* t) {
+  while (!blocked_release) {
+    usleep(1000);  // 0.001s
+  }
+  blocked_done++;
+  delete t;
+}
+
+TEST(Test_ThreadPool, TestThreadPoolElastic) {
+  HW4Environment::OpenTestCase();
+  ThreadPool tp(1, 8);
+  ASSERT_EQ(1U, tp.num_threads());
+
+  // Tie up the only worker and leave more tasks waiting behind it; the
+  // pool should grow to run them.
+  for (int i = 0; i < 8; i++) {
+    tp.Dispatch(new ThreadPool::Task(TestBlockedTaskFn));
+  }
+  for (int i = 0; i < 100 && tp.num_threads() < 8; i++) {
+    usleep(20000);  // 0.02s
+  }
+  ASSERT_EQ(8U, tp.num_threads());
+
+  blocked_release = true;
+  for (int i = 0; i < 100 && blocked_done < 8; i++) {
+    usleep(20000);  // 0.02s
+  }
+  ASSERT_EQ(8U, blocked_done.load());
+}
+
+static std::atomic<bool> gate_open(false);
+static std::atomic<uint32_t> gated_done(0);
+static std::atomic<uint64_t> gated_max_wait_ns(0);
+
+// Waits for the gate, and records the longest queue wait seen.
+void TestGatedTaskFn(ThreadPool::Task* t) {
+  uint64_t wait = t->queue_wait_ns();
+  uint64_t prev = gated_max_wait_ns.load();
+  while (wait > prev && !gated_max_wait_ns.compare_exchange_weak(prev, wait)) {
+  }
+  while (!gate_open) {
+    usleep(1000);  // 0.001s
+  }
+  gated_done++;
+  delete t;
+}
+
+TEST(Test_ThreadPool, TestThreadPoolHighWaterMark) {
+  HW4Environment::OpenTestCase();
+  ThreadPool tp(1);
+  tp.set_high_water_mark(2);
+
+  // Tie up the worker, then fill the queue to the high-water mark.
+  ASSERT_TRUE(tp.TryDispatch(new ThreadPool::Task(TestGatedTaskFn)));
+  for (int i = 0; i < 100 && tp.num_queued() > 0; i++) {
+    usleep(10000);  // 0.01s
+  }
+  ASSERT_TRUE(tp.TryDispatch(new ThreadPool::Task(TestGatedTaskFn)));
+  ASSERT_TRUE(tp.TryDispatch(new ThreadPool::Task(TestGatedTaskFn)));
+  ASSERT_EQ(2U, tp.num_queued());
+
+  // The next one is refused, and stays ours.
+  ThreadPool::Task refused(TestGatedTaskFn);
+  ASSERT_FALSE(tp.TryDispatch(&refused));
+
+  usleep(20000);  // 0.02s
+  gate_open = true;
+  for (int i = 0; i < 100 && gated_done < 3; i++) {
+    usleep(10000);  // 0.01s
+  }
+  ASSERT_EQ(3U, gated_done.load());
+
+  // The queued tasks waited behind the first one.
+  ASSERT_GE(gated_max_wait_ns.load(), 20000000ULL);
+}
+
 }  // namespace hw4
@@ -0,0 +1,67 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./TimerWheel.h"
+#include "./test_suite.h"
+
+using std::vector;
+
+namespace hw4 {
+
+TEST(Test_TimerWheel, TestTimerWheelBasic) {
+  HW4Environment::OpenTestCase();
+  // 8 slots of 10ms: one turn of the wheel is 80ms.
+  TimerWheel wheel(8, 10, 1000);
+  vector<uint64_t> expired;
+  ASSERT_EQ(-1, wheel.timeout_ms());
+
+  wheel.Schedule(1, 1025);
+  wheel.Schedule(2, 1050);
+  wheel.Schedule(3, 1050);
+  wheel.Schedule(4, 1300);  // more than one turn away
+  ASSERT_EQ(4U, wheel.size());
+  ASSERT_EQ(10, wheel.timeout_ms());
+
+  // Nothing fires early.
+  wheel.Expire(1020, &expired);
+  ASSERT_TRUE(expired.empty());
+  wheel.Expire(1030, &expired);
+  ASSERT_EQ(vector<uint64_t>({1}), expired);
+  expired.clear();
+
+  // Cancelled and rescheduled timers don't fire at their old deadlines.
+  wheel.Cancel(2);
+  wheel.Schedule(3, 1200);
+  wheel.Expire(1100, &expired);
+  ASSERT_TRUE(expired.empty());
+  ASSERT_EQ(2U, wheel.size());
+
+  // Skipping far ahead still finds everything that came due, including
+  // the timer that waited out several turns of the wheel.
+  wheel.Expire(2000, &expired);
+  std::sort(expired.begin(), expired.end());
+  ASSERT_EQ(vector<uint64_t>({3, 4}), expired);
+  ASSERT_EQ(0U, wheel.size());
+  ASSERT_EQ(-1, wheel.timeout_ms());
+
+  // A deadline that has already passed fires on the next tick.
+  expired.clear();
+  wheel.Schedule(5, 1500);
+  wheel.Expire(2010, &expired);
+  ASSERT_EQ(vector<uint64_t>({5}), expired);
+}
+
+}  // namespace hw4
@@ -0,0 +1,142 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include "./test_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./HttpUtils.h"
+
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+// How long to wait for a server before giving up on it.
+static const int kReadTimeoutMs = 5000;
+
+// nftw() callback that removes each file and directory it visits.
+static int RemoveEntry(const char* path, const struct stat* st, int type,
+                       struct FTW* ftw) {
+  return remove(path);
+}
+
+TempDir::TempDir(const string& prefix) {
+  string tmpl = "/tmp/" + prefix + ".XXXXXX";
+  vector<char> buf(tmpl.begin(), tmpl.end());
+  buf.push_back('\0');
+  if (mkdtemp(buf.data()) != nullptr) {
+    path_ = buf.data();
+  }
+}
+
+TempDir::~TempDir() {
+  // Children before their parents, and without following links.
+  if (!path_.empty()) {
+    nftw(path_.c_str(), &RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+}
+
+void WriteFile(const string& path, const string& contents) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(static_cast<ssize_t>(contents.size()),
+            write(fd, contents.data(), contents.size()));
+  close(fd);
+}
+
+bool Send(int fd, const string& data) {
+  return WrappedWrite(fd, reinterpret_cast<const unsigned char*>(data.data()),
+                      data.size()) == static_cast<int>(data.size());
+}
+
+bool ReadUntilClosed(int fd, string* data) {
+  char buf[4096];
+  while (1) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, kReadTimeoutMs) != 1)
+      return false;
+    ssize_t res = read(fd, buf, sizeof(buf));
+    if (res == 0)
+      return true;
+    if (res == -1)
+      return errno == ECONNRESET;
+    data->append(buf, res);
+  }
+}
+
+string ReadResponse(int fd) {
+  string data;
+  char buf[4096];
+  size_t header_end, body_len;
+  while (1) {
+    header_end = data.find("\r\n\r\n");
+    if (header_end != string::npos) {
+      size_t pos = data.find("Content-length: ");
+      if (pos == string::npos || pos > header_end)
+        return "";
+      body_len = strtoul(data.c_str() + pos + 16, nullptr, 10);
+      if (data.size() >= header_end + 4 + body_len)
+        return data;
+    }
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, kReadTimeoutMs) != 1)
+      return "";
+    ssize_t res = read(fd, buf, sizeof(buf));
+    if (res <= 0)
+      return "";
+    data.append(buf, res);
+  }
+}
+
+bool Exchange(int fd, const string& data, string* resp) {
+  size_t sent = 0;
+  char buf[65536];
+  while (1) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (sent < data.size()) {
+      pfd.events |= POLLOUT;
+    }
+    if (poll(&pfd, 1, kReadTimeoutMs) != 1)
+      return false;
+    if (pfd.revents & POLLOUT) {
+      ssize_t res = send(fd, data.data() + sent, data.size() - sent,
+                         MSG_DONTWAIT);
+      if (res == -1 && errno != EAGAIN)
+        return false;
+      if (res > 0) {
+        sent += res;
+      }
+    }
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t res = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (res == 0)
+        return sent == data.size();
+      if (res == -1 && errno != EAGAIN)
+        return false;
+      if (res > 0) {
+        resp->append(buf, res);
+      }
+    }
+  }
+}
+
+}  // namespace hw4
@@ -0,0 +1,57 @@
+/*
+ * Copyright ©2024 Hannah C. Tang.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2024 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_TEST_UTIL_H_
+#define HW4_TEST_UTIL_H_
+
+#include <string>
+
+namespace hw4 {
+
+// A fresh directory under /tmp for a test's files, removed along with
+// everything in it when the TempDir is destroyed.
+class TempDir {
+ public:
+  // Creates "/tmp/<prefix>.XXXXXX"; path() is empty if that fails.
+  explicit TempDir(const std::string& prefix);
+  ~TempDir();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+// Write "contents" to the file "path", replacing whatever was there.
+// Fails the current test if it can't.
+void WriteFile(const std::string& path, const std::string& contents);
+
+// Send all of "data" on "fd".
+bool Send(int fd, const std::string& data);
+
+// Append whatever arrives on "fd" to "data" until the server closes
+// the connection (returning true), or until nothing has come for a
+// while (returning false).
+bool ReadUntilClosed(int fd, std::string* data);
+
+// Read one response from "fd", which must have a "Content-length:"
+// header, and nothing after it.  Returns "" on failure.
+std::string ReadResponse(int fd);
+
+// Send all of "data" on "fd" while appending whatever comes back to
+// "resp", so that a server that stops reading until its responses are
+// read doesn't deadlock us.  Returns true once the server closes the
+// connection.
+bool Exchange(int fd, const std::string& data, std::string* resp);
+
+}  // namespace hw4
+
+#endif  // HW4_TEST_UTIL_H_